@@ -0,0 +1,523 @@
+#pragma once
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <string>
+#include <vector>
+#include "compare.h"
+
+// The cache is a memory-mapped file shared between processes, which needs mmap and flock.
+// Elsewhere ResultCache never opens, and every file is analyzed as if it were new.
+#ifndef _WIN32
+#define MONOC_CACHE 1
+#include <fcntl.h>
+#include <limits.h>
+#include <stdlib.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+/**
+ * Scrambles the bits of x so that every bit of the result depends on every bit of x.
+ */
+uint64_t mixBits(uint64_t x) {
+    x ^= x >> 33;
+    x *= 0xFF51AFD7ED558CCDull;
+    x ^= x >> 33;
+    x *= 0xC4CEB9FE1A85EC53ull;
+    x ^= x >> 33;
+    return x;
+}
+
+/**
+ * Returns a 64-bit hash of size bytes, a word at a time. Hashing a long run of bytes in pieces,
+ * with each piece's seed the hash of the one before, gives one hash for all of it.
+ */
+uint64_t hashBytes(const void *data, size_t size, uint64_t seed = 0) {
+    const uint64_t prime = 0x9E3779B97F4A7C15ull;
+    const uint8_t *bytes = (const uint8_t *)data;
+    uint64_t hash = seed ^ (size * prime);
+    size_t i = 0;
+    for (; i + 8 <= size; i += 8) {
+        uint64_t word;
+        memcpy(&word, bytes + i, sizeof(word));
+        hash = (hash ^ mixBits(word)) * prime;
+    }
+    uint64_t tail = 0;
+    memcpy(&tail, bytes + i, size - i);
+    return mixBits(hash ^ tail);
+}
+
+/**
+ * Hashes the whole contents of a file, a block at a time.
+ * Returns false if the file couldn't be read.
+ */
+bool hashFile(const std::string &path, uint64_t &hash) {
+    std::ifstream in(path, std::ios::binary);
+    if (!in.good()) {
+        return false;
+    }
+    std::vector<char> block(1 << 20);
+    hash = 0;
+    while (in) {
+        in.read(block.data(), block.size());
+        std::streamsize numRead = in.gcount();
+        if (numRead <= 0) {
+            break;
+        }
+        hash = hashBytes(block.data(), (size_t)numRead, hash);
+    }
+    return !in.bad();
+}
+
+// Which version of which file an analysis is for. A file that is written to again gets a new
+// modification time, so its old analysis no longer matches.
+struct FileKey {
+    uint64_t device = 0;
+    uint64_t inode = 0;
+    uint64_t size = 0;
+    int64_t modified = 0; // Modification time, in nanoseconds since the epoch
+    uint64_t settings = 0; // Hash of the settings the file was analyzed with, as an analysis only holds for those
+};
+
+/**
+ * Fills in the key of a file from its metadata, without reading any of it.
+ * Returns false if the file can't be looked at, or the platform has no cache.
+ */
+bool getFileKey(const std::string &path, uint64_t settings, FileKey &key) {
+#ifdef MONOC_CACHE
+    struct stat info;
+    if (stat(path.c_str(), &info) != 0) {
+        return false;
+    }
+    key.device = (uint64_t)info.st_dev;
+    key.inode = (uint64_t)info.st_ino;
+    key.size = (uint64_t)info.st_size;
+#ifdef __APPLE__
+    key.modified = (int64_t)info.st_mtimespec.tv_sec * 1000000000 + info.st_mtimespec.tv_nsec;
+#else
+    key.modified = (int64_t)info.st_mtim.tv_sec * 1000000000 + info.st_mtim.tv_nsec;
+#endif
+    key.settings = settings;
+    return true;
+#else
+    return false;
+#endif
+}
+
+// Files with more channels than this aren't cached, their groups wouldn't fit in an entry.
+const int MaxCachedChannels = 32;
+// Files with paths this long or longer aren't cached, their path wouldn't fit in an entry.
+const size_t MaxCachedPath = 256;
+
+// What analyzing a file found, as kept in the cache.
+struct CachedAnalysis {
+    uint64_t contentHash = 0; // Hash of the file's bytes, 0 if it wasn't hashed
+    int32_t result = 0; // An AudioResult
+    int32_t numChannels = 0;
+    int8_t groups[MaxCachedChannels] = {}; // The group of identical channels each channel is in
+    int32_t measured = 0; // Whether differences were measured
+    double gain = 1;
+    int64_t offset = 0;
+    DifferenceStats differences;
+};
+
+/**
+ * A persistent table of file analyses, kept in a memory-mapped file so that a run over files that haven't
+ * changed since the last one finds each of their results with a single hash table lookup.
+ *
+ * Any number of threads and processes can look up and store at once. Each slot starts with a check word:
+ * 0 for an empty slot, 1 while a writer has it, otherwise a hash of the rest of the slot that the writer
+ * stores last. Readers copy a slot and only trust it if the copy hashes to its check word, so a slot that
+ * is being written, or was half written when a process or the machine crashed, is never read as a result.
+ *
+ * Each file has at most one entry, found from its device, inode and settings, which storing a newer version of
+ * the file replaces. The entry also keeps the file's path, so a rebuild can tell which files are gone or changed.
+ *
+ * The header counts the processes using the cache. Whoever opens it while nobody else has it open checks it:
+ * a cache still counting users, so one of them crashed, or that is too full, is rebuilt into a new file that
+ * then replaces the old one. Only the good entries of files that are still there, unchanged, are kept.
+ * The table doesn't grow while it's open. Once it's three quarters full new files just aren't stored.
+ */
+class ResultCache {
+public:
+    ~ResultCache() {
+        close();
+    }
+
+    /**
+     * Opens the cache at path, making it if it doesn't exist, with room for at least minSlots files.
+     * Returns false if the cache can't be used, in which case lookups miss and stores do nothing.
+     */
+    bool open(const std::string &cachePath, size_t minSlots = 0) {
+        close();
+#ifdef MONOC_CACHE
+        path = cachePath;
+        size_t wantedSlots = 1024;
+        while (wantedSlots < minSlots) {
+            wantedSlots *= 2;
+        }
+        // Only retried when another process put a rebuilt cache in place while this one was opening it
+        for (int attempt = 0; attempt < 8; attempt++) {
+            int file = ::open(path.c_str(), O_RDWR | O_CREAT, 0666);
+            if (file < 0) {
+                return false;
+            }
+            if (flock(file, LOCK_EX | LOCK_NB) == 0) {
+                // Nobody else has the cache open, so it can be checked and rebuilt
+                if (isCurrent(file)) {
+                    file = prepare(file, wantedSlots);
+                    if (file < 0) {
+                        return false;
+                    }
+                }
+            }
+            // Turns the exclusive lock into a shared one, or waits for whoever is rebuilding the cache
+            flock(file, LOCK_SH);
+            if (!isCurrent(file)) {
+                ::close(file);
+                continue;
+            }
+            if (!mapFile(file)) {
+                ::close(file);
+                return false;
+            }
+            fd = file;
+            __atomic_fetch_add(&getHeader()->numUsers, 1, __ATOMIC_ACQ_REL);
+            return true;
+        }
+#else
+        (void)cachePath;
+        (void)minSlots;
+#endif
+        return false;
+    }
+
+    /**
+     * Closes the cache. The last process to close it writes it to the disk.
+     */
+    void close() {
+#ifdef MONOC_CACHE
+        if (map == nullptr) {
+            return;
+        }
+        if (__atomic_sub_fetch(&getHeader()->numUsers, 1, __ATOMIC_ACQ_REL) == 0) {
+            msync(map, mapBytes, MS_SYNC);
+        }
+        munmap(map, mapBytes);
+        ::close(fd);
+        map = nullptr;
+        fd = -1;
+#endif
+    }
+
+    bool isOpen() const {
+        return map != nullptr;
+    }
+
+    /**
+     * Looks up the analysis of a version of a file. If contentHash isn't 0, the analysis also has to be of
+     * a file with that hash. Returns true, and sets analysis, on a hit.
+     */
+    bool lookup(const FileKey &key, uint64_t contentHash, CachedAnalysis &analysis) {
+        numLookups++;
+#ifdef MONOC_CACHE
+        if (map == nullptr) {
+            return false;
+        }
+        size_t mask = numSlots - 1;
+        size_t home = homeSlot(key);
+        for (size_t probe = 0; probe < numSlots; probe++) {
+            CacheEntry *slot = getSlot((home + probe) & mask);
+            uint64_t check = loadCheck(slot);
+            if (check == EmptySlot) {
+                return false;
+            }
+            CacheEntry entry;
+            if (check == BusySlot || !readSlot(slot, check, entry) || !sameKey(entry.key, key)) {
+                continue;
+            }
+            if (contentHash != 0 && entry.analysis.contentHash != contentHash) {
+                return false;
+            }
+            analysis = entry.analysis;
+            numHits++;
+            return true;
+        }
+#else
+        (void)key;
+        (void)contentHash;
+        (void)analysis;
+#endif
+        return false;
+    }
+
+    /**
+     * Stores the analysis of a version of the file at file, replacing the entry of any earlier version.
+     * Returns false if it wasn't stored, because the cache isn't open or is too full, or the path is too long.
+     */
+    bool store(const FileKey &key, const std::string &file, const CachedAnalysis &analysis) {
+#ifdef MONOC_CACHE
+        // The full path, so a rebuild run from another folder still finds the file
+        char fullPath[PATH_MAX];
+        std::string stored = realpath(file.c_str(), fullPath) != nullptr ? fullPath : file;
+        if (map == nullptr || stored.size() >= MaxCachedPath) {
+            return false;
+        }
+        // Cleared first so the padding between fields is the same every time the entry is hashed
+        CacheEntry entry;
+        memset((void *)&entry, 0, sizeof(entry));
+        entry.key = key;
+        memcpy(entry.path, stored.c_str(), stored.size());
+        entry.analysis = analysis;
+        entry.check = checksum(entry);
+
+        CacheHeader *header = getHeader();
+        size_t mask = numSlots - 1;
+        size_t home = homeSlot(key);
+        size_t probe = 0;
+        while (probe < numSlots) {
+            CacheEntry *slot = getSlot((home + probe) & mask);
+            uint64_t check = loadCheck(slot);
+            bool empty = check == EmptySlot;
+            if (empty) {
+                if (__atomic_load_n(&header->numEntries, __ATOMIC_RELAXED) * 4 >= numSlots * 3) {
+                    return false;
+                }
+            } else {
+                CacheEntry old;
+                if (check == BusySlot || !readSlot(slot, check, old) || !sameFile(old.key, key)) {
+                    probe++;
+                    continue;
+                }
+            }
+            // Claim the slot, unless another writer changed it first, in which case look at it again
+            if (__atomic_compare_exchange_n(&slot->check, &check, BusySlot, false, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) {
+                memcpy((uint8_t *)slot + sizeof(slot->check), (const uint8_t *)&entry + sizeof(entry.check), sizeof(entry) - sizeof(entry.check));
+                __atomic_store_n(&slot->check, entry.check, __ATOMIC_RELEASE);
+                if (empty) {
+                    __atomic_fetch_add(&header->numEntries, 1, __ATOMIC_RELAXED);
+                }
+                return true;
+            }
+        }
+#else
+        (void)key;
+        (void)file;
+        (void)analysis;
+#endif
+        return false;
+    }
+
+    /**
+     * Returns the number of lookups since the cache was opened.
+     */
+    size_t getNumLookups() const {
+        return numLookups;
+    }
+
+    /**
+     * Returns the number of lookups that found an analysis since the cache was opened.
+     */
+    size_t getNumHits() const {
+        return numHits;
+    }
+
+private:
+    struct CacheHeader {
+        char magic[8];
+        uint32_t entrySize; // sizeof(CacheEntry) of the build that made the cache, other builds rebuild it
+        uint32_t numUsers; // Processes that have the cache open, or had it open when they crashed
+        uint64_t numSlots; // A power of two
+        uint64_t numEntries;
+    };
+
+    struct CacheEntry {
+        uint64_t check;
+        FileKey key;
+        char path[MaxCachedPath]; // The file's path when it was stored, ending in a 0
+        CachedAnalysis analysis;
+    };
+
+    static const size_t HeaderBytes = 64;
+    static const uint64_t EmptySlot = 0;
+    static const uint64_t BusySlot = 1;
+
+    /**
+     * Returns the check word for an entry, a hash of everything after it that is never EmptySlot or BusySlot.
+     */
+    static uint64_t checksum(const CacheEntry &entry) {
+        uint64_t hash = hashBytes((const uint8_t *)&entry + sizeof(entry.check), sizeof(entry) - sizeof(entry.check));
+        return hash <= BusySlot ? hash + 2 : hash;
+    }
+
+    static bool sameKey(const FileKey &a, const FileKey &b) {
+        return sameFile(a, b) && a.size == b.size && a.modified == b.modified;
+    }
+
+    /**
+     * Returns true if two keys are for the same file and settings, whichever version of the file they are for.
+     */
+    static bool sameFile(const FileKey &a, const FileKey &b) {
+        return a.device == b.device && a.inode == b.inode && a.settings == b.settings;
+    }
+
+    /**
+     * Returns where probing for a key's file starts. It leaves out the size and time, so every version of a file
+     * probes the same slots and a newer one finds the older one to replace.
+     */
+    static size_t homeSlot(const FileKey &key) {
+        uint64_t file[3] = {key.device, key.inode, key.settings};
+        return (size_t)hashBytes(file, sizeof(file));
+    }
+
+    /**
+     * Copies a slot whose check word was check. Returns false if the copy isn't a whole entry.
+     */
+    static bool readSlot(const CacheEntry *slot, uint64_t check, CacheEntry &entry) {
+        memcpy(&entry, slot, sizeof(entry));
+        return entry.check == check && checksum(entry) == check;
+    }
+
+    CacheHeader *getHeader() const {
+        return (CacheHeader *)map;
+    }
+
+    CacheEntry *getSlot(size_t index) const {
+        return (CacheEntry *)(map + HeaderBytes) + index;
+    }
+
+#ifdef MONOC_CACHE
+    static uint64_t loadCheck(CacheEntry *slot) {
+        return __atomic_load_n(&slot->check, __ATOMIC_ACQUIRE);
+    }
+
+    /**
+     * Returns true if an open file is still the one at the cache's path, and hasn't been replaced by a rebuild.
+     */
+    bool isCurrent(int file) const {
+        struct stat opened, named;
+        return fstat(file, &opened) == 0 && stat(path.c_str(), &named) == 0
+            && opened.st_dev == named.st_dev && opened.st_ino == named.st_ino;
+    }
+
+    /**
+     * Maps a cache file that has been checked by prepare. Returns false if it isn't a cache this build can use.
+     */
+    bool mapFile(int file) {
+        struct stat info;
+        CacheHeader header;
+        if (fstat(file, &info) != 0 || pread(file, &header, sizeof(header), 0) != (ssize_t)sizeof(header)) {
+            return false;
+        }
+        if (memcmp(header.magic, "MONOCRC2", 8) != 0 || header.entrySize != sizeof(CacheEntry)
+            || (uint64_t)info.st_size != HeaderBytes + header.numSlots * sizeof(CacheEntry)) {
+            return false;
+        }
+        void *mapped = mmap(nullptr, (size_t)info.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, file, 0);
+        if (mapped == MAP_FAILED) {
+            return false;
+        }
+        map = (uint8_t *)mapped;
+        mapBytes = (size_t)info.st_size;
+        numSlots = (size_t)header.numSlots;
+        return true;
+    }
+
+    /**
+     * With the cache locked so nobody else has it open, checks it and rebuilds it if it still counts users,
+     * is more than half full, or has fewer than wantedSlots slots.
+     * Returns the file to use, which is a new one still locked if the cache was rebuilt, or -1 on failure.
+     */
+    int prepare(int file, size_t wantedSlots) {
+        struct stat info;
+        CacheHeader header;
+        memset(&header, 0, sizeof(header));
+        bool valid = fstat(file, &info) == 0 && pread(file, &header, sizeof(header), 0) == (ssize_t)sizeof(header)
+            && memcmp(header.magic, "MONOCRC2", 8) == 0 && header.entrySize == sizeof(CacheEntry)
+            && header.numSlots > 0 && (uint64_t)info.st_size == HeaderBytes + header.numSlots * sizeof(CacheEntry);
+        if (valid && header.numUsers == 0 && header.numEntries * 2 <= header.numSlots && header.numSlots >= wantedSlots) {
+            return file;
+        }
+
+        // Keep the good entries of the old cache, if it is one, for files that are still there as they were stored
+        std::vector<CacheEntry> entries;
+        if (valid) {
+            void *old = mmap(nullptr, (size_t)info.st_size, PROT_READ, MAP_SHARED, file, 0);
+            if (old != MAP_FAILED) {
+                const CacheEntry *slots = (const CacheEntry *)((const uint8_t *)old + HeaderBytes);
+                for (size_t i = 0; i < header.numSlots; i++) {
+                    CacheEntry entry;
+                    FileKey current;
+                    if (slots[i].check > BusySlot && readSlot(&slots[i], slots[i].check, entry)
+                        && getFileKey(entry.path, entry.key.settings, current) && sameKey(current, entry.key)) {
+                        entries.push_back(entry);
+                    }
+                }
+                munmap(old, (size_t)info.st_size);
+            }
+        }
+        size_t newSlots = wantedSlots;
+        while (entries.size() * 4 > newSlots) {
+            newSlots *= 2;
+        }
+
+        // Build the new cache next to the old one, make sure it's on the disk, then put it in its place
+        std::string building = path + ".new" + std::to_string((long long)getpid());
+        int newFile = ::open(building.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0666);
+        size_t newBytes = HeaderBytes + newSlots * sizeof(CacheEntry);
+        if (newFile < 0 || flock(newFile, LOCK_EX) != 0 || ftruncate(newFile, (off_t)newBytes) != 0) {
+            if (newFile >= 0) {
+                ::close(newFile);
+                unlink(building.c_str());
+            }
+            ::close(file);
+            return -1;
+        }
+        void *mapped = mmap(nullptr, newBytes, PROT_READ | PROT_WRITE, MAP_SHARED, newFile, 0);
+        if (mapped == MAP_FAILED) {
+            ::close(newFile);
+            unlink(building.c_str());
+            ::close(file);
+            return -1;
+        }
+        CacheHeader *newHeader = (CacheHeader *)mapped;
+        memcpy(newHeader->magic, "MONOCRC2", 8);
+        newHeader->entrySize = sizeof(CacheEntry);
+        newHeader->numUsers = 0;
+        newHeader->numSlots = newSlots;
+        newHeader->numEntries = entries.size();
+        CacheEntry *slots = (CacheEntry *)((uint8_t *)mapped + HeaderBytes);
+        for (size_t i = 0; i < entries.size(); i++) {
+            size_t index = homeSlot(entries[i].key) & (newSlots - 1);
+            while (slots[index].check != EmptySlot) {
+                index = (index + 1) & (newSlots - 1);
+            }
+            slots[index] = entries[i];
+        }
+        bool written = msync(mapped, newBytes, MS_SYNC) == 0 && fsync(newFile) == 0;
+        munmap(mapped, newBytes);
+        if (!written || rename(building.c_str(), path.c_str()) != 0) {
+            ::close(newFile);
+            unlink(building.c_str());
+            ::close(file);
+            return -1;
+        }
+        ::close(file);
+        return newFile;
+    }
+
+    int fd = -1;
+#endif
+
+    std::string path;
+    uint8_t *map = nullptr;
+    size_t mapBytes = 0;
+    size_t numSlots = 0;
+    std::atomic<size_t> numLookups{0};
+    std::atomic<size_t> numHits{0};
+};
@@ -0,0 +1,110 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+/**
+ * Sorts the channels of a file into groups of identical channels, reading the interleaved frames a block at a time.
+ * All channels start out in one group. After each block a channel only stays grouped with the channels
+ * whose sample bytes have matched its own in every block so far.
+ * Every channel's samples in a block are hashed, so channels are only compared sample by sample
+ * with a channel that has the same hash, never with every other channel.
+ */
+class ChannelGroups {
+public:
+    explicit ChannelGroups(int numChannels)
+        : groups(numChannels, 0), representatives(1, 0), hashes(numChannels), numChannels(numChannels) {}
+
+    /**
+     * Splits the groups up by the samples of another block of numFrames frames.
+     */
+    void addFrames(const uint8_t *frames, size_t numFrames, int numBytesPerSample, int numBytesPerFrame) {
+        hashFrames(frames, numFrames, numBytesPerSample, numBytesPerFrame);
+
+        // A channel keeps to a new group only with channels from its old group with the same hash and the same samples
+        std::vector<int> newGroups(numChannels);
+        std::vector<int> newRepresentatives;
+        for (int channel = 0; channel < numChannels; channel++) {
+            int group = -1;
+            for (size_t g = 0; g < newRepresentatives.size() && group < 0; g++) {
+                int representative = newRepresentatives[g];
+                if (groups[representative] == groups[channel] && hashes[representative] == hashes[channel]
+                    && sameSamples(frames, numFrames, numBytesPerSample, numBytesPerFrame, representative, channel)) {
+                    group = (int)g;
+                }
+            }
+            if (group < 0) {
+                group = (int)newRepresentatives.size();
+                newRepresentatives.push_back(channel);
+            }
+            newGroups[channel] = group;
+        }
+        groups.swap(newGroups);
+        representatives.swap(newRepresentatives);
+    }
+
+    /**
+     * Returns the group of each channel. Groups are numbered in the order of their first channels.
+     */
+    const std::vector<int> &getGroups() const {
+        return groups;
+    }
+
+    /**
+     * Returns the first channel of each group, which are the channels to keep to lose no information.
+     */
+    const std::vector<int> &getRepresentatives() const {
+        return representatives;
+    }
+
+    int getNumGroups() const {
+        return (int)representatives.size();
+    }
+
+    /**
+     * Returns true once every channel is in a group of its own, after which more frames can't change anything.
+     */
+    bool allDistinct() const {
+        return getNumGroups() == numChannels;
+    }
+
+private:
+    /**
+     * Hashes the samples of each channel in a block with FNV-1a, taking a whole sample at a time.
+     */
+    void hashFrames(const uint8_t *frames, size_t numFrames, int numBytesPerSample, int numBytesPerFrame) {
+        const uint64_t offsetBasis = 0xcbf29ce484222325ULL;
+        const uint64_t prime = 0x100000001b3ULL;
+        for (int channel = 0; channel < numChannels; channel++) {
+            hashes[channel] = offsetBasis;
+        }
+        for (size_t i = 0; i < numFrames; i++) {
+            const uint8_t *frame = frames + i * numBytesPerFrame;
+            for (int channel = 0; channel < numChannels; channel++) {
+                uint32_t sample = 0;
+                memcpy(&sample, frame + channel * numBytesPerSample, numBytesPerSample < 4 ? numBytesPerSample : 4);
+                hashes[channel] = (hashes[channel] ^ sample) * prime;
+            }
+        }
+    }
+
+    /**
+     * Returns true if two channels have byte-for-byte the same samples in a block.
+     */
+    static bool sameSamples(const uint8_t *frames, size_t numFrames, int numBytesPerSample, int numBytesPerFrame, int a, int b) {
+        const uint8_t *sampleA = frames + a * numBytesPerSample;
+        const uint8_t *sampleB = frames + b * numBytesPerSample;
+        for (size_t i = 0; i < numFrames; i++) {
+            if (memcmp(sampleA + i * numBytesPerFrame, sampleB + i * numBytesPerFrame, numBytesPerSample) != 0) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    std::vector<int> groups;
+    std::vector<int> representatives;
+    std::vector<uint64_t> hashes;
+    int numChannels;
+};
@@ -0,0 +1,314 @@
+/**
+    Mono Catcher command line tool
+    Runs the same processing as the window app with no window, for servers and scripts.
+*/
+#include "monoc.h"
+#include <algorithm>
+#include <csignal>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+#ifdef _WIN32
+#include <direct.h>
+#include <windows.h>
+#else
+#include <glob.h>
+#include <sys/stat.h>
+#endif
+using std::string;
+using std::vector;
+
+/**
+ * Prints how to use the tool.
+ */
+void printUsage(const char *program) {
+    printf("Usage: %s [options] -o <folder> <file, glob or folder>...\n", program);
+    printf("       %s [options] -o <folder> -w <folder>...\n", program);
+    printf("       %s [options] --dry-run --report <file> <file, glob or folder>...\n", program);
+    printf("Saves the fake stereo files among the input files as mono to the output folder, and copies the rest.\n\n");
+    printf("  -o, --output <folder>    Folder the processed files are saved to, made if it doesn't exist\n");
+    printf("  -m, --manifest <file>    Also process the files listed in a text file, one per line, - for stdin\n");
+    printf("  -r, --recursive          Process the WAV and AIFF files in folders given as inputs, and in their subfolders\n");
+    printf("  -w, --watch <folder>     Keep running, and process the files written to this folder as they arrive\n");
+    printf("  -j, --threads <n>        Number of files processed at once, 0 for one per hardware thread (default)\n");
+    printf("      --mode <mode>        tolerant compares decoded samples (default), exact compares the raw bytes\n");
+    printf("      --report <file>      Write a report of every file processed, as JSON lines if it ends in .json or .ndjson,\n");
+    printf("                           CSV if it ends in .csv, and text otherwise\n");
+    printf("      --dry-run            Analyze every file, but save nothing, and don't need an output folder\n");
+    printf("      --cache <file>       Keep results in a cache file, and skip analyzing files that haven't changed since\n");
+    printf("      --hash               Also check the contents of cached files, not just their size and time\n");
+    printf("  -h, --help               Show this message\n");
+}
+
+/**
+ * Returns true if a path has glob wildcards in it.
+ */
+bool isPattern(const string &path) {
+    return path.find_first_of("*?[") != string::npos;
+}
+
+/**
+ * Adds the files matching a glob pattern to files, in sorted order.
+ * Shells usually expand globs themselves, this is for quoted patterns and shells that don't.
+ * Returns false if nothing matched.
+ */
+bool addMatches(const string &pattern, vector<string> &files) {
+#ifdef _WIN32
+    // FindFirstFile only matches the last part of the path, the rest is the folder the matches are in
+    size_t slash = pattern.find_last_of("/\\");
+    string folder = slash == string::npos ? "" : pattern.substr(0, slash + 1);
+    WIN32_FIND_DATAA found;
+    HANDLE search = FindFirstFileA(pattern.c_str(), &found);
+    if (search == INVALID_HANDLE_VALUE) {
+        return false;
+    }
+    size_t first = files.size();
+    do {
+        if ((found.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) == 0) {
+            files.push_back(folder + found.cFileName);
+        }
+    } while (FindNextFileA(search, &found));
+    FindClose(search);
+    std::sort(files.begin() + first, files.end());
+    return files.size() > first;
+#else
+    glob_t matches;
+    if (glob(pattern.c_str(), 0, nullptr, &matches) != 0) {
+        globfree(&matches);
+        return false;
+    }
+    for (size_t i = 0; i < matches.gl_pathc; i++) {
+        files.push_back(matches.gl_pathv[i]);
+    }
+    globfree(&matches);
+    return true;
+#endif
+}
+
+/**
+ * Returns true if a path is a folder.
+ */
+bool isFolder(const string &path) {
+#ifdef _WIN32
+    DWORD attributes = GetFileAttributesA(path.c_str());
+    return attributes != INVALID_FILE_ATTRIBUTES && (attributes & FILE_ATTRIBUTE_DIRECTORY) != 0;
+#else
+    struct stat info;
+    return stat(path.c_str(), &info) == 0 && S_ISDIR(info.st_mode);
+#endif
+}
+
+/**
+ * Adds an input to files: a path as it is, or the files a glob matches. Folders are added to folders instead.
+ */
+void addInput(const string &input, vector<string> &files, vector<string> &folders) {
+    if (isFolder(input)) {
+        folders.push_back(input);
+    } else if (!isPattern(input)) {
+        files.push_back(input);
+    } else if (!addMatches(input, files)) {
+        fprintf(stderr, "No files match %s\n", input.c_str());
+    }
+}
+
+/**
+ * Adds the inputs listed in a manifest to files, one per line. Blank lines and lines starting with # are skipped.
+ * Returns false if the manifest couldn't be read.
+ */
+bool addManifest(const string &manifest, vector<string> &files, vector<string> &folders) {
+    std::ifstream file;
+    if (manifest != "-") {
+        file.open(manifest);
+        if (!file.good()) {
+            return false;
+        }
+    }
+    std::istream &in = manifest == "-" ? std::cin : file;
+    string line;
+    while (std::getline(in, line)) {
+        // Lists written on Windows end their lines with \r\n
+        if (!line.empty() && line.back() == '\r') {
+            line.pop_back();
+        }
+        if (line.empty() || line[0] == '#') {
+            continue;
+        }
+        addInput(line, files, folders);
+    }
+    return true;
+}
+
+/**
+ * Makes a folder and any of its parents that don't exist yet.
+ * Returns true if the folder exists afterwards.
+ */
+bool makeFolder(const string &folder) {
+    for (size_t i = 1; i <= folder.size(); i++) {
+        if (i < folder.size() && folder[i] != '/' && folder[i] != '\\') {
+            continue;
+        }
+        string part = folder.substr(0, i);
+#ifdef _WIN32
+        _mkdir(part.c_str());
+#else
+        mkdir(part.c_str(), 0777);
+#endif
+    }
+    return isFolder(folder);
+}
+
+// The watcher that Ctrl-C stops, while watching folders
+FolderWatcher *activeWatcher = nullptr;
+
+void stopWatching(int) {
+    if (activeWatcher) {
+        activeWatcher->stop();
+    }
+}
+
+int main(int argc, char **argv) {
+    ProcessOptions options;
+    vector<string> files;
+    vector<string> folders;
+    vector<string> watched;
+    bool recursive = false;
+    string savePath;
+    string cachePath;
+
+    for (int i = 1; i < argc; i++) {
+        string arg = argv[i];
+        // Every option but help, hash, recursive and dry run takes a value
+        bool hasValue = i + 1 < argc;
+        if (arg == "-h" || arg == "--help") {
+            printUsage(argv[0]);
+            return 0;
+        } else if (arg == "--hash") {
+            options.cacheContentHash = true;
+        } else if (arg == "--dry-run") {
+            options.dryRun = true;
+        } else if (arg == "-r" || arg == "--recursive") {
+            recursive = true;
+        } else if ((arg == "-o" || arg == "--output") && hasValue) {
+            savePath = argv[++i];
+        } else if ((arg == "-m" || arg == "--manifest") && hasValue) {
+            string manifest = argv[++i];
+            if (!addManifest(manifest, files, folders)) {
+                fprintf(stderr, "Can't read the manifest %s\n", manifest.c_str());
+                return 1;
+            }
+        } else if ((arg == "-w" || arg == "--watch") && hasValue) {
+            watched.push_back(argv[++i]);
+        } else if ((arg == "-j" || arg == "--threads") && hasValue) {
+            options.numThreads = (unsigned)strtoul(argv[++i], nullptr, 10);
+        } else if (arg == "--mode" && hasValue) {
+            string mode = argv[++i];
+            if (mode == "tolerant") {
+                options.mode = Tolerant;
+            } else if (mode == "exact") {
+                options.mode = BitExact;
+            } else {
+                fprintf(stderr, "Unknown mode %s, use tolerant or exact\n", mode.c_str());
+                return 1;
+            }
+        } else if (arg == "--report" && hasValue) {
+            options.reportPath = argv[++i];
+        } else if (arg == "--cache" && hasValue) {
+            cachePath = argv[++i];
+        } else if (arg.size() > 1 && arg[0] == '-') {
+            fprintf(stderr, "Unknown option or missing value: %s\n", arg.c_str());
+            printUsage(argv[0]);
+            return 1;
+        } else {
+            addInput(arg, files, folders);
+        }
+    }
+
+    if ((savePath.empty() && !options.dryRun) || (files.empty() && folders.empty() && watched.empty())) {
+        printUsage(argv[0]);
+        return 1;
+    }
+    if (!folders.empty() && !recursive) {
+        fprintf(stderr, "%s is a folder, give -r to process the files in it\n", folders[0].c_str());
+        return 1;
+    }
+    // The output folder is skipped when it's inside a walked folder, but saving into the top of one would mix
+    // the saved files in with the ones still to be walked
+    for (const string &folder : folders) {
+        if (!options.dryRun && isSameFolder(folder, savePath)) {
+            fprintf(stderr, "The output folder can't be a folder given with -r: %s\n", folder.c_str());
+            return 1;
+        }
+    }
+    if (!options.dryRun && !makeFolder(savePath)) {
+        fprintf(stderr, "Can't make the output folder %s\n", savePath.c_str());
+        return 1;
+    }
+
+    FolderWatcher watcher;
+    if (!watched.empty()) {
+        if (!watcher.open()) {
+            fprintf(stderr, "Watching folders isn't supported on this system\n");
+            return 1;
+        }
+        for (const string &folder : watched) {
+            // Saved files would arrive in the watched folder again, and be processed over and over
+            if (!options.dryRun && isSameFolder(folder, savePath)) {
+                fprintf(stderr, "The output folder can't be a watched folder: %s\n", folder.c_str());
+                return 1;
+            }
+            if (!watcher.addFolder(folder)) {
+                fprintf(stderr, "Can't watch the folder %s\n", folder.c_str());
+                return 1;
+            }
+        }
+    }
+
+    // Room for twice the files keeps the cache's probes short. The files in folders and watched folders aren't known yet,
+    // so leave plenty, the cache file is sparse until it's used.
+    ResultCache cache;
+    size_t cacheSlots = std::max<size_t>(2 * files.size(), !folders.empty() ? 1 << 20 : !watched.empty() ? 1 << 16 : 0);
+    if (!cachePath.empty() && !cache.open(cachePath, cacheSlots)) {
+        fprintf(stderr, "Can't open the cache %s, every file will be analyzed\n", cachePath.c_str());
+    }
+
+    // One report for every file, however it was found
+    ReportWriter report;
+    if (!options.reportPath.empty() && !report.open(options.reportPath, options)) {
+        fprintf(stderr, "Can't write the report %s\n", options.reportPath.c_str());
+        return 1;
+    }
+    ReportWriter *reportTo = report.isOpen() ? &report : nullptr;
+
+    int numFake = processAll(files, savePath, options, &cache, reportTo);
+    if (!folders.empty()) {
+        numFake += processFolders(folders, savePath, options, &cache, nullptr, reportTo);
+    }
+    if (!watched.empty()) {
+        printf("Watching %zu folders, Ctrl-C to stop.\n", watched.size());
+        fflush(stdout);
+        activeWatcher = &watcher;
+        signal(SIGINT, stopWatching);
+        signal(SIGTERM, stopWatching);
+        numFake += processArrivals(watcher, savePath, options, &cache, [](const string &file, AudioResult result) {
+            printf("%s %s\n", resultName(result), file.c_str());
+            fflush(stdout);
+        }, reportTo);
+        activeWatcher = nullptr;
+    }
+    if (report.isOpen() && !report.close(&cache)) {
+        fprintf(stderr, "Couldn't write all of the report %s\n", options.reportPath.c_str());
+    }
+    if (options.dryRun) {
+        printf("%d fake stereo files found, nothing was saved.\n", numFake);
+    } else {
+        printf("%d fake stereo files converted to mono.\n", numFake);
+    }
+    if (cache.isOpen() && cache.getNumLookups() > 0) {
+        printf("%zu of %zu files found in the cache (%.1f%%).\n", cache.getNumHits(), cache.getNumLookups(),
+               100.0 * cache.getNumHits() / cache.getNumLookups());
+    }
+    return 0;
+}
@@ -0,0 +1,822 @@
+#pragma once
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cmath>
+#include <cfloat>
+#include <cstring>
+
+// Only x86 has the vector kernels below, everything else uses the scalar loop.
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#define MONOC_X86 1
+#include <immintrin.h>
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+#endif
+
+// Lets GCC and Clang compile a single function for a newer instruction set than the rest of the program.
+// MSVC accepts the intrinsics anywhere, so the attribute isn't needed there.
+#if defined(__GNUC__) || defined(__clang__)
+#define MONOC_TARGET(isa) __attribute__((target(isa)))
+#else
+#define MONOC_TARGET(isa)
+#endif
+
+// The instruction sets a comparison kernel can be built for, from slowest to fastest.
+enum class SimdLevel {
+    Scalar,
+    SSE2,
+    AVX2,
+    AVX512
+};
+
+// How a comparison kernel decides two samples match. Every kernel is built once for each of these,
+// so the choice is made when the kernel is picked and never inside its loop.
+enum class SampleMatch {
+    Absolute, // |a - b| <= threshold
+    ExactBits, // a and b are the same bit pattern
+    Ulps // a and b are at most threshold representable floats apart
+};
+
+/**
+ * A channel comparison kernel.
+ * Compares left[i] and right[i] for i in [0, count) and returns the index of the first
+ * pair that doesn't match, or count if every pair matches.
+ * threshold is in the units of the kernel's SampleMatch: a difference, or a number of floats.
+ */
+typedef size_t (*CompareKernel)(const float *left, const float *right, size_t count, float threshold);
+
+/**
+ * A raw frame comparison kernel.
+ * Compares the bytes of the first and second sample slot of each interleaved frame and
+ * returns the index of the first frame where they differ, or numFrames if none do.
+ */
+typedef size_t (*FrameCompareKernel)(const uint8_t *frames, size_t numFrames, int numBytesPerSample, int numBytesPerFrame);
+
+/**
+ * Running sums over a pair of channels, enough to fit right = gain * left by least squares.
+ * They are kept in double precision. The product of two floats is exact in a double,
+ * so the sums only round once per addition.
+ */
+struct ChannelSums {
+    double leftSquares = 0; // Sum of left * left
+    double rightSquares = 0; // Sum of right * right
+    double products = 0; // Sum of left * right
+};
+
+/**
+ * A channel correlation kernel.
+ * Adds the squares and products of left[i] and right[i] for i in [0, count) to sums.
+ */
+typedef void (*CorrelationKernel)(const float *left, const float *right, size_t count, ChannelSums &sums);
+
+/**
+ * Running statistics of how a pair of channels differ, kept over a file as its blocks stream past.
+ * The sums are kept in double precision like ChannelSums. Frames are counted from the first one added.
+ */
+struct DifferenceStats {
+    size_t numFrames = 0; // Frames added so far
+    float maxDifference = 0; // Largest |left - right|, NaN differences aren't counted
+    double differenceSquares = 0; // Sum of (left - right)^2, the side signal's energy times 4
+    double midSquares = 0; // Sum of ((left + right) / 2)^2, the mid signal's energy
+    size_t numDiffering = 0; // Frames whose samples don't match
+    size_t firstDiffering = 0; // First frame whose samples don't match, if numDiffering > 0
+    size_t lastDiffering = 0; // Last frame whose samples don't match, if numDiffering > 0
+};
+
+/**
+ * A difference statistics kernel.
+ * Adds left[i] and right[i] for i in [0, count) to stats, counting the pairs that don't match
+ * the same way the CompareKernel for its SampleMatch and threshold would.
+ */
+typedef void (*DifferenceKernel)(const float *left, const float *right, size_t count, float threshold, DifferenceStats &stats);
+
+/**
+ * Returns the largest float threshold t such that |a - b| <= t is the same test as |a - b| < epsilon.
+ * The kernels compare in single precision, this keeps them in step with the double EPSILON.
+ */
+float toleranceThreshold(double epsilon) {
+    float t = (float)epsilon;
+    while ((double)t >= epsilon) {
+        t = std::nextafter(t, 0.0f);
+    }
+    return t;
+}
+
+/**
+ * Returns the bits of a float as an integer that orders the same way as the float,
+ * so the difference of two of them counts the floats between them.
+ */
+int32_t orderedBits(float x) {
+    int32_t bits;
+    memcpy(&bits, &x, sizeof(bits));
+    return bits ^ ((bits >> 31) & 0x7FFFFFFF);
+}
+
+/**
+ * Returns true if a pair of samples doesn't match.
+ */
+template <SampleMatch M>
+bool samplesDiffer(float a, float b, float threshold) {
+    if (M == SampleMatch::ExactBits) {
+        return orderedBits(a) != orderedBits(b);
+    }
+    if (M == SampleMatch::Ulps) {
+        int64_t distance = (int64_t)orderedBits(a) - orderedBits(b);
+        return distance > (int64_t)threshold || distance < -(int64_t)threshold;
+    }
+    // Written as !(x <= t) so a NaN difference counts as a mismatch.
+    return !(std::fabs(a - b) <= threshold);
+}
+
+/**
+ * Plain C++ kernel, used when no vector unit is available and for the tail of every block.
+ */
+template <SampleMatch M>
+size_t findMismatchScalar(const float *left, const float *right, size_t count, float threshold) {
+    for (size_t i = 0; i < count; i++) {
+        if (samplesDiffer<M>(left[i], right[i], threshold)) {
+            return i;
+        }
+    }
+    return count;
+}
+
+#ifdef MONOC_X86
+/**
+ * Returns all ones in the lanes of a and b that don't match.
+ * For Ulps the float distance is taken as an integer difference, and a difference that overflows
+ * (the sign of the result is wrong for the signs of the operands) is always too far.
+ */
+template <SampleMatch M>
+MONOC_TARGET("sse2")
+__m128i lanesDifferSSE2(__m128 a, __m128 b, __m128 threshold, __m128i ulps) {
+    const __m128i signMask = _mm_set1_epi32(0x7FFFFFFF);
+    __m128i ai = _mm_castps_si128(a), bi = _mm_castps_si128(b);
+    if (M == SampleMatch::ExactBits) {
+        return _mm_xor_si128(_mm_cmpeq_epi32(ai, bi), _mm_set1_epi32(-1));
+    }
+    if (M == SampleMatch::Ulps) {
+        __m128i oa = _mm_xor_si128(ai, _mm_and_si128(_mm_srai_epi32(ai, 31), signMask));
+        __m128i ob = _mm_xor_si128(bi, _mm_and_si128(_mm_srai_epi32(bi, 31), signMask));
+        __m128i d = _mm_sub_epi32(oa, ob);
+        __m128i overflow = _mm_srai_epi32(_mm_and_si128(_mm_xor_si128(oa, ob), _mm_xor_si128(oa, d)), 31);
+        __m128i far = _mm_or_si128(_mm_cmpgt_epi32(d, ulps), _mm_cmpgt_epi32(_mm_sub_epi32(_mm_setzero_si128(), ulps), d));
+        return _mm_or_si128(overflow, far);
+    }
+    __m128 difference = _mm_andnot_ps(_mm_set1_ps(-0.0f), _mm_sub_ps(a, b));
+    return _mm_castps_si128(_mm_cmpnle_ps(difference, threshold));
+}
+
+/**
+ * SSE2 kernel. Checks 16 samples per block and only looks at individual samples once a block differs.
+ */
+template <SampleMatch M>
+MONOC_TARGET("sse2")
+size_t findMismatchSSE2(const float *left, const float *right, size_t count, float threshold) {
+    const __m128 t = _mm_set1_ps(threshold);
+    const __m128i u = _mm_set1_epi32((int32_t)threshold);
+    size_t i = 0;
+    for (; i + 16 <= count; i += 16) {
+        __m128i d0 = lanesDifferSSE2<M>(_mm_loadu_ps(left + i), _mm_loadu_ps(right + i), t, u);
+        __m128i d1 = lanesDifferSSE2<M>(_mm_loadu_ps(left + i + 4), _mm_loadu_ps(right + i + 4), t, u);
+        __m128i d2 = lanesDifferSSE2<M>(_mm_loadu_ps(left + i + 8), _mm_loadu_ps(right + i + 8), t, u);
+        __m128i d3 = lanesDifferSSE2<M>(_mm_loadu_ps(left + i + 12), _mm_loadu_ps(right + i + 12), t, u);
+        if (_mm_movemask_epi8(_mm_or_si128(_mm_or_si128(d0, d1), _mm_or_si128(d2, d3))) != 0) {
+            return i + findMismatchScalar<M>(left + i, right + i, 16, threshold);
+        }
+    }
+    return i + findMismatchScalar<M>(left + i, right + i, count - i, threshold);
+}
+
+/**
+ * Returns all ones in the lanes of a and b that don't match, the AVX2 version of lanesDifferSSE2.
+ */
+template <SampleMatch M>
+MONOC_TARGET("avx2")
+__m256i lanesDifferAVX2(__m256 a, __m256 b, __m256 threshold, __m256i ulps) {
+    const __m256i signMask = _mm256_set1_epi32(0x7FFFFFFF);
+    __m256i ai = _mm256_castps_si256(a), bi = _mm256_castps_si256(b);
+    if (M == SampleMatch::ExactBits) {
+        return _mm256_xor_si256(_mm256_cmpeq_epi32(ai, bi), _mm256_set1_epi32(-1));
+    }
+    if (M == SampleMatch::Ulps) {
+        __m256i oa = _mm256_xor_si256(ai, _mm256_and_si256(_mm256_srai_epi32(ai, 31), signMask));
+        __m256i ob = _mm256_xor_si256(bi, _mm256_and_si256(_mm256_srai_epi32(bi, 31), signMask));
+        __m256i d = _mm256_sub_epi32(oa, ob);
+        __m256i overflow = _mm256_srai_epi32(_mm256_and_si256(_mm256_xor_si256(oa, ob), _mm256_xor_si256(oa, d)), 31);
+        __m256i far = _mm256_or_si256(_mm256_cmpgt_epi32(d, ulps), _mm256_cmpgt_epi32(_mm256_sub_epi32(_mm256_setzero_si256(), ulps), d));
+        return _mm256_or_si256(overflow, far);
+    }
+    __m256 difference = _mm256_andnot_ps(_mm256_set1_ps(-0.0f), _mm256_sub_ps(a, b));
+    return _mm256_castps_si256(_mm256_cmp_ps(difference, threshold, _CMP_NLE_UQ));
+}
+
+/**
+ * AVX2 kernel. Same as the SSE2 one but with 32 sample blocks.
+ */
+template <SampleMatch M>
+MONOC_TARGET("avx2")
+size_t findMismatchAVX2(const float *left, const float *right, size_t count, float threshold) {
+    const __m256 t = _mm256_set1_ps(threshold);
+    const __m256i u = _mm256_set1_epi32((int32_t)threshold);
+    size_t i = 0;
+    for (; i + 32 <= count; i += 32) {
+        __m256i d0 = lanesDifferAVX2<M>(_mm256_loadu_ps(left + i), _mm256_loadu_ps(right + i), t, u);
+        __m256i d1 = lanesDifferAVX2<M>(_mm256_loadu_ps(left + i + 8), _mm256_loadu_ps(right + i + 8), t, u);
+        __m256i d2 = lanesDifferAVX2<M>(_mm256_loadu_ps(left + i + 16), _mm256_loadu_ps(right + i + 16), t, u);
+        __m256i d3 = lanesDifferAVX2<M>(_mm256_loadu_ps(left + i + 24), _mm256_loadu_ps(right + i + 24), t, u);
+        if (_mm256_movemask_epi8(_mm256_or_si256(_mm256_or_si256(d0, d1), _mm256_or_si256(d2, d3))) != 0) {
+            return i + findMismatchScalar<M>(left + i, right + i, 32, threshold);
+        }
+    }
+    return i + findMismatchScalar<M>(left + i, right + i, count - i, threshold);
+}
+
+/**
+ * Returns the mask of the lanes of a and b that don't match, the AVX-512 version of lanesDifferSSE2.
+ */
+template <SampleMatch M>
+MONOC_TARGET("avx512f")
+__mmask16 lanesDifferAVX512(__m512 a, __m512 b, __m512 threshold, __m512i ulps) {
+    const __m512i signMask = _mm512_set1_epi32(0x7FFFFFFF);
+    __m512i ai = _mm512_castps_si512(a), bi = _mm512_castps_si512(b);
+    if (M == SampleMatch::ExactBits) {
+        return _mm512_cmpneq_epi32_mask(ai, bi);
+    }
+    if (M == SampleMatch::Ulps) {
+        __m512i oa = _mm512_mask_xor_epi32(ai, _mm512_cmplt_epi32_mask(ai, _mm512_setzero_si512()), ai, signMask);
+        __m512i ob = _mm512_mask_xor_epi32(bi, _mm512_cmplt_epi32_mask(bi, _mm512_setzero_si512()), bi, signMask);
+        __m512i d = _mm512_sub_epi32(oa, ob);
+        __mmask16 overflow = _mm512_cmplt_epi32_mask(_mm512_and_si512(_mm512_xor_si512(oa, ob), _mm512_xor_si512(oa, d)), _mm512_setzero_si512());
+        return overflow | _mm512_cmpgt_epi32_mask(d, ulps) | _mm512_cmplt_epi32_mask(d, _mm512_sub_epi32(_mm512_setzero_si512(), ulps));
+    }
+    return _mm512_cmp_ps_mask(_mm512_abs_ps(_mm512_sub_ps(a, b)), threshold, _CMP_NLE_UQ);
+}
+
+/**
+ * AVX-512 kernel. 64 sample blocks, the compares go straight into mask registers.
+ */
+template <SampleMatch M>
+MONOC_TARGET("avx512f")
+size_t findMismatchAVX512(const float *left, const float *right, size_t count, float threshold) {
+    const __m512 t = _mm512_set1_ps(threshold);
+    const __m512i u = _mm512_set1_epi32((int32_t)threshold);
+    size_t i = 0;
+    for (; i + 64 <= count; i += 64) {
+        __mmask16 m = lanesDifferAVX512<M>(_mm512_loadu_ps(left + i), _mm512_loadu_ps(right + i), t, u)
+                    | lanesDifferAVX512<M>(_mm512_loadu_ps(left + i + 16), _mm512_loadu_ps(right + i + 16), t, u)
+                    | lanesDifferAVX512<M>(_mm512_loadu_ps(left + i + 32), _mm512_loadu_ps(right + i + 32), t, u)
+                    | lanesDifferAVX512<M>(_mm512_loadu_ps(left + i + 48), _mm512_loadu_ps(right + i + 48), t, u);
+        if (m != 0) {
+            return i + findMismatchScalar<M>(left + i, right + i, 64, threshold);
+        }
+    }
+    return i + findMismatchScalar<M>(left + i, right + i, count - i, threshold);
+}
+#endif
+
+/**
+ * Plain C++ raw frame kernel, used for anything that isn't two channels and for the tail of every block.
+ */
+size_t findFrameMismatchScalar(const uint8_t *frames, size_t numFrames, int numBytesPerSample, int numBytesPerFrame) {
+    for (size_t i = 0; i < numFrames; i++) {
+        const uint8_t *frame = frames + i * numBytesPerFrame;
+        if (memcmp(frame, frame + numBytesPerSample, numBytesPerSample) != 0) {
+            return i;
+        }
+    }
+    return numFrames;
+}
+
+/**
+ * Builds the byte mask for the left sample slots of a block of stereo frames.
+ * 48 bytes is a whole number of frames for 8, 16, 24 and 32 bit samples, so the pattern repeats every 48 bytes.
+ */
+void leftSlotMask(uint8_t *mask, int length, int numBytesPerSample, int numBytesPerFrame) {
+    for (int j = 0; j < length; j++) {
+        mask[j] = (j % numBytesPerFrame) < numBytesPerSample ? 0xFF : 0x00;
+    }
+}
+
+#ifdef MONOC_X86
+/**
+ * SSE2 raw frame kernel for stereo data.
+ * Compares each 48 byte block against itself shifted by one sample, so every left slot
+ * lines up with its right slot, and masks out the bytes that aren't left slots.
+ */
+MONOC_TARGET("sse2")
+size_t findFrameMismatchSSE2(const uint8_t *frames, size_t numFrames, int numBytesPerSample, int numBytesPerFrame) {
+    if (numBytesPerFrame != 2 * numBytesPerSample) {
+        return findFrameMismatchScalar(frames, numFrames, numBytesPerSample, numBytesPerFrame);
+    }
+    uint8_t maskBytes[48];
+    leftSlotMask(maskBytes, 48, numBytesPerSample, numBytesPerFrame);
+    const __m128i m0 = _mm_loadu_si128((const __m128i *)maskBytes);
+    const __m128i m1 = _mm_loadu_si128((const __m128i *)(maskBytes + 16));
+    const __m128i m2 = _mm_loadu_si128((const __m128i *)(maskBytes + 32));
+
+    const uint8_t *left = frames;
+    const uint8_t *right = frames + numBytesPerSample;
+    size_t totalBytes = numFrames * numBytesPerFrame;
+    size_t i = 0;
+    // The shifted loads read one sample past the block, so stop a frame early
+    for (; i + 48 + numBytesPerFrame <= totalBytes; i += 48) {
+        __m128i e0 = _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *)(left + i)), _mm_loadu_si128((const __m128i *)(right + i)));
+        __m128i e1 = _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *)(left + i + 16)), _mm_loadu_si128((const __m128i *)(right + i + 16)));
+        __m128i e2 = _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *)(left + i + 32)), _mm_loadu_si128((const __m128i *)(right + i + 32)));
+        __m128i d = _mm_or_si128(_mm_or_si128(_mm_andnot_si128(e0, m0), _mm_andnot_si128(e1, m1)), _mm_andnot_si128(e2, m2));
+        if (_mm_movemask_epi8(d) != 0) {
+            return i / numBytesPerFrame + findFrameMismatchScalar(frames + i, 48 / numBytesPerFrame, numBytesPerSample, numBytesPerFrame);
+        }
+    }
+    size_t done = i / numBytesPerFrame;
+    return done + findFrameMismatchScalar(frames + i, numFrames - done, numBytesPerSample, numBytesPerFrame);
+}
+
+/**
+ * AVX2 raw frame kernel for stereo data. Same as the SSE2 one but with 96 byte blocks.
+ */
+MONOC_TARGET("avx2")
+size_t findFrameMismatchAVX2(const uint8_t *frames, size_t numFrames, int numBytesPerSample, int numBytesPerFrame) {
+    if (numBytesPerFrame != 2 * numBytesPerSample) {
+        return findFrameMismatchScalar(frames, numFrames, numBytesPerSample, numBytesPerFrame);
+    }
+    uint8_t maskBytes[96];
+    leftSlotMask(maskBytes, 96, numBytesPerSample, numBytesPerFrame);
+    const __m256i m0 = _mm256_loadu_si256((const __m256i *)maskBytes);
+    const __m256i m1 = _mm256_loadu_si256((const __m256i *)(maskBytes + 32));
+    const __m256i m2 = _mm256_loadu_si256((const __m256i *)(maskBytes + 64));
+
+    const uint8_t *left = frames;
+    const uint8_t *right = frames + numBytesPerSample;
+    size_t totalBytes = numFrames * numBytesPerFrame;
+    size_t i = 0;
+    for (; i + 96 + numBytesPerFrame <= totalBytes; i += 96) {
+        __m256i e0 = _mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i *)(left + i)), _mm256_loadu_si256((const __m256i *)(right + i)));
+        __m256i e1 = _mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i *)(left + i + 32)), _mm256_loadu_si256((const __m256i *)(right + i + 32)));
+        __m256i e2 = _mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i *)(left + i + 64)), _mm256_loadu_si256((const __m256i *)(right + i + 64)));
+        __m256i d = _mm256_or_si256(_mm256_or_si256(_mm256_andnot_si256(e0, m0), _mm256_andnot_si256(e1, m1)), _mm256_andnot_si256(e2, m2));
+        if (_mm256_movemask_epi8(d) != 0) {
+            return i / numBytesPerFrame + findFrameMismatchScalar(frames + i, 96 / numBytesPerFrame, numBytesPerSample, numBytesPerFrame);
+        }
+    }
+    size_t done = i / numBytesPerFrame;
+    return done + findFrameMismatchScalar(frames + i, numFrames - done, numBytesPerSample, numBytesPerFrame);
+}
+#endif
+
+/**
+ * Plain C++ correlation kernel, used when no vector unit is available and for the tail of every block.
+ */
+void correlateScalar(const float *left, const float *right, size_t count, ChannelSums &sums) {
+    double ll = 0, rr = 0, lr = 0;
+    for (size_t i = 0; i < count; i++) {
+        double l = left[i];
+        double r = right[i];
+        ll += l * l;
+        rr += r * r;
+        lr += l * r;
+    }
+    sums.leftSquares += ll;
+    sums.rightSquares += rr;
+    sums.products += lr;
+}
+
+#ifdef MONOC_X86
+/**
+ * Adds the two doubles of each lane together.
+ */
+MONOC_TARGET("sse2")
+double horizontalSum(__m128d v) {
+    return _mm_cvtsd_f64(_mm_add_sd(v, _mm_unpackhi_pd(v, v)));
+}
+
+/**
+ * SSE2 correlation kernel. Widens 4 samples of each channel to doubles per step.
+ */
+MONOC_TARGET("sse2")
+void correlateSSE2(const float *left, const float *right, size_t count, ChannelSums &sums) {
+    __m128d ll = _mm_setzero_pd(), rr = _mm_setzero_pd(), lr = _mm_setzero_pd();
+    size_t i = 0;
+    for (; i + 4 <= count; i += 4) {
+        __m128 l = _mm_loadu_ps(left + i);
+        __m128 r = _mm_loadu_ps(right + i);
+        __m128d l0 = _mm_cvtps_pd(l), l1 = _mm_cvtps_pd(_mm_movehl_ps(l, l));
+        __m128d r0 = _mm_cvtps_pd(r), r1 = _mm_cvtps_pd(_mm_movehl_ps(r, r));
+        ll = _mm_add_pd(ll, _mm_add_pd(_mm_mul_pd(l0, l0), _mm_mul_pd(l1, l1)));
+        rr = _mm_add_pd(rr, _mm_add_pd(_mm_mul_pd(r0, r0), _mm_mul_pd(r1, r1)));
+        lr = _mm_add_pd(lr, _mm_add_pd(_mm_mul_pd(l0, r0), _mm_mul_pd(l1, r1)));
+    }
+    sums.leftSquares += horizontalSum(ll);
+    sums.rightSquares += horizontalSum(rr);
+    sums.products += horizontalSum(lr);
+    correlateScalar(left + i, right + i, count - i, sums);
+}
+
+/**
+ * AVX2 correlation kernel. Widens 8 samples of each channel to doubles per step.
+ */
+MONOC_TARGET("avx2")
+void correlateAVX2(const float *left, const float *right, size_t count, ChannelSums &sums) {
+    __m256d ll = _mm256_setzero_pd(), rr = _mm256_setzero_pd(), lr = _mm256_setzero_pd();
+    size_t i = 0;
+    for (; i + 8 <= count; i += 8) {
+        __m256d l0 = _mm256_cvtps_pd(_mm_loadu_ps(left + i)), l1 = _mm256_cvtps_pd(_mm_loadu_ps(left + i + 4));
+        __m256d r0 = _mm256_cvtps_pd(_mm_loadu_ps(right + i)), r1 = _mm256_cvtps_pd(_mm_loadu_ps(right + i + 4));
+        ll = _mm256_add_pd(ll, _mm256_add_pd(_mm256_mul_pd(l0, l0), _mm256_mul_pd(l1, l1)));
+        rr = _mm256_add_pd(rr, _mm256_add_pd(_mm256_mul_pd(r0, r0), _mm256_mul_pd(r1, r1)));
+        lr = _mm256_add_pd(lr, _mm256_add_pd(_mm256_mul_pd(l0, r0), _mm256_mul_pd(l1, r1)));
+    }
+    sums.leftSquares += horizontalSum(_mm_add_pd(_mm256_castpd256_pd128(ll), _mm256_extractf128_pd(ll, 1)));
+    sums.rightSquares += horizontalSum(_mm_add_pd(_mm256_castpd256_pd128(rr), _mm256_extractf128_pd(rr, 1)));
+    sums.products += horizontalSum(_mm_add_pd(_mm256_castpd256_pd128(lr), _mm256_extractf128_pd(lr, 1)));
+    correlateScalar(left + i, right + i, count - i, sums);
+}
+#endif
+
+/**
+ * Returns the gain that best fits right = gain * left to the sums, or 0 if the left channel is silent.
+ */
+double fitGain(const ChannelSums &sums) {
+    return sums.leftSquares > 0 ? sums.products / sums.leftSquares : 0;
+}
+
+/**
+ * Returns the energy of right - gain * left for the best fitting gain: the part of the right channel
+ * that scaling the left one can't explain.
+ */
+double fitResidual(const ChannelSums &sums) {
+    if (sums.leftSquares <= 0) {
+        return sums.rightSquares;
+    }
+    double residual = sums.rightSquares - sums.products * sums.products / sums.leftSquares;
+    return residual > 0 ? residual : 0;
+}
+
+/**
+ * Returns the index of the lowest set bit of a mask that isn't 0.
+ */
+int lowestBit(unsigned mask) {
+    int bit = 0;
+    while ((mask & 1) == 0) {
+        mask >>= 1;
+        bit++;
+    }
+    return bit;
+}
+
+/**
+ * Returns the index of the highest set bit of a mask that isn't 0.
+ */
+int highestBit(unsigned mask) {
+    int bit = 0;
+    while (mask >>= 1) {
+        bit++;
+    }
+    return bit;
+}
+
+/**
+ * Plain C++ difference statistics kernel, used when no vector unit is available and for the tail of every block.
+ */
+template <SampleMatch M>
+void differScalar(const float *left, const float *right, size_t count, float threshold, DifferenceStats &stats) {
+    double dd = 0, mm = 0;
+    float peak = stats.maxDifference;
+    for (size_t i = 0; i < count; i++) {
+        float d = left[i] - right[i];
+        double side = d;
+        double mid = (left[i] + right[i]) * 0.5f;
+        dd += side * side;
+        mm += mid * mid;
+        if (std::fabs(d) > peak) {
+            peak = std::fabs(d);
+        }
+        if (samplesDiffer<M>(left[i], right[i], threshold)) {
+            if (stats.numDiffering == 0) {
+                stats.firstDiffering = stats.numFrames + i;
+            }
+            stats.lastDiffering = stats.numFrames + i;
+            stats.numDiffering++;
+        }
+    }
+    stats.maxDifference = peak;
+    stats.differenceSquares += dd;
+    stats.midSquares += mm;
+    stats.numFrames += count;
+}
+
+#ifdef MONOC_X86
+/**
+ * Adds the results of a vector difference statistics loop over the first numFrames of a block to stats.
+ * first is the first frame that differed, or numFrames if none did, and the frames from lastStep
+ * have lastBits set for the ones that differed.
+ */
+void addDifferences(DifferenceStats &stats, size_t numFrames, float peak, double dd, double mm, size_t numDiffering,
+                    size_t first, size_t lastStep, unsigned lastBits) {
+    if (first < numFrames) {
+        if (stats.numDiffering == 0) {
+            stats.firstDiffering = stats.numFrames + first;
+        }
+        stats.lastDiffering = stats.numFrames + lastStep + highestBit(lastBits);
+    }
+    stats.maxDifference = std::max(stats.maxDifference, peak);
+    stats.differenceSquares += dd;
+    stats.midSquares += mm;
+    stats.numDiffering += numDiffering;
+    stats.numFrames += numFrames;
+}
+
+/**
+ * SSE2 difference statistics kernel. Widens 4 differences and mids to doubles per step,
+ * and counts the frames that differ in a vector of lane counts.
+ * Only the steps with a differing frame branch, to note where it was.
+ */
+template <SampleMatch M>
+MONOC_TARGET("sse2")
+void differSSE2(const float *left, const float *right, size_t count, float threshold, DifferenceStats &stats) {
+    const __m128 t = _mm_set1_ps(threshold);
+    const __m128i u = _mm_set1_epi32((int32_t)threshold);
+    const __m128 half = _mm_set1_ps(0.5f);
+    const __m128 signMask = _mm_set1_ps(-0.0f);
+    __m128d dd = _mm_setzero_pd(), mm = _mm_setzero_pd();
+    __m128 peak = _mm_setzero_ps();
+    __m128i differing = _mm_setzero_si128();
+    size_t first = count, lastStep = 0;
+    unsigned lastBits = 0;
+    size_t i = 0;
+    for (; i + 4 <= count; i += 4) {
+        __m128 l = _mm_loadu_ps(left + i);
+        __m128 r = _mm_loadu_ps(right + i);
+        __m128 d = _mm_sub_ps(l, r);
+        __m128 m = _mm_mul_ps(_mm_add_ps(l, r), half);
+        __m128d d0 = _mm_cvtps_pd(d), d1 = _mm_cvtps_pd(_mm_movehl_ps(d, d));
+        __m128d m0 = _mm_cvtps_pd(m), m1 = _mm_cvtps_pd(_mm_movehl_ps(m, m));
+        dd = _mm_add_pd(dd, _mm_add_pd(_mm_mul_pd(d0, d0), _mm_mul_pd(d1, d1)));
+        mm = _mm_add_pd(mm, _mm_add_pd(_mm_mul_pd(m0, m0), _mm_mul_pd(m1, m1)));
+        // max returns its second operand when the first is NaN, so NaN differences are skipped
+        peak = _mm_max_ps(_mm_andnot_ps(signMask, d), peak);
+        __m128i mask = lanesDifferSSE2<M>(l, r, t, u);
+        differing = _mm_sub_epi32(differing, mask);
+        unsigned bits = (unsigned)_mm_movemask_ps(_mm_castsi128_ps(mask));
+        if (bits != 0) {
+            if (first == count) {
+                first = i + lowestBit(bits);
+            }
+            lastStep = i;
+            lastBits = bits;
+        }
+    }
+    float peaks[4];
+    int32_t counts[4];
+    _mm_storeu_ps(peaks, peak);
+    _mm_storeu_si128((__m128i *)counts, differing);
+    float maxPeak = std::max(std::max(peaks[0], peaks[1]), std::max(peaks[2], peaks[3]));
+    size_t numDiffering = (size_t)(uint32_t)counts[0] + (uint32_t)counts[1] + (uint32_t)counts[2] + (uint32_t)counts[3];
+    addDifferences(stats, i, maxPeak, horizontalSum(dd), horizontalSum(mm), numDiffering, first < i ? first : i, lastStep, lastBits);
+    differScalar<M>(left + i, right + i, count - i, threshold, stats);
+}
+
+/**
+ * AVX2 difference statistics kernel. Same as the SSE2 one but 8 frames per step.
+ */
+template <SampleMatch M>
+MONOC_TARGET("avx2")
+void differAVX2(const float *left, const float *right, size_t count, float threshold, DifferenceStats &stats) {
+    const __m256 t = _mm256_set1_ps(threshold);
+    const __m256i u = _mm256_set1_epi32((int32_t)threshold);
+    const __m256 half = _mm256_set1_ps(0.5f);
+    const __m256 signMask = _mm256_set1_ps(-0.0f);
+    __m256d dd = _mm256_setzero_pd(), mm = _mm256_setzero_pd();
+    __m256 peak = _mm256_setzero_ps();
+    __m256i differing = _mm256_setzero_si256();
+    size_t first = count, lastStep = 0;
+    unsigned lastBits = 0;
+    size_t i = 0;
+    for (; i + 8 <= count; i += 8) {
+        __m256 l = _mm256_loadu_ps(left + i);
+        __m256 r = _mm256_loadu_ps(right + i);
+        __m256 d = _mm256_sub_ps(l, r);
+        __m256 m = _mm256_mul_ps(_mm256_add_ps(l, r), half);
+        __m256d d0 = _mm256_cvtps_pd(_mm256_castps256_ps128(d)), d1 = _mm256_cvtps_pd(_mm256_extractf128_ps(d, 1));
+        __m256d m0 = _mm256_cvtps_pd(_mm256_castps256_ps128(m)), m1 = _mm256_cvtps_pd(_mm256_extractf128_ps(m, 1));
+        dd = _mm256_add_pd(dd, _mm256_add_pd(_mm256_mul_pd(d0, d0), _mm256_mul_pd(d1, d1)));
+        mm = _mm256_add_pd(mm, _mm256_add_pd(_mm256_mul_pd(m0, m0), _mm256_mul_pd(m1, m1)));
+        peak = _mm256_max_ps(_mm256_andnot_ps(signMask, d), peak);
+        __m256i mask = lanesDifferAVX2<M>(l, r, t, u);
+        differing = _mm256_sub_epi32(differing, mask);
+        unsigned bits = (unsigned)_mm256_movemask_ps(_mm256_castsi256_ps(mask));
+        if (bits != 0) {
+            if (first == count) {
+                first = i + lowestBit(bits);
+            }
+            lastStep = i;
+            lastBits = bits;
+        }
+    }
+    float peaks[8];
+    int32_t counts[8];
+    _mm256_storeu_ps(peaks, peak);
+    _mm256_storeu_si256((__m256i *)counts, differing);
+    float maxPeak = 0;
+    size_t numDiffering = 0;
+    for (int lane = 0; lane < 8; lane++) {
+        maxPeak = std::max(maxPeak, peaks[lane]);
+        numDiffering += (uint32_t)counts[lane];
+    }
+    double sumDD = horizontalSum(_mm_add_pd(_mm256_castpd256_pd128(dd), _mm256_extractf128_pd(dd, 1)));
+    double sumMM = horizontalSum(_mm_add_pd(_mm256_castpd256_pd128(mm), _mm256_extractf128_pd(mm, 1)));
+    addDifferences(stats, i, maxPeak, sumDD, sumMM, numDiffering, first < i ? first : i, lastStep, lastBits);
+    differScalar<M>(left + i, right + i, count - i, threshold, stats);
+}
+#endif
+
+/**
+ * Returns the RMS of left - right over the frames in stats, or 0 if there are none.
+ */
+double differenceRms(const DifferenceStats &stats) {
+    return stats.numFrames > 0 ? std::sqrt(stats.differenceSquares / stats.numFrames) : 0;
+}
+
+/**
+ * Returns the energy of the mid signal over the energy of the side signal,
+ * infinite when the side signal is silent.
+ */
+double midSideRatio(const DifferenceStats &stats) {
+    double sideSquares = stats.differenceSquares / 4;
+    return sideSquares > 0 ? stats.midSquares / sideSquares : INFINITY;
+}
+
+/**
+ * Asks the CPU (and the OS, for the wider registers) which instruction sets we can use.
+ */
+SimdLevel detectSimdLevel() {
+#if defined(MONOC_X86) && (defined(__GNUC__) || defined(__clang__))
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx512f")) {
+        return SimdLevel::AVX512;
+    }
+    if (__builtin_cpu_supports("avx2")) {
+        return SimdLevel::AVX2;
+    }
+    if (__builtin_cpu_supports("sse2")) {
+        return SimdLevel::SSE2;
+    }
+#elif defined(MONOC_X86) && defined(_MSC_VER)
+    int info[4];
+    __cpuid(info, 0);
+    int maxLeaf = info[0];
+    __cpuid(info, 1);
+    bool sse2 = (info[3] & (1 << 26)) != 0;
+    bool osxsave = (info[2] & (1 << 27)) != 0;
+    if (osxsave && maxLeaf >= 7) {
+        unsigned long long xcr0 = _xgetbv(0);
+        __cpuidex(info, 7, 0);
+        bool ymmEnabled = (xcr0 & 0x6) == 0x6;
+        bool zmmEnabled = (xcr0 & 0xE6) == 0xE6;
+        if (zmmEnabled && (info[1] & (1 << 16))) {
+            return SimdLevel::AVX512;
+        }
+        if (ymmEnabled && (info[1] & (1 << 5))) {
+            return SimdLevel::AVX2;
+        }
+    }
+    if (sse2) {
+        return SimdLevel::SSE2;
+    }
+#endif
+    return SimdLevel::Scalar;
+}
+
+/**
+ * Returns the comparison kernel for a given instruction set, built for one way of matching samples.
+ * Falls back to the scalar kernel when the set isn't built for this platform.
+ */
+template <SampleMatch M>
+CompareKernel compareKernelFor(SimdLevel level) {
+#ifdef MONOC_X86
+    switch (level) {
+        case SimdLevel::AVX512: return findMismatchAVX512<M>;
+        case SimdLevel::AVX2: return findMismatchAVX2<M>;
+        case SimdLevel::SSE2: return findMismatchSSE2<M>;
+        default: break;
+    }
+#endif
+    return findMismatchScalar<M>;
+}
+
+/**
+ * Returns the comparison kernel for a given instruction set and way of matching samples.
+ */
+CompareKernel compareKernelFor(SimdLevel level, SampleMatch match = SampleMatch::Absolute) {
+    switch (match) {
+        case SampleMatch::ExactBits: return compareKernelFor<SampleMatch::ExactBits>(level);
+        case SampleMatch::Ulps: return compareKernelFor<SampleMatch::Ulps>(level);
+        default: return compareKernelFor<SampleMatch::Absolute>(level);
+    }
+}
+
+/**
+ * Returns the fastest comparison kernel this machine supports for a way of matching samples.
+ * The CPU is only checked the first time this is called.
+ */
+CompareKernel getCompareKernel(SampleMatch match = SampleMatch::Absolute) {
+    static const SimdLevel level = detectSimdLevel();
+    static const CompareKernel kernels[3] = {
+        compareKernelFor(level, SampleMatch::Absolute),
+        compareKernelFor(level, SampleMatch::ExactBits),
+        compareKernelFor(level, SampleMatch::Ulps)
+    };
+    return kernels[(int)match];
+}
+
+/**
+ * Returns the raw frame comparison kernel for a given instruction set.
+ * There is no AVX-512 version, byte compares are already bound by memory bandwidth at AVX2 width.
+ */
+FrameCompareKernel frameCompareKernelFor(SimdLevel level) {
+#ifdef MONOC_X86
+    switch (level) {
+        case SimdLevel::AVX512:
+        case SimdLevel::AVX2: return findFrameMismatchAVX2;
+        case SimdLevel::SSE2: return findFrameMismatchSSE2;
+        default: break;
+    }
+#endif
+    return findFrameMismatchScalar;
+}
+
+/**
+ * Returns the fastest raw frame comparison kernel this machine supports.
+ */
+FrameCompareKernel getFrameCompareKernel() {
+    static const FrameCompareKernel kernel = frameCompareKernelFor(detectSimdLevel());
+    return kernel;
+}
+
+/**
+ * Returns the correlation kernel for a given instruction set.
+ * There is no AVX-512 version, the sums are already bound by memory bandwidth at AVX2 width.
+ */
+CorrelationKernel correlationKernelFor(SimdLevel level) {
+#ifdef MONOC_X86
+    switch (level) {
+        case SimdLevel::AVX512:
+        case SimdLevel::AVX2: return correlateAVX2;
+        case SimdLevel::SSE2: return correlateSSE2;
+        default: break;
+    }
+#endif
+    return correlateScalar;
+}
+
+/**
+ * Returns the fastest correlation kernel this machine supports.
+ */
+CorrelationKernel getCorrelationKernel() {
+    static const CorrelationKernel kernel = correlationKernelFor(detectSimdLevel());
+    return kernel;
+}
+
+/**
+ * Returns the difference statistics kernel for a given instruction set, built for one way of matching samples.
+ * There is no AVX-512 version, the sums are already bound by memory bandwidth at AVX2 width.
+ */
+template <SampleMatch M>
+DifferenceKernel differenceKernelFor(SimdLevel level) {
+#ifdef MONOC_X86
+    switch (level) {
+        case SimdLevel::AVX512:
+        case SimdLevel::AVX2: return differAVX2<M>;
+        case SimdLevel::SSE2: return differSSE2<M>;
+        default: break;
+    }
+#endif
+    return differScalar<M>;
+}
+
+/**
+ * Returns the difference statistics kernel for a given instruction set and way of matching samples.
+ */
+DifferenceKernel differenceKernelFor(SimdLevel level, SampleMatch match = SampleMatch::Absolute) {
+    switch (match) {
+        case SampleMatch::ExactBits: return differenceKernelFor<SampleMatch::ExactBits>(level);
+        case SampleMatch::Ulps: return differenceKernelFor<SampleMatch::Ulps>(level);
+        default: return differenceKernelFor<SampleMatch::Absolute>(level);
+    }
+}
+
+/**
+ * Returns the fastest difference statistics kernel this machine supports for a way of matching samples.
+ */
+DifferenceKernel getDifferenceKernel(SampleMatch match = SampleMatch::Absolute) {
+    static const SimdLevel level = detectSimdLevel();
+    static const DifferenceKernel kernels[3] = {
+        differenceKernelFor(level, SampleMatch::Absolute),
+        differenceKernelFor(level, SampleMatch::ExactBits),
+        differenceKernelFor(level, SampleMatch::Ulps)
+    };
+    return kernels[(int)match];
+}
@@ -0,0 +1,62 @@
+#pragma once
+//#include "include/pfd.h"
+#include "include/tinyfiledialogs.h"
+#include <cstdio>
+#include <string>
+#include <vector>
+using std::vector;
+using std::string;
+
+/**
+ * Opens an Open File Dialog and returns a list of file paths selected.
+ */ 
+vector<string> showOpenDialog() {
+    /*auto selection = pfd::open_file("Select a file", ".",
+                                { "Wave Files", "*.wav" },
+                                pfd::opt::multiselect).result();*/
+    vector<string> selection;
+    char const * filter[3] = {"*.wav", "*.aiff", "*.aif"};
+    auto result = tinyfd_openFileDialog("Select Audio File(s)", "", 3, filter, "Audio Files", 1);
+
+    if (result != NULL) {
+        string str_result(result);
+        str_result += "|";
+        auto del_index = str_result.find("|");
+
+        
+            do {
+                
+                auto one_file = str_result.substr(0, del_index);
+                selection.push_back(one_file);
+                printf("%s\n", one_file.c_str());
+                str_result = str_result.substr(del_index+1, str_result.length());
+                del_index = str_result.find("|");
+                
+            } while(del_index != std::string::npos);
+        
+        
+    }
+    return selection;
+}
+
+/**
+ * Opens a Choose Folder Dialog and returns the path of the folder chosen.
+ */
+string showSaveDialog() {
+    //string selection = pfd::select_folder("Select a folder to save.").result();
+    auto result = tinyfd_selectFolderDialog("Select a folder to save.", "");
+    if (result != NULL) {
+        return string(result);
+    } else {
+        return "";
+    }
+}
+
+/**
+ * Opens a Choose Folder Dialog for a folder of audio files, and returns its path, or "" if none was chosen.
+ * Picking a folder saves choosing thousands of files one by one in the Open File Dialog.
+ */
+string showFolderDialog() {
+    auto result = tinyfd_selectFolderDialog("Select a folder of audio files.", "");
+    return result != NULL ? string(result) : "";
+}
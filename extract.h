@@ -0,0 +1,180 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <utility>
+#include <vector>
+#include "compare.h"
+
+/**
+ * A channel extraction kernel.
+ * Copies the bytes of the first sample slot of each of numFrames interleaved frames to out,
+ * packed one sample after another. The bytes are copied as they are, so any sample format works.
+ */
+typedef void (*ExtractKernel)(const uint8_t *frames, size_t numFrames, int numBytesPerSample, int numBytesPerFrame, uint8_t *out);
+
+/**
+ * Copies the first slot of each frame for a sample size known at compile time,
+ * so every copy becomes a single load and store.
+ */
+template <int N>
+void extractFirstFixed(const uint8_t *frames, size_t numFrames, int numBytesPerFrame, uint8_t *out) {
+    for (size_t i = 0; i < numFrames; i++) {
+        memcpy(out + i * N, frames + i * numBytesPerFrame, N);
+    }
+}
+
+/**
+ * Plain C++ kernel, used when no vector unit is available and for the tail of every block.
+ */
+void extractFirstScalar(const uint8_t *frames, size_t numFrames, int numBytesPerSample, int numBytesPerFrame, uint8_t *out) {
+    switch (numBytesPerSample) {
+        case 1: extractFirstFixed<1>(frames, numFrames, numBytesPerFrame, out); break;
+        case 2: extractFirstFixed<2>(frames, numFrames, numBytesPerFrame, out); break;
+        case 3: extractFirstFixed<3>(frames, numFrames, numBytesPerFrame, out); break;
+        case 4: extractFirstFixed<4>(frames, numFrames, numBytesPerFrame, out); break;
+        default:
+            for (size_t i = 0; i < numFrames; i++) {
+                memcpy(out + i * numBytesPerSample, frames + i * numBytesPerFrame, numBytesPerSample);
+            }
+    }
+}
+
+#ifdef MONOC_X86
+/**
+ * SSE2 kernel for stereo 8, 16 and 32-bit frames. Reads 32 bytes of frames per step and keeps every other sample.
+ * Mono data is already packed, and other layouts go to the scalar kernel.
+ */
+MONOC_TARGET("sse2")
+void extractFirstSSE2(const uint8_t *frames, size_t numFrames, int numBytesPerSample, int numBytesPerFrame, uint8_t *out) {
+    if (numBytesPerFrame == numBytesPerSample) {
+        if (numFrames > 0) {
+            memcpy(out, frames, numFrames * numBytesPerSample);
+        }
+        return;
+    }
+    if (numBytesPerFrame != 2 * numBytesPerSample || numBytesPerSample == 3) {
+        extractFirstScalar(frames, numFrames, numBytesPerSample, numBytesPerFrame, out);
+        return;
+    }
+    size_t framesPerStep = 16 / numBytesPerSample;
+    size_t i = 0;
+    for (; i + framesPerStep <= numFrames; i += framesPerStep) {
+        const uint8_t *src = frames + i * numBytesPerFrame;
+        __m128i a = _mm_loadu_si128((const __m128i *)src);
+        __m128i b = _mm_loadu_si128((const __m128i *)(src + 16));
+        __m128i left;
+        if (numBytesPerSample == 1) {
+            // Clear the right bytes, then pack the 16-bit lanes down to their low bytes
+            const __m128i lowBytes = _mm_set1_epi16(0x00FF);
+            left = _mm_packus_epi16(_mm_and_si128(a, lowBytes), _mm_and_si128(b, lowBytes));
+        } else if (numBytesPerSample == 2) {
+            // Sign-extend the low half of each 32-bit lane so the saturating pack can't change it
+            left = _mm_packs_epi32(_mm_srai_epi32(_mm_slli_epi32(a, 16), 16), _mm_srai_epi32(_mm_slli_epi32(b, 16), 16));
+        } else {
+            left = _mm_castps_si128(_mm_shuffle_ps(_mm_castsi128_ps(a), _mm_castsi128_ps(b), _MM_SHUFFLE(2, 0, 2, 0)));
+        }
+        _mm_storeu_si128((__m128i *)(out + i * numBytesPerSample), left);
+    }
+    extractFirstScalar(frames + i * numBytesPerFrame, numFrames - i, numBytesPerSample, numBytesPerFrame, out + i * numBytesPerSample);
+}
+
+/**
+ * AVX2 kernel for stereo frames. 8, 16 and 32-bit samples take 64 bytes of frames per step.
+ * 24-bit samples are gathered four frames at a time with byte shuffles.
+ */
+MONOC_TARGET("avx2")
+void extractFirstAVX2(const uint8_t *frames, size_t numFrames, int numBytesPerSample, int numBytesPerFrame, uint8_t *out) {
+    if (numBytesPerFrame == numBytesPerSample) {
+        if (numFrames > 0) {
+            memcpy(out, frames, numFrames * numBytesPerSample);
+        }
+        return;
+    }
+    if (numBytesPerFrame != 2 * numBytesPerSample) {
+        extractFirstScalar(frames, numFrames, numBytesPerSample, numBytesPerFrame, out);
+        return;
+    }
+    size_t i = 0;
+    if (numBytesPerSample == 3) {
+        // Each 16-byte load holds two whole frames, the shuffles pick out their left samples.
+        // Stopping two frames early keeps the loads and the 16-byte store inside the buffers.
+        const __m128i firstPair = _mm_setr_epi8(0, 1, 2, 6, 7, 8, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1);
+        const __m128i secondPair = _mm_setr_epi8(-1, -1, -1, -1, -1, -1, 0, 1, 2, 6, 7, 8, -1, -1, -1, -1);
+        for (; i + 6 <= numFrames; i += 4) {
+            const uint8_t *src = frames + i * 6;
+            __m128i a = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)src), firstPair);
+            __m128i b = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)(src + 12)), secondPair);
+            _mm_storeu_si128((__m128i *)(out + i * 3), _mm_or_si128(a, b));
+        }
+    } else {
+        size_t framesPerStep = 32 / numBytesPerSample;
+        for (; i + framesPerStep <= numFrames; i += framesPerStep) {
+            const uint8_t *src = frames + i * numBytesPerFrame;
+            __m256i a = _mm256_loadu_si256((const __m256i *)src);
+            __m256i b = _mm256_loadu_si256((const __m256i *)(src + 32));
+            __m256i left;
+            if (numBytesPerSample == 1) {
+                const __m256i lowBytes = _mm256_set1_epi16(0x00FF);
+                left = _mm256_packus_epi16(_mm256_and_si256(a, lowBytes), _mm256_and_si256(b, lowBytes));
+            } else if (numBytesPerSample == 2) {
+                left = _mm256_packs_epi32(_mm256_srai_epi32(_mm256_slli_epi32(a, 16), 16), _mm256_srai_epi32(_mm256_slli_epi32(b, 16), 16));
+            } else {
+                left = _mm256_castps_si256(_mm256_shuffle_ps(_mm256_castsi256_ps(a), _mm256_castsi256_ps(b), _MM_SHUFFLE(2, 0, 2, 0)));
+            }
+            // The packs and shuffles work within each 128-bit lane, put the four quarters back in order
+            left = _mm256_permute4x64_epi64(left, _MM_SHUFFLE(3, 1, 2, 0));
+            _mm256_storeu_si256((__m256i *)(out + i * numBytesPerSample), left);
+        }
+    }
+    extractFirstScalar(frames + i * numBytesPerFrame, numFrames - i, numBytesPerSample, numBytesPerFrame, out + i * numBytesPerSample);
+}
+#endif
+
+/**
+ * Returns the channel extraction kernel for a given instruction set.
+ * There is no AVX-512 version, the copy is already bound by memory bandwidth at AVX2 width.
+ */
+ExtractKernel extractKernelFor(SimdLevel level) {
+#ifdef MONOC_X86
+    switch (level) {
+        case SimdLevel::AVX512:
+        case SimdLevel::AVX2: return extractFirstAVX2;
+        case SimdLevel::SSE2: return extractFirstSSE2;
+        default: break;
+    }
+#endif
+    return extractFirstScalar;
+}
+
+/**
+ * Returns the fastest channel extraction kernel this machine supports.
+ */
+ExtractKernel getExtractKernel() {
+    static const ExtractKernel kernel = extractKernelFor(detectSimdLevel());
+    return kernel;
+}
+
+/**
+ * Copies the samples of the given channels, in ascending order, out of each of numFrames interleaved frames to out,
+ * packed into frames of just those channels. Neighbouring channels are copied together.
+ */
+void extractChannels(const uint8_t *frames, size_t numFrames, int numBytesPerSample, int numBytesPerFrame, const std::vector<int> &channels, uint8_t *out) {
+    // Turn the channels into runs of consecutive channels, as a byte offset and length in each frame
+    std::vector<std::pair<int, int>> runs;
+    for (size_t i = 0; i < channels.size(); i++) {
+        int offset = channels[i] * numBytesPerSample;
+        if (!runs.empty() && runs.back().first + runs.back().second == offset) {
+            runs.back().second += numBytesPerSample;
+        } else {
+            runs.push_back(std::make_pair(offset, numBytesPerSample));
+        }
+    }
+    for (size_t i = 0; i < numFrames; i++) {
+        const uint8_t *frame = frames + i * numBytesPerFrame;
+        for (size_t r = 0; r < runs.size(); r++) {
+            memcpy(out, frame + runs[r].first, runs[r].second);
+            out += runs[r].second;
+        }
+    }
+}
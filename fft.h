@@ -0,0 +1,271 @@
+#pragma once
+#include <cmath>
+#include <cstddef>
+#include <utility>
+#include <vector>
+#include "compare.h"
+
+/**
+ * A fused radix-4 FFT pass.
+ * Runs two radix-2 decimation in time stages, of half sizes m and 2m, over n complex values stored as
+ * separate real and imaginary arrays. w1 holds the m twiddles of the first stage and w2 those of the second.
+ */
+typedef void (*Radix4Kernel)(float *re, float *im, size_t n, size_t m, const float *w1re, const float *w1im, const float *w2re, const float *w2im);
+
+/**
+ * Plain C++ radix-4 pass, used when no vector unit is available and for the passes too narrow to vectorise.
+ * Each butterfly takes x[k], x[k+m], x[k+2m] and x[k+3m]. The second stage's twiddle for x[k+3m] is
+ * the one for x[k+2m] turned a quarter circle, so it needs no table of its own.
+ */
+void radix4Scalar(float *re, float *im, size_t n, size_t m, const float *w1re, const float *w1im, const float *w2re, const float *w2im) {
+    for (size_t base = 0; base < n; base += 4 * m) {
+        for (size_t j = 0; j < m; j++) {
+            size_t k0 = base + j, k1 = k0 + m, k2 = k1 + m, k3 = k2 + m;
+            // First stage: (x0, x1) and (x2, x3)
+            float t1re = re[k1] * w1re[j] - im[k1] * w1im[j], t1im = re[k1] * w1im[j] + im[k1] * w1re[j];
+            float t3re = re[k3] * w1re[j] - im[k3] * w1im[j], t3im = re[k3] * w1im[j] + im[k3] * w1re[j];
+            float b0re = re[k0] + t1re, b0im = im[k0] + t1im;
+            float b1re = re[k0] - t1re, b1im = im[k0] - t1im;
+            float b2re = re[k2] + t3re, b2im = im[k2] + t3im;
+            float b3re = re[k2] - t3re, b3im = im[k2] - t3im;
+            // Second stage: (b0, b2) with w2, and (b1, b3) with -i * w2
+            float u2re = b2re * w2re[j] - b2im * w2im[j], u2im = b2re * w2im[j] + b2im * w2re[j];
+            float u3re = b3re * w2im[j] + b3im * w2re[j], u3im = b3im * w2im[j] - b3re * w2re[j];
+            re[k0] = b0re + u2re; im[k0] = b0im + u2im;
+            re[k2] = b0re - u2re; im[k2] = b0im - u2im;
+            re[k1] = b1re + u3re; im[k1] = b1im + u3im;
+            re[k3] = b1re - u3re; im[k3] = b1im - u3im;
+        }
+    }
+}
+
+#ifdef MONOC_X86
+/**
+ * SSE2 radix-4 pass. Runs 4 butterflies side by side, one for each of 4 neighbouring twiddles.
+ */
+MONOC_TARGET("sse2")
+void radix4SSE2(float *re, float *im, size_t n, size_t m, const float *w1re, const float *w1im, const float *w2re, const float *w2im) {
+    if (m < 4) {
+        radix4Scalar(re, im, n, m, w1re, w1im, w2re, w2im);
+        return;
+    }
+    for (size_t base = 0; base < n; base += 4 * m) {
+        for (size_t j = 0; j < m; j += 4) {
+            size_t k0 = base + j, k1 = k0 + m, k2 = k1 + m, k3 = k2 + m;
+            __m128 a1re = _mm_loadu_ps(w1re + j), a1im = _mm_loadu_ps(w1im + j);
+            __m128 a2re = _mm_loadu_ps(w2re + j), a2im = _mm_loadu_ps(w2im + j);
+            __m128 x0re = _mm_loadu_ps(re + k0), x0im = _mm_loadu_ps(im + k0);
+            __m128 x1re = _mm_loadu_ps(re + k1), x1im = _mm_loadu_ps(im + k1);
+            __m128 x2re = _mm_loadu_ps(re + k2), x2im = _mm_loadu_ps(im + k2);
+            __m128 x3re = _mm_loadu_ps(re + k3), x3im = _mm_loadu_ps(im + k3);
+            __m128 t1re = _mm_sub_ps(_mm_mul_ps(x1re, a1re), _mm_mul_ps(x1im, a1im));
+            __m128 t1im = _mm_add_ps(_mm_mul_ps(x1re, a1im), _mm_mul_ps(x1im, a1re));
+            __m128 t3re = _mm_sub_ps(_mm_mul_ps(x3re, a1re), _mm_mul_ps(x3im, a1im));
+            __m128 t3im = _mm_add_ps(_mm_mul_ps(x3re, a1im), _mm_mul_ps(x3im, a1re));
+            __m128 b0re = _mm_add_ps(x0re, t1re), b0im = _mm_add_ps(x0im, t1im);
+            __m128 b1re = _mm_sub_ps(x0re, t1re), b1im = _mm_sub_ps(x0im, t1im);
+            __m128 b2re = _mm_add_ps(x2re, t3re), b2im = _mm_add_ps(x2im, t3im);
+            __m128 b3re = _mm_sub_ps(x2re, t3re), b3im = _mm_sub_ps(x2im, t3im);
+            __m128 u2re = _mm_sub_ps(_mm_mul_ps(b2re, a2re), _mm_mul_ps(b2im, a2im));
+            __m128 u2im = _mm_add_ps(_mm_mul_ps(b2re, a2im), _mm_mul_ps(b2im, a2re));
+            __m128 u3re = _mm_add_ps(_mm_mul_ps(b3re, a2im), _mm_mul_ps(b3im, a2re));
+            __m128 u3im = _mm_sub_ps(_mm_mul_ps(b3im, a2im), _mm_mul_ps(b3re, a2re));
+            _mm_storeu_ps(re + k0, _mm_add_ps(b0re, u2re)); _mm_storeu_ps(im + k0, _mm_add_ps(b0im, u2im));
+            _mm_storeu_ps(re + k2, _mm_sub_ps(b0re, u2re)); _mm_storeu_ps(im + k2, _mm_sub_ps(b0im, u2im));
+            _mm_storeu_ps(re + k1, _mm_add_ps(b1re, u3re)); _mm_storeu_ps(im + k1, _mm_add_ps(b1im, u3im));
+            _mm_storeu_ps(re + k3, _mm_sub_ps(b1re, u3re)); _mm_storeu_ps(im + k3, _mm_sub_ps(b1im, u3im));
+        }
+    }
+}
+
+/**
+ * AVX2 radix-4 pass. Same as the SSE2 one but 8 butterflies at a time.
+ */
+MONOC_TARGET("avx2")
+void radix4AVX2(float *re, float *im, size_t n, size_t m, const float *w1re, const float *w1im, const float *w2re, const float *w2im) {
+    if (m < 8) {
+        radix4SSE2(re, im, n, m, w1re, w1im, w2re, w2im);
+        return;
+    }
+    for (size_t base = 0; base < n; base += 4 * m) {
+        for (size_t j = 0; j < m; j += 8) {
+            size_t k0 = base + j, k1 = k0 + m, k2 = k1 + m, k3 = k2 + m;
+            __m256 a1re = _mm256_loadu_ps(w1re + j), a1im = _mm256_loadu_ps(w1im + j);
+            __m256 a2re = _mm256_loadu_ps(w2re + j), a2im = _mm256_loadu_ps(w2im + j);
+            __m256 x0re = _mm256_loadu_ps(re + k0), x0im = _mm256_loadu_ps(im + k0);
+            __m256 x1re = _mm256_loadu_ps(re + k1), x1im = _mm256_loadu_ps(im + k1);
+            __m256 x2re = _mm256_loadu_ps(re + k2), x2im = _mm256_loadu_ps(im + k2);
+            __m256 x3re = _mm256_loadu_ps(re + k3), x3im = _mm256_loadu_ps(im + k3);
+            __m256 t1re = _mm256_sub_ps(_mm256_mul_ps(x1re, a1re), _mm256_mul_ps(x1im, a1im));
+            __m256 t1im = _mm256_add_ps(_mm256_mul_ps(x1re, a1im), _mm256_mul_ps(x1im, a1re));
+            __m256 t3re = _mm256_sub_ps(_mm256_mul_ps(x3re, a1re), _mm256_mul_ps(x3im, a1im));
+            __m256 t3im = _mm256_add_ps(_mm256_mul_ps(x3re, a1im), _mm256_mul_ps(x3im, a1re));
+            __m256 b0re = _mm256_add_ps(x0re, t1re), b0im = _mm256_add_ps(x0im, t1im);
+            __m256 b1re = _mm256_sub_ps(x0re, t1re), b1im = _mm256_sub_ps(x0im, t1im);
+            __m256 b2re = _mm256_add_ps(x2re, t3re), b2im = _mm256_add_ps(x2im, t3im);
+            __m256 b3re = _mm256_sub_ps(x2re, t3re), b3im = _mm256_sub_ps(x2im, t3im);
+            __m256 u2re = _mm256_sub_ps(_mm256_mul_ps(b2re, a2re), _mm256_mul_ps(b2im, a2im));
+            __m256 u2im = _mm256_add_ps(_mm256_mul_ps(b2re, a2im), _mm256_mul_ps(b2im, a2re));
+            __m256 u3re = _mm256_add_ps(_mm256_mul_ps(b3re, a2im), _mm256_mul_ps(b3im, a2re));
+            __m256 u3im = _mm256_sub_ps(_mm256_mul_ps(b3im, a2im), _mm256_mul_ps(b3re, a2re));
+            _mm256_storeu_ps(re + k0, _mm256_add_ps(b0re, u2re)); _mm256_storeu_ps(im + k0, _mm256_add_ps(b0im, u2im));
+            _mm256_storeu_ps(re + k2, _mm256_sub_ps(b0re, u2re)); _mm256_storeu_ps(im + k2, _mm256_sub_ps(b0im, u2im));
+            _mm256_storeu_ps(re + k1, _mm256_add_ps(b1re, u3re)); _mm256_storeu_ps(im + k1, _mm256_add_ps(b1im, u3im));
+            _mm256_storeu_ps(re + k3, _mm256_sub_ps(b1re, u3re)); _mm256_storeu_ps(im + k3, _mm256_sub_ps(b1im, u3im));
+        }
+    }
+}
+#endif
+
+/**
+ * Returns the radix-4 pass for a given instruction set.
+ * There is no AVX-512 version, the passes are already bound by memory bandwidth at AVX2 width.
+ */
+Radix4Kernel radix4KernelFor(SimdLevel level) {
+#ifdef MONOC_X86
+    switch (level) {
+        case SimdLevel::AVX512:
+        case SimdLevel::AVX2: return radix4AVX2;
+        case SimdLevel::SSE2: return radix4SSE2;
+        default: break;
+    }
+#endif
+    return radix4Scalar;
+}
+
+/**
+ * Returns the fastest radix-4 pass this machine supports.
+ */
+Radix4Kernel getRadix4Kernel() {
+    static const Radix4Kernel kernel = radix4KernelFor(detectSimdLevel());
+    return kernel;
+}
+
+/**
+ * A fast Fourier transform of real signals of one power of two size.
+ * A signal of n samples is transformed as n / 2 complex values, the even samples as the real parts and
+ * the odd ones as the imaginary parts, which are then untangled into the n / 2 + 1 bins of the real signal.
+ * The complex transform pairs its radix-2 stages up into radix-4 passes, so it reads the data half as often.
+ * The tables are built once, then any number of signals can be transformed. An object isn't thread safe,
+ * use one per thread.
+ */
+class RealFFT {
+public:
+    /**
+     * Prepares transforms of size samples, which must be a power of two and at least 4.
+     */
+    explicit RealFFT(size_t size) : n(size), half(size / 2), re(size / 2), im(size / 2) {
+        const double pi = 3.14159265358979323846;
+        // Reorders the input so the stages can run in place
+        int bits = 0;
+        while (((size_t)1 << bits) < half) {
+            bits++;
+        }
+        reversed.resize(half);
+        for (size_t i = 0; i < half; i++) {
+            size_t r = 0;
+            for (int b = 0; b < bits; b++) {
+                r |= ((i >> b) & 1) << (bits - 1 - b);
+            }
+            reversed[i] = r;
+        }
+        // An odd number of stages starts with a plain radix-2 stage, the rest are paired up
+        firstRadix2 = bits % 2 == 1;
+        for (size_t m = firstRadix2 ? 2 : 1; m < half; m *= 4) {
+            Pass pass;
+            pass.m = m;
+            for (size_t j = 0; j < m; j++) {
+                pass.w1re.push_back((float)std::cos(-pi * j / m));
+                pass.w1im.push_back((float)std::sin(-pi * j / m));
+                pass.w2re.push_back((float)std::cos(-pi * j / (2 * m)));
+                pass.w2im.push_back((float)std::sin(-pi * j / (2 * m)));
+            }
+            passes.push_back(pass);
+        }
+        // Twiddles for untangling the real signal's bins from the complex transform
+        for (size_t k = 0; k <= half; k++) {
+            untangleRe.push_back((float)std::cos(-2 * pi * k / n));
+            untangleIm.push_back((float)std::sin(-2 * pi * k / n));
+        }
+    }
+
+    size_t size() const {
+        return n;
+    }
+
+    /**
+     * Transforms size() real samples into size() / 2 + 1 complex bins, written to outRe and outIm.
+     */
+    void forward(const float *in, float *outRe, float *outIm) {
+        for (size_t i = 0; i < half; i++) {
+            re[reversed[i]] = in[2 * i];
+            im[reversed[i]] = in[2 * i + 1];
+        }
+        transform(re.data(), im.data());
+        // X[k] = E[k] + W^k O[k], where E and O are the transforms of the even and odd samples:
+        // E[k] = (Z[k] + conj(Z[half - k])) / 2 and O[k] = (Z[k] - conj(Z[half - k])) / 2i
+        for (size_t k = 0; k <= half; k++) {
+            size_t a = k % half, b = (half - k) % half;
+            float eRe = 0.5f * (re[a] + re[b]), eIm = 0.5f * (im[a] - im[b]);
+            float oRe = 0.5f * (im[a] + im[b]), oIm = -0.5f * (re[a] - re[b]);
+            outRe[k] = eRe + oRe * untangleRe[k] - oIm * untangleIm[k];
+            outIm[k] = eIm + oRe * untangleIm[k] + oIm * untangleRe[k];
+        }
+    }
+
+    /**
+     * Turns size() / 2 + 1 complex bins back into size() real samples.
+     * Like most FFTs it doesn't divide by the size, so a forward and inverse transform scales the signal by size().
+     */
+    void inverse(const float *inRe, const float *inIm, float *out) {
+        // Rebuild Z[k] = E[k] + i O[k] from E[k] = (X[k] + conj(X[half - k])) / 2 and
+        // O[k] = (X[k] - conj(X[half - k])) / 2 / W^k, then undo the complex transform
+        for (size_t k = 0; k < half; k++) {
+            size_t b = half - k;
+            float eRe = 0.5f * (inRe[k] + inRe[b]), eIm = 0.5f * (inIm[k] - inIm[b]);
+            float dRe = 0.5f * (inRe[k] - inRe[b]), dIm = 0.5f * (inIm[k] + inIm[b]);
+            float oRe = dRe * untangleRe[k] + dIm * untangleIm[k];
+            float oIm = dIm * untangleRe[k] - dRe * untangleIm[k];
+            // The inverse is the forward transform with the real and imaginary parts swapped on the way in and out
+            re[reversed[k]] = 2 * (eIm + oRe);
+            im[reversed[k]] = 2 * (eRe - oIm);
+        }
+        transform(re.data(), im.data());
+        for (size_t i = 0; i < half; i++) {
+            out[2 * i] = im[i];
+            out[2 * i + 1] = re[i];
+        }
+    }
+
+private:
+    struct Pass {
+        size_t m;
+        std::vector<float> w1re, w1im, w2re, w2im;
+    };
+
+    /**
+     * Runs the complex transform in place on input that has already been put in bit-reversed order.
+     */
+    void transform(float *xre, float *xim) {
+        if (firstRadix2) {
+            for (size_t k = 0; k < half; k += 2) {
+                float are = xre[k], aim = xim[k];
+                xre[k] = are + xre[k + 1]; xim[k] = aim + xim[k + 1];
+                xre[k + 1] = are - xre[k + 1]; xim[k + 1] = aim - xim[k + 1];
+            }
+        }
+        Radix4Kernel radix4 = getRadix4Kernel();
+        for (size_t p = 0; p < passes.size(); p++) {
+            const Pass &pass = passes[p];
+            radix4(xre, xim, half, pass.m, pass.w1re.data(), pass.w1im.data(), pass.w2re.data(), pass.w2im.data());
+        }
+    }
+
+    size_t n;
+    size_t half;
+    bool firstRadix2 = false;
+    std::vector<size_t> reversed;
+    std::vector<Pass> passes;
+    std::vector<float> untangleRe, untangleIm;
+    std::vector<float> re, im;
+};
@@ -32,6 +32,28 @@
 #include <unordered_map>
 #include <iterator>
 #include <algorithm>
+#include <limits>
+#include <type_traits>
+#include <memory>
+#include <cstdint>
+
+// memory-map files and write them through file descriptors where the platform supports it
+#if defined (__unix__) || defined (__APPLE__)
+    #define AUDIOFILE_USE_MMAP 1
+    #define AUDIOFILE_USE_POSIX_IO 1
+    #include <cerrno>
+    #include <fcntl.h>
+    #include <sys/mman.h>
+    #include <sys/stat.h>
+    #include <sys/uio.h>
+    #include <unistd.h>
+#endif
+
+// decode samples four at a time where the compiler targets SSE2, which every x86-64 build does
+#if defined (__SSE2__) || defined (_M_X64) || (defined (_M_IX86_FP) && _M_IX86_FP >= 2)
+    #define AUDIOFILE_USE_SSE2 1
+    #include <emmintrin.h>
+#endif
 
 // disable some warnings on Windows
 #if defined (_MSC_VER)
@@ -61,6 +83,429 @@ enum class AudioFileFormat
     Aiff
 };
 
+//=============================================================
+/** Describes where and how the samples of a WAV or AIFF file are
+ * stored in its data, so they can be read without being decoded
+ */
+struct AudioFileLayout
+{
+    AudioFileFormat format {AudioFileFormat::NotLoaded};
+    int audioFormat {0}; // a WavAudioFormat or AIFFAudioFormat value
+    int numChannels {0};
+    int bitDepth {0};
+    uint32_t sampleRate {0};
+    bool bigEndian {false};
+    size_t numSamplesPerChannel {0};
+    size_t samplesStartIndex {0};
+    int numBytesPerSample {0};
+    int numBytesPerFrame {0};
+    size_t iXMLChunkStartIndex {0}; // where the iXML chunk's data starts, 0 if there isn't one (only set by readLayout)
+    size_t iXMLChunkSize {0};
+    
+    /** @Returns the number of bytes of sample data */
+    uint64_t getDataSize() const { return (uint64_t) numSamplesPerChannel * numBytesPerFrame; }
+};
+
+//=============================================================
+/** Read-only access to the bytes of an audio file. The bytes are either
+ * memory-mapped straight from the file (so the decoders read from the page
+ * cache without a copy) or borrowed from a vector that lives elsewhere.
+ */
+class AudioFileData
+{
+public:
+    
+    //=============================================================
+    AudioFileData() {}
+    
+    /** Borrows the bytes of a vector, which must outlive this object */
+    AudioFileData (const std::vector<uint8_t>& v) : bytes (v.data()), length (v.size()) {}
+    
+    ~AudioFileData() { close(); }
+    
+    AudioFileData (const AudioFileData&) = delete;
+    AudioFileData& operator= (const AudioFileData&) = delete;
+    
+    //=============================================================
+    /** Opens a file for reading, memory-mapping it where possible.
+     * @Returns true if the whole file is available
+     */
+    bool open (const std::string& filePath);
+    
+    /** Releases the file's bytes */
+    void close();
+    
+    //=============================================================
+    const uint8_t& operator[] (size_t i) const { return bytes[i]; }
+    const uint8_t* data() const { return bytes; }
+    size_t size() const { return length; }
+    const uint8_t* begin() const { return bytes; }
+    const uint8_t* end() const { return bytes + length; }
+    
+private:
+    
+    //=============================================================
+    const uint8_t* bytes {nullptr};
+    size_t length {0};
+    bool mapped {false};
+    std::vector<uint8_t> storage; // used when the file can't be mapped
+};
+
+//=============================================================
+/** Writes the bytes of an audio file through a large buffer, so the file goes out in
+ * a few big system calls that start on block boundaries rather than many small ones.
+ * A write that overflows the buffer is sent together with what is already buffered
+ * in one gathered call, without copying it first.
+ */
+class AudioFileSink
+{
+public:
+    
+    //=============================================================
+    AudioFileSink() {}
+    
+    ~AudioFileSink() { close(); }
+    
+    AudioFileSink (const AudioFileSink&) = delete;
+    AudioFileSink& operator= (const AudioFileSink&) = delete;
+    
+    //=============================================================
+    /** Creates a file for writing, replacing any file already at that path.
+     * @Returns true if the file was created
+     */
+    bool open (const std::string& filePath);
+    
+    /** Appends size bytes to the file.
+     * @Returns false if anything written so far has failed
+     */
+    bool write (const uint8_t* data, size_t size);
+    
+    /** Overwrites size bytes starting at a given offset, e.g. to fill in a header once the sizes are known.
+     * Anything buffered is written out first.
+     * @Returns false if anything written so far has failed
+     */
+    bool writeAt (const uint8_t* data, size_t size, uint64_t offset);
+    
+    /** Writes out anything still buffered.
+     * @Returns false if anything written so far has failed
+     */
+    bool flush();
+    
+    /** Flushes and closes the file.
+     * @Returns true if everything was written
+     */
+    bool close();
+    
+    //=============================================================
+    /** @Returns true if a file is open */
+    bool isOpen() const;
+    
+    /** @Returns the number of bytes appended since the file was opened */
+    uint64_t getNumBytesWritten() const { return numBytesWritten; }
+    
+    //=============================================================
+    /** The size of the buffer, and of most of the writes made to the file */
+    static constexpr size_t bufferSize = 1 << 20;
+    
+private:
+    
+    //=============================================================
+    bool writeGathered (const uint8_t* first, size_t firstSize, const uint8_t* second, size_t secondSize);
+    
+    //=============================================================
+#if AUDIOFILE_USE_POSIX_IO
+    int fd {-1};
+#else
+    std::ofstream file;
+#endif
+    std::vector<uint8_t> buffer;
+    size_t numBuffered {0};
+    uint64_t numBytesWritten {0};
+    bool failed {false};
+};
+
+//=============================================================
+/** Reads bytes from given offsets of a file, so reads from scattered parts of a file
+ * don't each need a seek first. Nothing is buffered, each read goes straight to the file.
+ */
+class AudioFileSource
+{
+public:
+    
+    //=============================================================
+    AudioFileSource() {}
+    
+    ~AudioFileSource() { close(); }
+    
+    AudioFileSource (const AudioFileSource&) = delete;
+    AudioFileSource& operator= (const AudioFileSource&) = delete;
+    
+    //=============================================================
+    /** Opens a file for reading.
+     * @Returns true if the file was opened
+     */
+    bool open (const std::string& filePath);
+    
+    /** Reads up to size bytes starting at a given offset.
+     * @Returns the number of bytes read, less than size only at the end of the file or on an error
+     */
+    size_t readAt (uint8_t* data, size_t size, uint64_t offset);
+    
+    /** Closes the file */
+    void close();
+    
+    //=============================================================
+    /** @Returns true if a file is open */
+    bool isOpen() const;
+    
+private:
+    
+    //=============================================================
+#if AUDIOFILE_USE_POSIX_IO
+    int fd {-1};
+#else
+    std::ifstream file;
+#endif
+};
+
+//=============================================================
+/** Where a chunk is in a WAV or AIFF file */
+struct AudioFileChunk
+{
+    char id[4];
+    size_t offset; // where the chunk's 8-byte header starts
+    uint64_t size; // the size of the chunk's data, taken from the ds64 chunk for an RF64 data chunk
+};
+
+//=============================================================
+/** A table of the chunks in a WAV or AIFF file, made by walking the chunk headers once,
+ * so the parsers can look up any chunk without searching the file again. Room for the
+ * first 32 chunks is kept inside the table, so ordinary files are indexed without allocating
+ */
+class AudioFileChunkDirectory
+{
+public:
+    
+    //=============================================================
+    /** Walks the chunks of a file of fileSize bytes, reading its headers with readBytes (offset, numBytes, dest),
+     * which copies numBytes bytes from the file and returns false if it can't.
+     * @Returns false if the file is too short to have a RIFF or FORM header
+     */
+    template <class ReadBytes>
+    bool build (uint64_t fileSize, bool bigEndian, ReadBytes readBytes);
+    
+    /** Walks the chunks of a file that is all in memory */
+    bool build (const AudioFileData& fileData, bool bigEndian);
+    
+    //=============================================================
+    /** @Returns the first chunk with a given four character ID, or nullptr if there isn't one */
+    const AudioFileChunk* find (const char* id) const;
+    
+    /** @Returns the size of the RIFF or FORM chunk that holds the whole file, taken from the ds64 chunk in an RF64 file */
+    uint64_t getFormSize() const { return formSize; }
+    
+    size_t size() const { return numChunks; }
+    const AudioFileChunk& operator[] (size_t i) const { return i < numInlineChunks ? inlineChunks[i] : moreChunks[i - numInlineChunks]; }
+    
+private:
+    
+    //=============================================================
+    void add (const uint8_t* header, size_t offset, uint64_t size);
+    
+    //=============================================================
+    static const size_t numInlineChunks = 32;
+    
+    AudioFileChunk inlineChunks[numInlineChunks];
+    std::vector<AudioFileChunk> moreChunks;
+    size_t numChunks {0};
+    uint64_t formSize {0};
+};
+
+//=============================================================
+/** A view of a run of contiguous samples, such as one channel of an AudioSampleBuffer */
+template <class T>
+class AudioSampleSpan
+{
+public:
+    
+    //=============================================================
+    AudioSampleSpan (T* samples, size_t numSamples) : samples (samples), numSamples (numSamples) {}
+    
+    //=============================================================
+    T& operator[] (size_t i) const { return samples[i]; }
+    T* data() const { return samples; }
+    size_t size() const { return numSamples; }
+    bool empty() const { return numSamples == 0; }
+    T* begin() const { return samples; }
+    T* end() const { return samples + numSamples; }
+    
+private:
+    
+    //=============================================================
+    T* samples;
+    size_t numSamples;
+};
+
+//=============================================================
+/** Audio samples for any number of channels, stored planar in a single block of memory. Every channel
+ * starts on a 64-byte boundary, so vector code can read whole cache lines. You can access the samples
+ * by channel and then by sample index, i.e:
+ *
+ *      buffer[channel][sampleIndex]
+ *
+ * Changing the size only reallocates when the buffer needs more room than it already has, so dropping
+ * channels or shortening the channels never moves any samples.
+ */
+template <class T>
+class AudioSampleBuffer
+{
+public:
+    
+    //=============================================================
+    /** A frame by frame view of a buffer's samples, in the order an interleaved file stores them */
+    template <class U>
+    class InterleavedView
+    {
+    public:
+        
+        //=============================================================
+        InterleavedView (U* samples, size_t channelStride, int numChannels, size_t numFrames)
+         : samples (samples), channelStride (channelStride), numChannels (numChannels), numFrames (numFrames) {}
+        
+        //=============================================================
+        /** @Returns the sample of a channel in a given frame */
+        U& operator() (size_t frame, int channel) const { return samples[channel * channelStride + frame]; }
+        
+        /** @Returns sample i of the interleaved sequence, which is channel i % numChannels of frame i / numChannels */
+        U& operator[] (size_t i) const { return (*this) (i / numChannels, (int) (i % numChannels)); }
+        
+        size_t size() const { return numFrames * numChannels; }
+        int getNumChannels() const { return numChannels; }
+        size_t getNumFrames() const { return numFrames; }
+        
+        /** Copies numFramesToCopy frames, starting at startFrame, to dest as interleaved samples */
+        void copyTo (typename std::remove_const<U>::type* dest, size_t startFrame, size_t numFramesToCopy) const
+        {
+            for (size_t i = 0; i < numFramesToCopy; i++)
+                for (int channel = 0; channel < numChannels; channel++)
+                    *dest++ = (*this) (startFrame + i, channel);
+        }
+        
+    private:
+        
+        //=============================================================
+        U* samples;
+        size_t channelStride;
+        int numChannels;
+        size_t numFrames;
+    };
+    
+    //=============================================================
+    /** Steps through a buffer's channels, so a range-based for loop sees it as a list of channels */
+    template <class U>
+    class ChannelIterator
+    {
+    public:
+        
+        //=============================================================
+        ChannelIterator (U* samples, size_t channelStride, size_t numSamples, int channel)
+         : span (samples + channel * channelStride, numSamples), channelStride (channelStride), channel (channel) {}
+        
+        //=============================================================
+        AudioSampleSpan<U>& operator*() { return span; }
+        AudioSampleSpan<U>* operator->() { return &span; }
+        
+        ChannelIterator& operator++()
+        {
+            span = AudioSampleSpan<U> (span.data() + channelStride, span.size());
+            channel++;
+            return *this;
+        }
+        
+        bool operator== (const ChannelIterator& other) const { return channel == other.channel; }
+        bool operator!= (const ChannelIterator& other) const { return channel != other.channel; }
+        
+    private:
+        
+        //=============================================================
+        AudioSampleSpan<U> span; // the current channel, kept here so that loops can take it by reference
+        size_t channelStride;
+        int channel;
+    };
+    
+    //=============================================================
+    /** Constructor, creating an empty buffer */
+    AudioSampleBuffer() {}
+    
+    /** Constructor, creating a buffer of a given size with every sample set to zero */
+    AudioSampleBuffer (int numChannels, size_t numSamples) { setSize (numChannels, numSamples); }
+    
+    AudioSampleBuffer (const AudioSampleBuffer& other);
+    AudioSampleBuffer (AudioSampleBuffer&& other) noexcept { swap (other); }
+    AudioSampleBuffer& operator= (AudioSampleBuffer other) noexcept { swap (other); return *this; }
+    
+    //=============================================================
+    /** Changes the number of channels and the number of samples per channel.
+     * If keepExistingContent is true, the samples that are still in range keep their values and any new
+     * samples are set to zero. Otherwise the contents are left undefined, which is quicker when they
+     * are about to be overwritten anyway
+     */
+    void setSize (int newNumChannels, size_t newNumSamples, bool keepExistingContent = true);
+    
+    /** Sets the number of channels, keeping the existing ones and setting any new ones to zero */
+    void setNumChannels (int newNumChannels) { setSize (newNumChannels, numSamples); }
+    
+    /** Sets the number of samples per channel, keeping the existing ones and setting any new ones to zero */
+    void setNumSamplesPerChannel (size_t newNumSamples) { setSize (numChannels, newNumSamples); }
+    
+    /** Sets the number of channels, as resizing a vector of channels did */
+    void resize (size_t newNumChannels) { setNumChannels ((int) newNumChannels); }
+    
+    /** Removes every channel, keeping the memory for later use */
+    void clear() { numChannels = 0; numSamples = 0; }
+    
+    //=============================================================
+    /** @Returns the number of channels */
+    size_t size() const { return (size_t) numChannels; }
+    bool empty() const { return numChannels == 0; }
+    int getNumChannels() const { return numChannels; }
+    size_t getNumSamplesPerChannel() const { return numSamples; }
+    
+    /** @Returns the distance in samples from the start of one channel to the start of the next */
+    size_t getChannelStride() const { return channelStride; }
+    
+    //=============================================================
+    AudioSampleSpan<T> operator[] (int channel) { return AudioSampleSpan<T> (samples + channel * channelStride, numSamples); }
+    AudioSampleSpan<const T> operator[] (int channel) const { return AudioSampleSpan<const T> (samples + channel * channelStride, numSamples); }
+    
+    ChannelIterator<T> begin() { return ChannelIterator<T> (samples, channelStride, numSamples, 0); }
+    ChannelIterator<T> end() { return ChannelIterator<T> (samples, channelStride, numSamples, numChannels); }
+    ChannelIterator<const T> begin() const { return ChannelIterator<const T> (samples, channelStride, numSamples, 0); }
+    ChannelIterator<const T> end() const { return ChannelIterator<const T> (samples, channelStride, numSamples, numChannels); }
+    
+    InterleavedView<T> interleaved() { return InterleavedView<T> (samples, channelStride, numChannels, numSamples); }
+    InterleavedView<const T> interleaved() const { return InterleavedView<const T> (samples, channelStride, numChannels, numSamples); }
+    
+    //=============================================================
+    bool operator== (const AudioSampleBuffer& other) const;
+    bool operator!= (const AudioSampleBuffer& other) const { return ! (*this == other); }
+    
+    void swap (AudioSampleBuffer& other) noexcept;
+    
+private:
+    
+    //=============================================================
+    static const size_t alignment = 64;
+    
+    //=============================================================
+    std::unique_ptr<uint8_t[]> allocation;
+    T* samples {nullptr};
+    size_t capacity {0}; // the number of samples the allocation has room for
+    size_t channelStride {0};
+    int numChannels {0};
+    size_t numSamples {0};
+};
+
 //=============================================================
 template <class T>
 class AudioFile
@@ -68,7 +513,7 @@ class AudioFile
 public:
     
     //=============================================================
-    typedef std::vector<std::vector<T> > AudioBuffer;
+    typedef AudioSampleBuffer<T> AudioBuffer;
     
     //=============================================================
     /** Constructor */
@@ -83,6 +528,34 @@ public:
      */
     bool load (std::string filePath);
     
+    /** Loads an audio file from data in memory
+     * @Returns true if the data was successfully decoded
+     */
+    bool loadFromMemory (const AudioFileData& fileData);
+    
+    /** Opens the raw bytes of an audio file and works out where its samples are, without decoding them.
+     * @Returns true if the file was opened and its header is valid
+     */
+    bool loadLayout (std::string filePath, AudioFileData& fileData, AudioFileLayout& layout);
+    
+    /** Reads only the header of an audio file, stopping where its sample data starts. This is enough to tell a
+     * file's format, channels, bit depth, sample rate and data size without reading any samples, and most
+     * files' headers are read with a single read of the file's first few kilobytes.
+     * @Returns true if the header is valid
+     */
+    bool readLayout (std::string filePath, AudioFileLayout& layout);
+    
+    /** Decodes a block of interleaved sample frames, stored as described by layout, into buffer.
+     * The buffer is resized to the layout's number of channels and numFrames samples per channel.
+     */
+    void decodeFrames (const uint8_t* frameData, size_t numFrames, const AudioFileLayout& layout, AudioBuffer& buffer);
+    
+    /** Encodes numFrames frames from buffer, starting at startFrame, as interleaved samples stored as described
+     * by layout, and appends them to frameData. Only the first layout.numChannels channels of the buffer are used.
+     * @Returns false if the layout's bit depth is not supported
+     */
+    bool encodeFrames (const AudioBuffer& buffer, size_t startFrame, size_t numFrames, const AudioFileLayout& layout, std::vector<uint8_t>& frameData);
+    
     /** Saves an audio file to a given file path.
      * @Returns true if the file was successfully saved
      */
@@ -105,7 +578,7 @@ public:
     int getBitDepth() const;
     
     /** @Returns the number of samples per channel */
-    int getNumSamplesPerChannel() const;
+    size_t getNumSamplesPerChannel() const;
     
     /** @Returns the length in seconds of the audio file based on the number of samples and sample rate */
     double getLengthInSeconds() const;
@@ -118,17 +591,22 @@ public:
     /** Set the audio buffer for this AudioFile by copying samples from another buffer.
      * @Returns true if the buffer was copied successfully.
      */
-    bool setAudioBuffer (AudioBuffer& newBuffer);
+    bool setAudioBuffer (const AudioBuffer& newBuffer);
+    
+    /** Set the audio buffer for this AudioFile by copying samples from a vector of channels, which must all be the same length.
+     * @Returns true if the buffer was copied successfully.
+     */
+    bool setAudioBuffer (const std::vector<std::vector<T> >& newBuffer);
     
     /** Sets the audio buffer to a given number of channels and number of samples per channel. This will try to preserve
      * the existing audio, adding zeros to any new channels or new samples in a given channel.
      */
-    void setAudioBufferSize (int numChannels, int numSamples);
+    void setAudioBufferSize (int numChannels, size_t numSamples);
     
     /** Sets the number of samples per channel in the audio buffer. This will try to preserve
      * the existing audio, adding zeros to new samples in a given channel if the number of samples is increased.
      */
-    void setNumSamplesPerChannel (int numSamples);
+    void setNumSamplesPerChannel (size_t numSamples);
     
     /** Sets the number of channels. New channels will have the correct number of samples and be initialised to zero */
     void setNumChannels (int numChannels);
@@ -144,7 +622,7 @@ public:
     void shouldLogErrorsToConsole (bool logErrors);
     
     //=============================================================
-    /** A vector of vectors holding the audio samples for the AudioFile. You can 
+    /** A buffer holding the audio samples for the AudioFile. You can 
      * access the samples by channel and then by sample index, i.e:
      *
      *      samples[channel][sampleIndex]
@@ -158,6 +636,9 @@ public:
     
 private:
     
+    template <class U> friend class AudioFileReader;
+    template <class U> friend class AudioFileWriter;
+    
     //=============================================================
     enum class Endianness
     {
@@ -166,22 +647,29 @@ private:
     };
     
     //=============================================================
-    AudioFileFormat determineAudioFileFormat (std::vector<uint8_t>& fileData);
-    bool decodeWaveFile (std::vector<uint8_t>& fileData);
-    bool decodeAiffFile (std::vector<uint8_t>& fileData);
+    AudioFileFormat determineAudioFileFormat (const AudioFileData& fileData);
+    void clampLayoutToFileSize (AudioFileLayout& layout, size_t fileSize);
+    bool parseWaveHeader (const AudioFileData& fileData, const AudioFileChunkDirectory& chunks, AudioFileLayout& layout);
+    bool parseAiffHeader (const AudioFileData& fileData, size_t fileSize, const AudioFileChunkDirectory& chunks, AudioFileLayout& layout);
+    bool decodeWaveFile (const AudioFileData& fileData);
+    bool decodeAiffFile (const AudioFileData& fileData);
+    std::string readIXMLChunk (const AudioFileData& fileData, const AudioFileChunkDirectory& chunks);
     
     //=============================================================
     bool saveToWaveFile (std::string filePath);
     bool saveToAiffFile (std::string filePath);
+    AudioFileLayout getOutputLayout (AudioFileFormat format, int numChannels, int numBitsPerSample, uint32_t newSampleRate);
+    void addWaveHeaderToFileData (std::vector<uint8_t>& fileData, const AudioFileLayout& layout, uint64_t dataChunkSize, uint32_t iXMLChunkSize, bool reserveDs64Chunk = false);
+    bool addAiffHeaderToFileData (std::vector<uint8_t>& fileData, const AudioFileLayout& layout, uint64_t numSamplesPerChannel, uint32_t iXMLChunkSize);
     
     //=============================================================
     void clearAudioBuffer();
     
     //=============================================================
-    int32_t fourBytesToInt (std::vector<uint8_t>& source, int startIndex, Endianness endianness = Endianness::LittleEndian);
-    int16_t twoBytesToInt (std::vector<uint8_t>& source, int startIndex, Endianness endianness = Endianness::LittleEndian);
-    int getIndexOfString (std::vector<uint8_t>& source, std::string s);
-    int getIndexOfChunk (std::vector<uint8_t>& source, const std::string& chunkHeaderID, int startIndex, Endianness endianness = Endianness::LittleEndian);
+    uint64_t eightBytesToInt (const AudioFileData& source, size_t startIndex);
+    int32_t fourBytesToInt (const AudioFileData& source, size_t startIndex, Endianness endianness = Endianness::LittleEndian);
+    int16_t twoBytesToInt (const AudioFileData& source, size_t startIndex, Endianness endianness = Endianness::LittleEndian);
+    int64_t getIndexOfString (const AudioFileData& source, std::string s);
     
     //=============================================================
     T sixteenBitIntToSample (int16_t sample);
@@ -191,18 +679,19 @@ private:
     uint8_t sampleToSingleByte (T sample);
     T singleByteToSample (uint8_t sample);
     
-    uint32_t getAiffSampleRate (std::vector<uint8_t>& fileData, int sampleRateStartIndex);
-    bool tenByteMatch (std::vector<uint8_t>& v1, int startIndex1, std::vector<uint8_t>& v2, int startIndex2);
+    uint32_t getAiffSampleRate (const AudioFileData& fileData, size_t sampleRateStartIndex);
+    bool tenByteMatch (const AudioFileData& v1, size_t startIndex1, const AudioFileData& v2, size_t startIndex2);
     void addSampleRateToAiffData (std::vector<uint8_t>& fileData, uint32_t sampleRate);
     T clamp (T v1, T minValue, T maxValue);
     
     //=============================================================
     void addStringToFileData (std::vector<uint8_t>& fileData, std::string s);
+    void addInt64ToFileData (std::vector<uint8_t>& fileData, uint64_t i);
     void addInt32ToFileData (std::vector<uint8_t>& fileData, int32_t i, Endianness endianness = Endianness::LittleEndian);
     void addInt16ToFileData (std::vector<uint8_t>& fileData, int16_t i, Endianness endianness = Endianness::LittleEndian);
     
     //=============================================================
-    bool writeDataToFile (std::vector<uint8_t>& fileData, std::string filePath);
+    bool writeDataToFile (const std::vector<uint8_t>& headerData, const AudioFileLayout& layout, std::string filePath);
     
     //=============================================================
     void reportError (std::string errorMessage);
@@ -214,33 +703,300 @@ private:
     bool logErrorsToConsole {true};
 };
 
-
 //=============================================================
-// Pre-defined 10-byte representations of common sample rates
-static std::unordered_map <uint32_t, std::vector<uint8_t>> aiffSampleRateTable = {
-    {8000, {64, 11, 250, 0, 0, 0, 0, 0, 0, 0}},
-    {11025, {64, 12, 172, 68, 0, 0, 0, 0, 0, 0}},
-    {16000, {64, 12, 250, 0, 0, 0, 0, 0, 0, 0}},
-    {22050, {64, 13, 172, 68, 0, 0, 0, 0, 0, 0}},
-    {32000, {64, 13, 250, 0, 0, 0, 0, 0, 0, 0}},
-    {37800, {64, 14, 147, 168, 0, 0, 0, 0, 0, 0}},
-    {44056, {64, 14, 172, 24, 0, 0, 0, 0, 0, 0}},
-    {44100, {64, 14, 172, 68, 0, 0, 0, 0, 0, 0}},
-    {47250, {64, 14, 184, 146, 0, 0, 0, 0, 0, 0}},
-    {48000, {64, 14, 187, 128, 0, 0, 0, 0, 0, 0}},
-    {50000, {64, 14, 195, 80, 0, 0, 0, 0, 0, 0}},
-    {50400, {64, 14, 196, 224, 0, 0, 0, 0, 0, 0}},
-    {88200, {64, 15, 172, 68, 0, 0, 0, 0, 0, 0}},
-    {96000, {64, 15, 187, 128, 0, 0, 0, 0, 0, 0}},
-    {176400, {64, 16, 172, 68, 0, 0, 0, 0, 0, 0}},
-    {192000, {64, 16, 187, 128, 0, 0, 0, 0, 0, 0}},
-    {352800, {64, 17, 172, 68, 0, 0, 0, 0, 0, 0}},
-    {2822400, {64, 20, 172, 68, 0, 0, 0, 0, 0, 0}},
-    {5644800, {64, 21, 172, 68, 0, 0, 0, 0, 0, 0}}
+/** Reads the samples of a WAV or AIFF file a block of frames at a time,
+ * so files of any size can be processed with a fixed amount of memory
+ */
+template <class T>
+class AudioFileReader
+{
+public:
+    
+    //=============================================================
+    typedef typename AudioFile<T>::AudioBuffer AudioBuffer;
+    
+    //=============================================================
+    /** Opens a file and reads its header.
+     * @Returns true if the file was opened and its header is valid
+     */
+    bool open (std::string filePath);
+    
+    /** Closes the file */
+    void close();
+    
+    //=============================================================
+    /** Reads up to numFrames frames into buffer, decoded to one buffer channel per channel of the file.
+     * @Returns the number of frames read, 0 once the end of the sample data is reached
+     */
+    size_t read (AudioBuffer& buffer, size_t numFrames);
+    
+    /** Reads up to numFrames frames into frameData exactly as they are stored in the file.
+     * @Returns the number of frames read, 0 once the end of the sample data is reached
+     */
+    size_t readFrames (std::vector<uint8_t>& frameData, size_t numFrames);
+    
+    /** Reads up to numFrames frames starting at a given frame into buffer, decoded to one buffer channel per channel of the file.
+     * The read position doesn't move, so this can probe any part of the file in between reads.
+     * @Returns the number of frames read
+     */
+    size_t readAt (size_t frame, AudioBuffer& buffer, size_t numFrames);
+    
+    /** Reads up to numFrames frames starting at a given frame into frameData exactly as they are stored in the file.
+     * The read position doesn't move.
+     * @Returns the number of frames read
+     */
+    size_t readFramesAt (size_t frame, std::vector<uint8_t>& frameData, size_t numFrames);
+    
+    /** Moves the read position to a given frame.
+     * @Returns true if the frame is within the sample data
+     */
+    bool seek (size_t frame);
+    
+    //=============================================================
+    /** @Returns where and how the samples are stored in the file */
+    const AudioFileLayout& getLayout() const { return layout; }
+    
+    /** @Returns the number of frames left to read */
+    size_t getNumFramesRemaining() const { return layout.numSamplesPerChannel - position; }
+    
+    /** Sets whether the reader should log error messages to the console. By default this is true */
+    void shouldLogErrorsToConsole (bool logErrors) { codec.shouldLogErrorsToConsole (logErrors); }
+    
+    //=============================================================
+    /** The file's iXML chunk, if it has one */
+    std::string iXMLChunk;
+    
+private:
+    
+    //=============================================================
+    AudioFile<T> codec;
+    AudioFileLayout layout;
+    AudioFileSource file;
+    size_t position {0};
+    std::vector<uint8_t> frameData;
 };
 
 //=============================================================
-enum WavAudioFormat
+/** Writes a WAV or AIFF file a block of frames at a time. The header is written
+ * with empty sizes when the file is opened, and the sizes are filled in on close().
+ * A WAV file that grows past 4 GB is turned into an RF64 file when it is closed
+ */
+template <class T>
+class AudioFileWriter
+{
+public:
+    
+    //=============================================================
+    typedef typename AudioFile<T>::AudioBuffer AudioBuffer;
+    
+    //=============================================================
+    ~AudioFileWriter() { close(); }
+    
+    //=============================================================
+    /** Creates a file and writes its header.
+     * @Returns true if the file was created
+     */
+    bool open (std::string filePath, AudioFileFormat format, int numChannels, uint32_t sampleRate, int bitDepth);
+    
+    /** Creates a file whose samples are stored exactly as sampleLayout describes (format, sample format,
+     * bit depth, byte order and number of channels), so frames copied from a file stored that way
+     * can be written with writeFrames without being decoded.
+     * @Returns true if the file was created
+     */
+    bool open (std::string filePath, const AudioFileLayout& sampleLayout);
+    
+    /** @Returns true if files with samples stored as sampleLayout describes can be written */
+    static bool canWriteLayout (const AudioFileLayout& sampleLayout);
+    
+    /** Encodes and appends numFrames frames from the first channels of buffer.
+     * @Returns true if the frames were written
+     */
+    bool write (const AudioBuffer& buffer, size_t numFrames);
+    
+    /** Appends numFrames frames that are already encoded in the file's sample format.
+     * @Returns true if the frames were written
+     */
+    bool writeFrames (const uint8_t* frames, size_t numFrames);
+    
+    /** Writes the iXML chunk, fills in the sizes in the header and closes the file.
+     * @Returns true if the file was completed
+     */
+    bool close();
+    
+    //=============================================================
+    /** @Returns how the samples are stored in the file */
+    const AudioFileLayout& getLayout() const { return layout; }
+    
+    /** Sets whether the writer should log error messages to the console. By default this is true */
+    void shouldLogErrorsToConsole (bool logErrors) { codec.shouldLogErrorsToConsole (logErrors); }
+    
+    //=============================================================
+    /** An optional iXML chunk, written after the samples when the file is closed */
+    std::string iXMLChunk;
+    
+private:
+    
+    //=============================================================
+    bool getHeader (std::vector<uint8_t>& header, uint32_t iXMLChunkSize);
+    
+    //=============================================================
+    AudioFile<T> codec;
+    AudioFileLayout layout;
+    AudioFileSink file;
+    std::string path;
+    size_t numFramesWritten {0};
+    bool failed {false};
+    std::vector<uint8_t> frameData;
+};
+
+//=============================================================
+/** Kernels that decode interleaved sample frames into one buffer per channel. There is one
+ * for each combination of sample format (bit depth, byte order, integer or float) and for mono,
+ * stereo or any other number of channels, so the inner loops have no branches and fixed strides.
+ * A kernel is picked once per block of frames, rather than branching on the format for every sample
+ */
+template <class T>
+class AudioFrameDecoder
+{
+public:
+    
+    //=============================================================
+    /** Decodes numFrames interleaved frames into channels[0 .. numChannels - 1], which must each have room for numFrames samples */
+    typedef void (*Kernel) (const uint8_t* frames, size_t numFrames, int numChannels, T* const* channels);
+    
+    /** @Returns the kernel for samples stored as layout describes, or nullptr if the bit depth isn't supported */
+    static Kernel getKernel (const AudioFileLayout& layout);
+    
+private:
+    
+    //=============================================================
+    // the stored sample formats, each turning the bytes of one sample into a sample value
+    struct UnsignedEightBit
+    {
+        static const int numBytes = 1;
+        static T read (const uint8_t* b) { return static_cast<T> (b[0] - 128) / static_cast<T> (128.); }
+    };
+    
+    struct SignedEightBit
+    {
+        static const int numBytes = 1;
+        static T read (const uint8_t* b) { return (T)(int8_t)b[0] / (T)128.; }
+    };
+    
+    template <bool BigEndian>
+    struct SixteenBit
+    {
+        static const int numBytes = 2;
+        static T read (const uint8_t* b)
+        {
+            int16_t sampleAsInt = BigEndian ? (int16_t)((b[0] << 8) | b[1]) : (int16_t)((b[1] << 8) | b[0]);
+            return static_cast<T> (sampleAsInt) / static_cast<T> (32768.);
+        }
+    };
+    
+    template <bool BigEndian>
+    struct TwentyFourBit
+    {
+        static const int numBytes = 3;
+        static T read (const uint8_t* b)
+        {
+            int32_t sampleAsInt = BigEndian ? ((b[0] << 16) | (b[1] << 8) | b[2]) : ((b[2] << 16) | (b[1] << 8) | b[0]);
+            
+            if (sampleAsInt & 0x800000) //  if the 24th bit is set, this is a negative number in 24-bit world
+                sampleAsInt = sampleAsInt | ~0xFFFFFF; // so make sure sign is extended to the 32 bit float
+            
+            return (T)sampleAsInt / (T)8388608.;
+        }
+    };
+    
+    template <bool BigEndian>
+    struct ThirtyTwoBit
+    {
+        static const int numBytes = 4;
+        static T read (const uint8_t* b)
+        {
+            int32_t sampleAsInt = BigEndian ? ((b[0] << 24) | (b[1] << 16) | (b[2] << 8) | b[3]) : ((b[3] << 24) | (b[2] << 16) | (b[1] << 8) | b[0]);
+            return (T) sampleAsInt / static_cast<float> (std::numeric_limits<std::int32_t>::max());
+        }
+    };
+    
+    template <bool BigEndian>
+    struct ThirtyTwoBitFloat
+    {
+        static const int numBytes = 4;
+        static T read (const uint8_t* b)
+        {
+            uint32_t bits = BigEndian ? ((uint32_t) b[0] << 24) | (b[1] << 16) | (b[2] << 8) | b[3] : ((uint32_t) b[3] << 24) | (b[2] << 16) | (b[1] << 8) | b[0];
+            float sample;
+            memcpy (&sample, &bits, sizeof (float));
+            return (T) sample;
+        }
+    };
+    
+    //=============================================================
+    template <class Format>
+    static Kernel getKernelForChannels (int numChannels);
+    
+    /** Decodes frames of Format with NumChannels channels, or any number of channels if NumChannels is 0 */
+    template <class Format, int NumChannels>
+    static void decode (const uint8_t* frames, size_t numFrames, int numChannels, T* const* channels);
+    
+    //=============================================================
+    /** Decodes as many of the first frames as it can with vector instructions, and
+     * @Returns how many it decoded. This one is for the formats that don't have a vector version
+     */
+    template <class Format, class Channels, class U>
+    static size_t decodeVectorised (Format, Channels, const uint8_t*, size_t, U* const*) { return 0; }
+    
+#if AUDIOFILE_USE_SSE2
+    template <bool BigEndian, int NumChannels>
+    static size_t decodeVectorised (SixteenBit<BigEndian>, std::integral_constant<int, NumChannels>, const uint8_t* frames, size_t numFrames, float* const* channels);
+    
+    template <bool BigEndian, int NumChannels>
+    static size_t decodeVectorised (TwentyFourBit<BigEndian>, std::integral_constant<int, NumChannels>, const uint8_t* frames, size_t numFrames, float* const* channels);
+    
+    template <bool BigEndian, int NumChannels>
+    static size_t decodeVectorised (ThirtyTwoBit<BigEndian>, std::integral_constant<int, NumChannels>, const uint8_t* frames, size_t numFrames, float* const* channels);
+    
+    template <bool BigEndian, int NumChannels>
+    static size_t decodeVectorised (ThirtyTwoBitFloat<BigEndian>, std::integral_constant<int, NumChannels>, const uint8_t* frames, size_t numFrames, float* const* channels);
+    
+    //=============================================================
+    template <int NumChannels, bool BigEndian, bool IsFloat>
+    static size_t decodeThirtyTwoBit (const uint8_t* frames, size_t numFrames, float* const* channels);
+    
+    static __m128i swapBytes16 (__m128i v) { return _mm_or_si128 (_mm_slli_epi16 (v, 8), _mm_srli_epi16 (v, 8)); }
+    static __m128i swapBytes32 (__m128i v) { v = swapBytes16 (v); return _mm_shufflehi_epi16 (_mm_shufflelo_epi16 (v, 0xB1), 0xB1); }
+    static int32_t loadFourBytes (const uint8_t* b) { int32_t x; memcpy (&x, b, 4); return x; }
+#endif
+};
+
+//=============================================================
+// Pre-defined 10-byte representations of common sample rates
+static std::unordered_map <uint32_t, std::vector<uint8_t>> aiffSampleRateTable = {
+    {8000, {64, 11, 250, 0, 0, 0, 0, 0, 0, 0}},
+    {11025, {64, 12, 172, 68, 0, 0, 0, 0, 0, 0}},
+    {16000, {64, 12, 250, 0, 0, 0, 0, 0, 0, 0}},
+    {22050, {64, 13, 172, 68, 0, 0, 0, 0, 0, 0}},
+    {32000, {64, 13, 250, 0, 0, 0, 0, 0, 0, 0}},
+    {37800, {64, 14, 147, 168, 0, 0, 0, 0, 0, 0}},
+    {44056, {64, 14, 172, 24, 0, 0, 0, 0, 0, 0}},
+    {44100, {64, 14, 172, 68, 0, 0, 0, 0, 0, 0}},
+    {47250, {64, 14, 184, 146, 0, 0, 0, 0, 0, 0}},
+    {48000, {64, 14, 187, 128, 0, 0, 0, 0, 0, 0}},
+    {50000, {64, 14, 195, 80, 0, 0, 0, 0, 0, 0}},
+    {50400, {64, 14, 196, 224, 0, 0, 0, 0, 0, 0}},
+    {88200, {64, 15, 172, 68, 0, 0, 0, 0, 0, 0}},
+    {96000, {64, 15, 187, 128, 0, 0, 0, 0, 0, 0}},
+    {176400, {64, 16, 172, 68, 0, 0, 0, 0, 0, 0}},
+    {192000, {64, 16, 187, 128, 0, 0, 0, 0, 0, 0}},
+    {352800, {64, 17, 172, 68, 0, 0, 0, 0, 0, 0}},
+    {2822400, {64, 20, 172, 68, 0, 0, 0, 0, 0, 0}},
+    {5644800, {64, 21, 172, 68, 0, 0, 0, 0, 0, 0}}
+};
+
+//=============================================================
+enum WavAudioFormat
 {
     PCM = 0x0001,
     IEEEFloat = 0x0003,
@@ -250,16 +1006,728 @@ enum WavAudioFormat
 };
 
 //=============================================================
-enum AIFFAudioFormat
+enum AIFFAudioFormat
+{
+    Uncompressed,
+    Compressed,
+    Error
+};
+
+//=============================================================
+/* IMPLEMENTATION */
+//=============================================================
+
+//=============================================================
+inline bool AudioFileData::open (const std::string& filePath)
+{
+    close();
+    
+#if AUDIOFILE_USE_MMAP
+    int fd = ::open (filePath.c_str(), O_RDONLY);
+    
+    if (fd != -1)
+    {
+        struct stat info;
+        
+        if (fstat (fd, &info) == 0 && info.st_size > 0)
+        {
+            void* address = mmap (nullptr, (size_t) info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+            
+            if (address != MAP_FAILED)
+            {
+                // the decoders walk the file front to back, so ask for aggressive readahead
+                // and start bringing the whole file into the page cache straight away
+                madvise (address, (size_t) info.st_size, MADV_SEQUENTIAL);
+                madvise (address, (size_t) info.st_size, MADV_WILLNEED);
+                
+                bytes = static_cast<const uint8_t*> (address);
+                length = (size_t) info.st_size;
+                mapped = true;
+            }
+        }
+        
+        // the mapping stays valid after the descriptor is closed
+        ::close (fd);
+        
+        if (mapped)
+            return true;
+    }
+#endif
+    
+    // fall back to reading the whole file into memory
+    std::ifstream file (filePath, std::ios::binary);
+    
+    if (! file.good())
+        return false;
+    
+    file.unsetf (std::ios::skipws);
+    
+    file.seekg (0, std::ios::end);
+    size_t fileLength = file.tellg();
+    file.seekg (0, std::ios::beg);
+    
+    storage.resize (fileLength);
+    file.read (reinterpret_cast<char*> (storage.data()), fileLength);
+    
+    if (static_cast<size_t> (file.gcount()) != fileLength)
+    {
+        storage.clear();
+        return false;
+    }
+    
+    bytes = storage.data();
+    length = storage.size();
+    return true;
+}
+
+//=============================================================
+inline void AudioFileData::close()
+{
+#if AUDIOFILE_USE_MMAP
+    if (mapped)
+        munmap (const_cast<uint8_t*> (bytes), length);
+#endif
+    
+    bytes = nullptr;
+    length = 0;
+    mapped = false;
+    storage.clear();
+    storage.shrink_to_fit();
+}
+
+//=============================================================
+inline bool AudioFileSink::open (const std::string& filePath)
+{
+    close();
+    
+#if AUDIOFILE_USE_POSIX_IO
+    fd = ::open (filePath.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0666);
+#else
+    file.open (filePath, std::ios::binary);
+#endif
+    
+    buffer.resize (bufferSize);
+    numBuffered = 0;
+    numBytesWritten = 0;
+    failed = false;
+    
+    return isOpen();
+}
+
+//=============================================================
+inline bool AudioFileSink::write (const uint8_t* data, size_t size)
+{
+    if (! isOpen() || failed)
+        return false;
+    
+    numBytesWritten += size;
+    
+    if (numBuffered + size < bufferSize)
+    {
+        if (size > 0)
+            memcpy (buffer.data() + numBuffered, data, size);
+        
+        numBuffered += size;
+        return true;
+    }
+    
+    // send what is buffered along with as much of the new data as ends on a
+    // buffer boundary, so the next write starts on one too, and keep the rest
+    size_t total = numBuffered + size;
+    size_t numDirect = total - total % bufferSize - numBuffered;
+    
+    if (! writeGathered (buffer.data(), numBuffered, data, numDirect))
+    {
+        failed = true;
+        return false;
+    }
+    
+    numBuffered = size - numDirect;
+    
+    if (numBuffered > 0)
+        memcpy (buffer.data(), data + numDirect, numBuffered);
+    
+    return true;
+}
+
+//=============================================================
+inline bool AudioFileSink::writeAt (const uint8_t* data, size_t size, uint64_t offset)
+{
+    if (! flush())
+        return false;
+    
+#if AUDIOFILE_USE_POSIX_IO
+    while (size > 0)
+    {
+        ssize_t n = ::pwrite (fd, data, size, (off_t) offset);
+        
+        if (n < 0 && errno == EINTR)
+            continue;
+        
+        if (n <= 0)
+        {
+            failed = true;
+            return false;
+        }
+        
+        data += n;
+        size -= (size_t) n;
+        offset += (uint64_t) n;
+    }
+#else
+    file.seekp ((std::streamoff) offset, std::ios::beg);
+    file.write (reinterpret_cast<const char*> (data), size);
+    file.seekp (0, std::ios::end);
+    
+    if (! file.good())
+        failed = true;
+#endif
+    
+    return ! failed;
+}
+
+//=============================================================
+inline bool AudioFileSink::flush()
+{
+    if (! isOpen() || failed)
+        return false;
+    
+    if (! writeGathered (buffer.data(), numBuffered, nullptr, 0))
+        failed = true;
+    
+    numBuffered = 0;
+    return ! failed;
+}
+
+//=============================================================
+inline bool AudioFileSink::close()
+{
+    if (! isOpen())
+        return false;
+    
+    bool complete = flush();
+    
+#if AUDIOFILE_USE_POSIX_IO
+    if (::close (fd) != 0)
+        complete = false;
+    
+    fd = -1;
+#else
+    file.close();
+    
+    if (file.fail())
+        complete = false;
+    
+    file.clear();
+#endif
+    
+    return complete;
+}
+
+//=============================================================
+inline bool AudioFileSink::isOpen() const
+{
+#if AUDIOFILE_USE_POSIX_IO
+    return fd != -1;
+#else
+    return file.is_open();
+#endif
+}
+
+//=============================================================
+inline bool AudioFileSink::writeGathered (const uint8_t* first, size_t firstSize, const uint8_t* second, size_t secondSize)
+{
+#if AUDIOFILE_USE_POSIX_IO
+    struct iovec parts[2];
+    parts[0].iov_base = const_cast<uint8_t*> (first);
+    parts[0].iov_len = firstSize;
+    parts[1].iov_base = const_cast<uint8_t*> (second);
+    parts[1].iov_len = secondSize;
+    
+    int part = 0;
+    
+    while (part < 2)
+    {
+        if (parts[part].iov_len == 0)
+        {
+            part++;
+            continue;
+        }
+        
+        ssize_t n = ::writev (fd, parts + part, 2 - part);
+        
+        if (n < 0 && errno == EINTR)
+            continue;
+        
+        if (n <= 0)
+            return false;
+        
+        // a short write can stop part way through either part, so carry on from there
+        size_t written = (size_t) n;
+        
+        while (part < 2 && written >= parts[part].iov_len)
+            written -= parts[part++].iov_len;
+        
+        if (part < 2)
+        {
+            parts[part].iov_base = static_cast<uint8_t*> (parts[part].iov_base) + written;
+            parts[part].iov_len -= written;
+        }
+    }
+    
+    return true;
+#else
+    file.write (reinterpret_cast<const char*> (first), firstSize);
+    file.write (reinterpret_cast<const char*> (second), secondSize);
+    return file.good();
+#endif
+}
+
+//=============================================================
+inline bool AudioFileSource::open (const std::string& filePath)
+{
+    close();
+    
+#if AUDIOFILE_USE_POSIX_IO
+    fd = ::open (filePath.c_str(), O_RDONLY);
+#else
+    file.open (filePath, std::ios::binary);
+#endif
+    
+    return isOpen();
+}
+
+//=============================================================
+inline size_t AudioFileSource::readAt (uint8_t* data, size_t size, uint64_t offset)
+{
+    if (! isOpen())
+        return 0;
+    
+#if AUDIOFILE_USE_POSIX_IO
+    size_t numRead = 0;
+    
+    while (numRead < size)
+    {
+        ssize_t n = ::pread (fd, data + numRead, size - numRead, (off_t) (offset + numRead));
+        
+        if (n < 0 && errno == EINTR)
+            continue;
+        
+        if (n <= 0)
+            break;
+        
+        numRead += (size_t) n;
+    }
+    
+    return numRead;
+#else
+    file.clear();
+    file.seekg ((std::streamoff) offset, std::ios::beg);
+    file.read (reinterpret_cast<char*> (data), size);
+    return static_cast<size_t> (file.gcount());
+#endif
+}
+
+//=============================================================
+inline void AudioFileSource::close()
+{
+#if AUDIOFILE_USE_POSIX_IO
+    if (fd != -1)
+        ::close (fd);
+    
+    fd = -1;
+#else
+    if (file.is_open())
+        file.close();
+    
+    file.clear();
+#endif
+}
+
+//=============================================================
+inline bool AudioFileSource::isOpen() const
+{
+#if AUDIOFILE_USE_POSIX_IO
+    return fd != -1;
+#else
+    return file.is_open();
+#endif
+}
+
+//=============================================================
+template <class ReadBytes>
+bool AudioFileChunkDirectory::build (uint64_t fileSize, bool bigEndian, ReadBytes readBytes)
+{
+    auto readInt = [bigEndian] (const uint8_t* b, int numBytes)
+    {
+        uint64_t result = 0;
+        
+        for (int i = 0; i < numBytes; i++)
+            result |= (uint64_t) b[i] << (8 * (bigEndian ? numBytes - 1 - i : i));
+        
+        return result;
+    };
+    
+    numChunks = 0;
+    moreChunks.clear();
+    
+    uint8_t header[24];
+    
+    if (fileSize < 12 || ! readBytes (0, 12, header))
+        return false;
+    
+    formSize = readInt (header + 4, 4);
+    
+    uint64_t ds64DataChunkSize = 0;
+    bool haveDs64DataChunkSize = false;
+    uint64_t i = 12;
+    
+    while (i + 8 <= fileSize && readBytes (i, 8, header))
+    {
+        uint64_t chunkSize = readInt (header + 4, 4);
+        
+        // an RF64 file keeps its real sizes in the ds64 chunk, which comes before the chunks it describes
+        if (memcmp (header, "ds64", 4) == 0 && chunkSize >= 16 && i + 24 <= fileSize && readBytes (i + 8, 16, header + 8))
+        {
+            formSize = readInt (header + 8, 8);
+            ds64DataChunkSize = readInt (header + 16, 8);
+            haveDs64DataChunkSize = true;
+        }
+        else if (memcmp (header, "data", 4) == 0 && chunkSize == 0xFFFFFFFF && haveDs64DataChunkSize)
+        {
+            chunkSize = ds64DataChunkSize;
+        }
+        
+        add (header, (size_t) i, chunkSize);
+        
+        uint64_t next = i + 8 + chunkSize;
+        
+        if (next < i)
+            break;
+        
+        i = next;
+    }
+    
+    return true;
+}
+
+//=============================================================
+inline bool AudioFileChunkDirectory::build (const AudioFileData& fileData, bool bigEndian)
+{
+    return build (fileData.size(), bigEndian, [&fileData] (uint64_t offset, size_t numBytes, uint8_t* dest)
+    {
+        if (offset + numBytes > fileData.size())
+            return false;
+        
+        memcpy (dest, fileData.data() + offset, numBytes);
+        return true;
+    });
+}
+
+//=============================================================
+inline const AudioFileChunk* AudioFileChunkDirectory::find (const char* id) const
+{
+    for (size_t i = 0; i < numChunks; i++)
+    {
+        const AudioFileChunk& chunk = (*this)[i];
+        
+        if (memcmp (chunk.id, id, 4) == 0)
+            return &chunk;
+    }
+    
+    return nullptr;
+}
+
+//=============================================================
+inline void AudioFileChunkDirectory::add (const uint8_t* header, size_t offset, uint64_t size)
+{
+    AudioFileChunk chunk;
+    memcpy (chunk.id, header, 4);
+    chunk.offset = offset;
+    chunk.size = size;
+    
+    if (numChunks < numInlineChunks)
+        inlineChunks[numChunks] = chunk;
+    else
+        moreChunks.push_back (chunk);
+    
+    numChunks++;
+}
+
+//=============================================================
+template <class T>
+AudioSampleBuffer<T>::AudioSampleBuffer (const AudioSampleBuffer& other)
+{
+    setSize (other.numChannels, other.numSamples, false);
+    
+    for (int channel = 0; channel < numChannels; channel++)
+        std::copy (other[channel].begin(), other[channel].end(), (*this)[channel].begin());
+}
+
+//=============================================================
+template <class T>
+void AudioSampleBuffer<T>::setSize (int newNumChannels, size_t newNumSamples, bool keepExistingContent)
 {
-    Uncompressed,
-    Compressed,
-    Error
-};
+    newNumChannels = std::max (newNumChannels, 0);
+    
+    if (newNumSamples <= channelStride && (size_t) newNumChannels * channelStride <= capacity)
+    {
+        // it already fits, so only samples that come into range need clearing
+        if (keepExistingContent)
+        {
+            for (int channel = 0; channel < newNumChannels; channel++)
+            {
+                T* channelSamples = samples + channel * channelStride;
+                size_t numToKeep = channel < numChannels ? std::min (numSamples, newNumSamples) : 0;
+                std::fill (channelSamples + numToKeep, channelSamples + newNumSamples, (T)0.);
+            }
+        }
+        
+        numChannels = newNumChannels;
+        numSamples = newNumSamples;
+        return;
+    }
+    
+    // round each channel up to a whole number of aligned blocks, so every channel starts aligned
+    const size_t samplesPerBlock = alignment / sizeof (T) > 0 ? alignment / sizeof (T) : 1;
+    size_t newChannelStride = (newNumSamples + samplesPerBlock - 1) / samplesPerBlock * samplesPerBlock;
+    size_t newCapacity = newChannelStride * newNumChannels;
+    
+    std::unique_ptr<uint8_t[]> newAllocation (new uint8_t[newCapacity * sizeof (T) + alignment - 1]);
+    T* newSamples = reinterpret_cast<T*> ((reinterpret_cast<uintptr_t> (newAllocation.get()) + alignment - 1) & ~(uintptr_t) (alignment - 1));
+    
+    if (keepExistingContent)
+    {
+        for (int channel = 0; channel < newNumChannels; channel++)
+        {
+            T* channelSamples = newSamples + channel * newChannelStride;
+            size_t numToKeep = channel < numChannels ? std::min (numSamples, newNumSamples) : 0;
+            std::copy (samples + channel * channelStride, samples + channel * channelStride + numToKeep, channelSamples);
+            std::fill (channelSamples + numToKeep, channelSamples + newNumSamples, (T)0.);
+        }
+    }
+    
+    allocation = std::move (newAllocation);
+    samples = newSamples;
+    capacity = newCapacity;
+    channelStride = newChannelStride;
+    numChannels = newNumChannels;
+    numSamples = newNumSamples;
+}
 
 //=============================================================
-/* IMPLEMENTATION */
+template <class T>
+bool AudioSampleBuffer<T>::operator== (const AudioSampleBuffer& other) const
+{
+    if (numChannels != other.numChannels || numSamples != other.numSamples)
+        return false;
+    
+    for (int channel = 0; channel < numChannels; channel++)
+        if (! std::equal ((*this)[channel].begin(), (*this)[channel].end(), other[channel].begin()))
+            return false;
+    
+    return true;
+}
+
+//=============================================================
+template <class T>
+void AudioSampleBuffer<T>::swap (AudioSampleBuffer& other) noexcept
+{
+    std::swap (allocation, other.allocation);
+    std::swap (samples, other.samples);
+    std::swap (capacity, other.capacity);
+    std::swap (channelStride, other.channelStride);
+    std::swap (numChannels, other.numChannels);
+    std::swap (numSamples, other.numSamples);
+}
+
+//=============================================================
+template <class T>
+typename AudioFrameDecoder<T>::Kernel AudioFrameDecoder<T>::getKernel (const AudioFileLayout& layout)
+{
+    bool isFloat = layout.format == AudioFileFormat::Wave ? layout.audioFormat == WavAudioFormat::IEEEFloat : layout.audioFormat == AIFFAudioFormat::Compressed;
+    bool bigEndian = layout.bigEndian;
+    
+    switch (layout.bitDepth)
+    {
+        // WAV stores 8 bit samples as unsigned, AIFF as signed
+        case 8: return bigEndian ? getKernelForChannels<SignedEightBit> (layout.numChannels) : getKernelForChannels<UnsignedEightBit> (layout.numChannels);
+        case 16: return bigEndian ? getKernelForChannels<SixteenBit<true>> (layout.numChannels) : getKernelForChannels<SixteenBit<false>> (layout.numChannels);
+        case 24: return bigEndian ? getKernelForChannels<TwentyFourBit<true>> (layout.numChannels) : getKernelForChannels<TwentyFourBit<false>> (layout.numChannels);
+        case 32:
+            if (isFloat)
+                return bigEndian ? getKernelForChannels<ThirtyTwoBitFloat<true>> (layout.numChannels) : getKernelForChannels<ThirtyTwoBitFloat<false>> (layout.numChannels);
+            else
+                return bigEndian ? getKernelForChannels<ThirtyTwoBit<true>> (layout.numChannels) : getKernelForChannels<ThirtyTwoBit<false>> (layout.numChannels);
+        default: return nullptr;
+    }
+}
+
+//=============================================================
+template <class T>
+template <class Format>
+typename AudioFrameDecoder<T>::Kernel AudioFrameDecoder<T>::getKernelForChannels (int numChannels)
+{
+    if (numChannels == 1)
+        return decode<Format, 1>;
+    else if (numChannels == 2)
+        return decode<Format, 2>;
+    else
+        return decode<Format, 0>;
+}
+
+//=============================================================
+template <class T>
+template <class Format, int NumChannels>
+void AudioFrameDecoder<T>::decode (const uint8_t* frames, size_t numFrames, int numChannels, T* const* channels)
+{
+    const int channelCount = NumChannels > 0 ? NumChannels : numChannels;
+    const size_t numBytesPerFrame = (size_t) Format::numBytes * channelCount;
+    
+    size_t i = decodeVectorised (Format(), std::integral_constant<int, NumChannels>(), frames, numFrames, channels);
+    
+    for (; i < numFrames; i++)
+    {
+        const uint8_t* frame = frames + numBytesPerFrame * i;
+        
+        for (int channel = 0; channel < channelCount; channel++)
+            channels[channel][i] = Format::read (frame + channel * Format::numBytes);
+    }
+}
+
+#if AUDIOFILE_USE_SSE2
+//=============================================================
+template <class T>
+template <bool BigEndian, int NumChannels>
+size_t AudioFrameDecoder<T>::decodeVectorised (SixteenBit<BigEndian>, std::integral_constant<int, NumChannels>, const uint8_t* frames, size_t numFrames, float* const* channels)
+{
+    // dividing by a power of two is exact, so multiplying by its inverse gives the same result
+    const __m128 scale = _mm_set1_ps (1.f / 32768.f);
+    size_t i = 0;
+    
+    if (NumChannels == 1)
+    {
+        for (; i + 8 <= numFrames; i += 8)
+        {
+            __m128i v = _mm_loadu_si128 ((const __m128i*) (frames + i * 2));
+            
+            if (BigEndian)
+                v = swapBytes16 (v);
+            
+            // widen each sample into the top half of a 32-bit lane, then shift it back down to sign-extend it
+            __m128i low = _mm_srai_epi32 (_mm_unpacklo_epi16 (v, v), 16);
+            __m128i high = _mm_srai_epi32 (_mm_unpackhi_epi16 (v, v), 16);
+            _mm_storeu_ps (channels[0] + i, _mm_mul_ps (_mm_cvtepi32_ps (low), scale));
+            _mm_storeu_ps (channels[0] + i + 4, _mm_mul_ps (_mm_cvtepi32_ps (high), scale));
+        }
+    }
+    else if (NumChannels == 2)
+    {
+        for (; i + 4 <= numFrames; i += 4)
+        {
+            __m128i v = _mm_loadu_si128 ((const __m128i*) (frames + i * 4));
+            
+            if (BigEndian)
+                v = swapBytes16 (v);
+            
+            // each 32-bit lane holds one frame, left in the low half and right in the high half
+            __m128i left = _mm_srai_epi32 (_mm_slli_epi32 (v, 16), 16);
+            __m128i right = _mm_srai_epi32 (v, 16);
+            _mm_storeu_ps (channels[0] + i, _mm_mul_ps (_mm_cvtepi32_ps (left), scale));
+            _mm_storeu_ps (channels[1] + i, _mm_mul_ps (_mm_cvtepi32_ps (right), scale));
+        }
+    }
+    
+    return i;
+}
+
+//=============================================================
+template <class T>
+template <bool BigEndian, int NumChannels>
+size_t AudioFrameDecoder<T>::decodeVectorised (TwentyFourBit<BigEndian>, std::integral_constant<int, NumChannels>, const uint8_t* frames, size_t numFrames, float* const* channels)
+{
+    if (NumChannels != 1 && NumChannels != 2)
+        return 0;
+    
+    const __m128 scale = _mm_set1_ps (1.f / 8388608.f);
+    const size_t numBytesPerFrame = 3 * NumChannels;
+    size_t i = 0;
+    
+    // every sample is read as four bytes, the last of which belongs to the next sample, so the
+    // loop stops a frame early to keep the final read inside the data
+    for (; i + 5 <= numFrames; i += 4)
+    {
+        for (int channel = 0; channel < NumChannels; channel++)
+        {
+            const uint8_t* b = frames + i * numBytesPerFrame + channel * 3;
+            __m128i v = _mm_setr_epi32 (loadFourBytes (b), loadFourBytes (b + numBytesPerFrame), loadFourBytes (b + 2 * numBytesPerFrame), loadFourBytes (b + 3 * numBytesPerFrame));
+            
+            // put the sample's top byte at the top of the lane, then shift it back down to sign-extend it
+            if (BigEndian)
+                v = _mm_srai_epi32 (swapBytes32 (v), 8);
+            else
+                v = _mm_srai_epi32 (_mm_slli_epi32 (v, 8), 8);
+            
+            _mm_storeu_ps (channels[channel] + i, _mm_mul_ps (_mm_cvtepi32_ps (v), scale));
+        }
+    }
+    
+    return i;
+}
+
+//=============================================================
+template <class T>
+template <bool BigEndian, int NumChannels>
+size_t AudioFrameDecoder<T>::decodeVectorised (ThirtyTwoBit<BigEndian>, std::integral_constant<int, NumChannels>, const uint8_t* frames, size_t numFrames, float* const* channels)
+{
+    return decodeThirtyTwoBit<NumChannels, BigEndian, false> (frames, numFrames, channels);
+}
+
+//=============================================================
+template <class T>
+template <bool BigEndian, int NumChannels>
+size_t AudioFrameDecoder<T>::decodeVectorised (ThirtyTwoBitFloat<BigEndian>, std::integral_constant<int, NumChannels>, const uint8_t* frames, size_t numFrames, float* const* channels)
+{
+    return decodeThirtyTwoBit<NumChannels, BigEndian, true> (frames, numFrames, channels);
+}
+
 //=============================================================
+template <class T>
+template <int NumChannels, bool BigEndian, bool IsFloat>
+size_t AudioFrameDecoder<T>::decodeThirtyTwoBit (const uint8_t* frames, size_t numFrames, float* const* channels)
+{
+    const __m128 scale = _mm_set1_ps (1.f / 2147483648.f);
+    size_t i = 0;
+    
+    auto load = [&] (size_t byteIndex)
+    {
+        __m128i v = _mm_loadu_si128 ((const __m128i*) (frames + byteIndex));
+        
+        if (BigEndian)
+            v = swapBytes32 (v);
+        
+        return IsFloat ? _mm_castsi128_ps (v) : _mm_mul_ps (_mm_cvtepi32_ps (v), scale);
+    };
+    
+    if (NumChannels == 1)
+    {
+        for (; i + 4 <= numFrames; i += 4)
+            _mm_storeu_ps (channels[0] + i, load (i * 4));
+    }
+    else if (NumChannels == 2)
+    {
+        for (; i + 4 <= numFrames; i += 4)
+        {
+            __m128 a = load (i * 8);
+            __m128 b = load (i * 8 + 16);
+            _mm_storeu_ps (channels[0] + i, _mm_shuffle_ps (a, b, _MM_SHUFFLE (2, 0, 2, 0)));
+            _mm_storeu_ps (channels[1] + i, _mm_shuffle_ps (a, b, _MM_SHUFFLE (3, 1, 3, 1)));
+        }
+    }
+    
+    return i;
+}
+#endif
 
 //=============================================================
 template <class T>
@@ -269,8 +1737,7 @@ AudioFile<T>::AudioFile()
 
     bitDepth = 16;
     sampleRate = 44100;
-    samples.resize (1);
-    samples[0].resize (0);
+    samples.setSize (1, 0);
     audioFileFormat = AudioFileFormat::NotLoaded;
 }
 
@@ -293,7 +1760,7 @@ uint32_t AudioFile<T>::getSampleRate() const
 template <class T>
 int AudioFile<T>::getNumChannels() const
 {
-    return (int)samples.size();
+    return samples.getNumChannels();
 }
 
 //=============================================================
@@ -319,10 +1786,10 @@ int AudioFile<T>::getBitDepth() const
 
 //=============================================================
 template <class T>
-int AudioFile<T>::getNumSamplesPerChannel() const
+size_t AudioFile<T>::getNumSamplesPerChannel() const
 {
-    if (samples.size() > 0)
-        return (int) samples[0].size();
+    if (samples.getNumChannels() > 0)
+        return samples.getNumSamplesPerChannel();
     else
         return 0;
 }
@@ -349,7 +1816,21 @@ void AudioFile<T>::printSummary() const
 
 //=============================================================
 template <class T>
-bool AudioFile<T>::setAudioBuffer (AudioBuffer& newBuffer)
+bool AudioFile<T>::setAudioBuffer (const AudioBuffer& newBuffer)
+{
+    if (newBuffer.getNumChannels() <= 0)
+    {
+        assert (false && "The buffer your are trying to use has no channels");
+        return false;
+    }
+    
+    samples = newBuffer;
+    return true;
+}
+
+//=============================================================
+template <class T>
+bool AudioFile<T>::setAudioBuffer (const std::vector<std::vector<T> >& newBuffer)
 {
     int numChannels = (int)newBuffer.size();
     
@@ -361,18 +1842,15 @@ bool AudioFile<T>::setAudioBuffer (AudioBuffer& newBuffer)
     
     size_t numSamples = newBuffer[0].size();
     
-    // set the number of channels
-    samples.resize (newBuffer.size());
+    samples.setSize (numChannels, numSamples, false);
     
     for (int k = 0; k < getNumChannels(); k++)
     {
         assert (newBuffer[k].size() == numSamples);
         
-        samples[k].resize (numSamples);
-        
         for (size_t i = 0; i < numSamples; i++)
         {
-            samples[k][i] = newBuffer[k][i];
+            samples[k][i] = i < newBuffer[k].size() ? newBuffer[k][i] : (T)0.;
         }
     }
     
@@ -381,140 +1859,315 @@ bool AudioFile<T>::setAudioBuffer (AudioBuffer& newBuffer)
 
 //=============================================================
 template <class T>
-void AudioFile<T>::setAudioBufferSize (int numChannels, int numSamples)
+void AudioFile<T>::setAudioBufferSize (int numChannels, size_t numSamples)
+{
+    samples.setSize (numChannels, numSamples);
+}
+
+//=============================================================
+template <class T>
+void AudioFile<T>::setNumSamplesPerChannel (size_t numSamples)
+{
+    samples.setNumSamplesPerChannel (numSamples);
+}
+
+//=============================================================
+template <class T>
+void AudioFile<T>::setNumChannels (int numChannels)
+{
+    samples.setNumChannels (numChannels);
+}
+
+//=============================================================
+template <class T>
+void AudioFile<T>::setBitDepth (int numBitsPerSample)
+{
+    bitDepth = numBitsPerSample;
+}
+
+//=============================================================
+template <class T>
+void AudioFile<T>::setSampleRate (uint32_t newSampleRate)
+{
+    sampleRate = newSampleRate;
+}
+
+//=============================================================
+template <class T>
+void AudioFile<T>::shouldLogErrorsToConsole (bool logErrors)
 {
-    samples.resize (numChannels);
-    setNumSamplesPerChannel (numSamples);
+    logErrorsToConsole = logErrors;
 }
 
 //=============================================================
 template <class T>
-void AudioFile<T>::setNumSamplesPerChannel (int numSamples)
+bool AudioFile<T>::load (std::string filePath)
 {
-    int originalSize = getNumSamplesPerChannel();
+    AudioFileData fileData;
     
-    for (int i = 0; i < getNumChannels();i++)
+    if (! fileData.open (filePath))
     {
-        samples[i].resize (numSamples);
-        
-        // set any new samples to zero
-        if (numSamples > originalSize)
-            std::fill (samples[i].begin() + originalSize, samples[i].end(), (T)0.);
+        reportError ("ERROR: File doesn't exist or otherwise can't load file\n"  + filePath);
+        return false;
     }
+    
+    return loadFromMemory (fileData);
 }
 
 //=============================================================
 template <class T>
-void AudioFile<T>::setNumChannels (int numChannels)
+bool AudioFile<T>::loadFromMemory (const AudioFileData& fileData)
 {
-    int originalNumChannels = getNumChannels();
-    int originalNumSamplesPerChannel = getNumSamplesPerChannel();
-    
-    samples.resize (numChannels);
+    // get audio file format
+    audioFileFormat = determineAudioFileFormat (fileData);
     
-    // make sure any new channels are set to the right size
-    // and filled with zeros
-    if (numChannels > originalNumChannels)
+    if (audioFileFormat == AudioFileFormat::Wave)
     {
-        for (int i = originalNumChannels; i < numChannels; i++)
-        {
-            samples[i].resize (originalNumSamplesPerChannel);
-            std::fill (samples[i].begin(), samples[i].end(), (T)0.);
-        }
+        return decodeWaveFile (fileData);
+    }
+    else if (audioFileFormat == AudioFileFormat::Aiff)
+    {
+        return decodeAiffFile (fileData);
+    }
+    else
+    {
+        reportError ("Audio File Type: Error");
+        return false;
     }
 }
 
 //=============================================================
 template <class T>
-void AudioFile<T>::setBitDepth (int numBitsPerSample)
+bool AudioFile<T>::loadLayout (std::string filePath, AudioFileData& fileData, AudioFileLayout& layout)
 {
-    bitDepth = numBitsPerSample;
+    if (! fileData.open (filePath))
+    {
+        reportError ("ERROR: File doesn't exist or otherwise can't load file\n"  + filePath);
+        return false;
+    }
+    
+    layout.format = determineAudioFileFormat (fileData);
+    
+    AudioFileChunkDirectory chunks;
+    bool validHeader = false;
+    
+    if (layout.format == AudioFileFormat::Wave)
+        validHeader = chunks.build (fileData, false) && parseWaveHeader (fileData, chunks, layout);
+    else if (layout.format == AudioFileFormat::Aiff)
+        validHeader = chunks.build (fileData, true) && parseAiffHeader (fileData, fileData.size(), chunks, layout);
+    else
+        reportError ("Audio File Type: Error");
+    
+    if (! validHeader)
+        return false;
+    
+    clampLayoutToFileSize (layout, fileData.size());
+    
+    return true;
+}
+
+//=============================================================
+template <class T>
+bool AudioFile<T>::readLayout (std::string filePath, AudioFileLayout& layout)
+{
+    std::ifstream file (filePath, std::ios::binary);
+    
+    // check the file exists
+    if (! file.good())
+    {
+        reportError ("ERROR: File doesn't exist or otherwise can't load file\n"  + filePath);
+        return false;
+    }
+    
+    file.seekg (0, std::ios::end);
+    size_t fileSize = file.tellg();
+    file.seekg (0, std::ios::beg);
+    
+    // read the start of the file in one go, which holds the whole header of most files
+    std::vector<uint8_t> headerData (std::min (fileSize, (size_t) 4096));
+    
+    if (fileSize < 12 || ! file.read (reinterpret_cast<char*> (headerData.data()), headerData.size()))
+    {
+        reportError ("Audio File Type: Error");
+        return false;
+    }
+    
+    layout.format = determineAudioFileFormat (headerData);
+    
+    if (layout.format == AudioFileFormat::Error)
+    {
+        reportError ("Audio File Type: Error");
+        return false;
+    }
+    
+    bool isWave = layout.format == AudioFileFormat::Wave;
+    
+    // walk the chunk headers to find out how much of the file comes before the sample data
+    AudioFileChunkDirectory chunks;
+    
+    chunks.build (fileSize, ! isWave, [&file, &headerData] (uint64_t offset, size_t numBytes, uint8_t* dest)
+    {
+        if (offset + numBytes <= headerData.size())
+        {
+            memcpy (dest, headerData.data() + offset, numBytes);
+            return true;
+        }
+        
+        file.clear();
+        file.seekg ((std::streamoff) offset, std::ios::beg);
+        return (bool) file.read (reinterpret_cast<char*> (dest), numBytes);
+    });
+    
+    // only the first 16 bytes of the data chunk are needed, which covers the SSND offset fields
+    size_t headerSize = 12;
+    
+    for (size_t i = 0; i < chunks.size(); i++)
+    {
+        const AudioFileChunk& chunk = chunks[i];
+        size_t chunkEnd = (size_t) std::min<uint64_t> (chunk.offset + 8 + chunk.size, fileSize);
+        
+        if (memcmp (chunk.id, isWave ? "fmt " : "COMM", 4) == 0 || memcmp (chunk.id, "ds64", 4) == 0)
+            headerSize = std::max (headerSize, chunkEnd);
+    }
+    
+    if (const AudioFileChunk* dataChunk = chunks.find (isWave ? "data" : "SSND"))
+        headerSize = std::max (headerSize, dataChunk->offset + 16);
+    
+    headerSize = std::min (headerSize, fileSize);
+    
+    // only go back to the file if the header is longer than the part already read
+    if (headerSize > headerData.size())
+    {
+        size_t numBytesRead = headerData.size();
+        headerData.resize (headerSize);
+        file.clear();
+        file.seekg ((std::streamoff) numBytesRead, std::ios::beg);
+        file.read (reinterpret_cast<char*> (headerData.data() + numBytesRead), headerSize - numBytesRead);
+    }
+    
+    bool validHeader = isWave ? parseWaveHeader (headerData, chunks, layout) : parseAiffHeader (headerData, fileSize, chunks, layout);
+    
+    if (! validHeader)
+        return false;
+    
+    // note where the iXML chunk is, so it can be read later
+    if (const AudioFileChunk* iXMLChunk = chunks.find ("iXML"))
+    {
+        layout.iXMLChunkStartIndex = iXMLChunk->offset + 8;
+        layout.iXMLChunkSize = (size_t) std::min<uint64_t> (iXMLChunk->size, fileSize - std::min (fileSize, layout.iXMLChunkStartIndex));
+    }
+    
+    clampLayoutToFileSize (layout, fileSize);
+    
+    return true;
 }
 
 //=============================================================
 template <class T>
-void AudioFile<T>::setSampleRate (uint32_t newSampleRate)
+void AudioFile<T>::clampLayoutToFileSize (AudioFileLayout& layout, size_t fileSize)
 {
-    sampleRate = newSampleRate;
+    // a truncated file is read up to its last whole frame, as the decoders would
+    size_t numFramesInFile = (fileSize - std::min (fileSize, layout.samplesStartIndex)) / layout.numBytesPerFrame;
+    layout.numSamplesPerChannel = std::min (layout.numSamplesPerChannel, numFramesInFile);
 }
 
 //=============================================================
 template <class T>
-void AudioFile<T>::shouldLogErrorsToConsole (bool logErrors)
+void AudioFile<T>::decodeFrames (const uint8_t* frameData, size_t numFrames, const AudioFileLayout& layout, AudioBuffer& buffer)
 {
-    logErrorsToConsole = logErrors;
+    // every sample is about to be overwritten, so there's no need to keep or clear the old ones
+    buffer.setSize (layout.numChannels, numFrames, false);
+    
+    std::vector<T*> channels (layout.numChannels);
+    
+    for (int channel = 0; channel < layout.numChannels; channel++)
+        channels[channel] = buffer[channel].data();
+    
+    typename AudioFrameDecoder<T>::Kernel decode = AudioFrameDecoder<T>::getKernel (layout);
+    assert (decode != nullptr);
+    
+    if (decode != nullptr && numFrames > 0)
+        decode (frameData, numFrames, layout.numChannels, channels.data());
 }
 
 //=============================================================
 template <class T>
-bool AudioFile<T>::load (std::string filePath)
+bool AudioFile<T>::encodeFrames (const AudioBuffer& buffer, size_t startFrame, size_t numFrames, const AudioFileLayout& layout, std::vector<uint8_t>& frameData)
 {
-    std::ifstream file (filePath, std::ios::binary);
-    
-    // check the file exists
-    if (! file.good())
-    {
-        reportError ("ERROR: File doesn't exist or otherwise can't load file\n"  + filePath);
-        return false;
-    }
-    
-    std::vector<uint8_t> fileData;
-
-	file.unsetf (std::ios::skipws);
-
-	file.seekg (0, std::ios::end);
-	size_t length = file.tellg();
-	file.seekg (0, std::ios::beg);
-
-	// allocate
-	fileData.resize (length);
-
-	file.read(reinterpret_cast<char*> (fileData.data()), length);
-	file.close();
-
-	if (file.gcount() != length)
-	{
-		reportError ("ERROR: Couldn't read entire file\n" + filePath);
-		return false;
-	}
+    bool isFloat = layout.format == AudioFileFormat::Wave ? layout.audioFormat == WavAudioFormat::IEEEFloat : layout.audioFormat == AIFFAudioFormat::Compressed;
+    Endianness endianness = layout.bigEndian ? Endianness::BigEndian : Endianness::LittleEndian;
     
-    // get audio file format
-    audioFileFormat = determineAudioFileFormat (fileData);
+    frameData.reserve (frameData.size() + numFrames * layout.numBytesPerFrame);
     
-    if (audioFileFormat == AudioFileFormat::Wave)
+    for (size_t i = startFrame; i < startFrame + numFrames; i++)
     {
-        return decodeWaveFile (fileData);
-    }
-    else if (audioFileFormat == AudioFileFormat::Aiff)
-    {
-        return decodeAiffFile (fileData);
-    }
-    else
-    {
-        reportError ("Audio File Type: Error");
-        return false;
+        for (int channel = 0; channel < layout.numChannels; channel++)
+        {
+            if (layout.bitDepth == 8)
+            {
+                uint8_t byte = sampleToSingleByte (buffer[channel][i]);
+                frameData.push_back (byte);
+            }
+            else if (layout.bitDepth == 16)
+            {
+                int16_t sampleAsInt = sampleToSixteenBitInt (buffer[channel][i]);
+                addInt16ToFileData (frameData, sampleAsInt, endianness);
+            }
+            else if (layout.bitDepth == 24)
+            {
+                int32_t sampleAsIntAgain = (int32_t) (buffer[channel][i] * (T)8388608.);
+                
+                uint8_t bytes[3];
+                bytes[2] = (uint8_t) (sampleAsIntAgain >> 16) & 0xFF;
+                bytes[1] = (uint8_t) (sampleAsIntAgain >>  8) & 0xFF;
+                bytes[0] = (uint8_t) sampleAsIntAgain & 0xFF;
+                
+                if (layout.bigEndian)
+                    std::swap (bytes[0], bytes[2]);
+                
+                frameData.push_back (bytes[0]);
+                frameData.push_back (bytes[1]);
+                frameData.push_back (bytes[2]);
+            }
+            else if (layout.bitDepth == 32)
+            {
+                int32_t sampleAsInt;
+                
+                if (isFloat)
+                    sampleAsInt = (int32_t) reinterpret_cast<const int32_t&> (buffer[channel][i]);
+                else // assume PCM
+                    sampleAsInt = (int32_t) (buffer[channel][i] * std::numeric_limits<int32_t>::max());
+                
+                addInt32ToFileData (frameData, sampleAsInt, endianness);
+            }
+            else
+            {
+                assert (false && "Trying to write a file with unsupported bit depth");
+                return false;
+            }
+        }
     }
+    
+    return true;
 }
 
 //=============================================================
 template <class T>
-bool AudioFile<T>::decodeWaveFile (std::vector<uint8_t>& fileData)
+bool AudioFile<T>::parseWaveHeader (const AudioFileData& fileData, const AudioFileChunkDirectory& chunks, AudioFileLayout& layout)
 {
     // -----------------------------------------------------------
     // HEADER CHUNK
-    std::string headerChunkID (fileData.begin(), fileData.begin() + 4);
-    //int32_t fileSizeInBytes = fourBytesToInt (fileData, 4) + 8;
-    std::string format (fileData.begin() + 8, fileData.begin() + 12);
+    bool validHeaderChunkID = memcmp (&fileData[0], "RIFF", 4) == 0 || memcmp (&fileData[0], "RF64", 4) == 0 || memcmp (&fileData[0], "BW64", 4) == 0;
+    bool validFormat = memcmp (&fileData[8], "WAVE", 4) == 0;
     
     // -----------------------------------------------------------
-    // try and find the start points of key chunks
-    int indexOfDataChunk = getIndexOfChunk (fileData, "data", 12);
-    int indexOfFormatChunk = getIndexOfChunk (fileData, "fmt ", 12);
-    int indexOfXMLChunk = getIndexOfChunk (fileData, "iXML", 12);
+    // look up the key chunks
+    const AudioFileChunk* dataChunk = chunks.find ("data");
+    const AudioFileChunk* formatChunk = chunks.find ("fmt ");
     
     // if we can't find the data or format chunks, or the IDs/formats don't seem to be as expected
     // then it is unlikely we'll able to read this file, so abort
-    if (indexOfDataChunk == -1 || indexOfFormatChunk == -1 || headerChunkID != "RIFF" || format != "WAVE")
+    if (dataChunk == nullptr || formatChunk == nullptr || formatChunk->offset + 24 > fileData.size() || ! validHeaderChunkID || ! validFormat)
     {
         reportError ("ERROR: this doesn't seem to be a valid .WAV file");
         return false;
@@ -522,18 +2175,21 @@ bool AudioFile<T>::decodeWaveFile (std::vector<uint8_t>& fileData)
     
     // -----------------------------------------------------------
     // FORMAT CHUNK
-    int f = indexOfFormatChunk;
-    std::string formatChunkID (fileData.begin() + f, fileData.begin() + f + 4);
-    //int32_t formatChunkSize = fourBytesToInt (fileData, f + 4);
+    size_t f = formatChunk->offset;
+    uint32_t formatChunkSize = (uint32_t) fourBytesToInt (fileData, f + 4);
     uint16_t audioFormat = twoBytesToInt (fileData, f + 8);
     uint16_t numChannels = twoBytesToInt (fileData, f + 10);
-    sampleRate = (uint32_t) fourBytesToInt (fileData, f + 12);
+    uint32_t sampleRate = (uint32_t) fourBytesToInt (fileData, f + 12);
     uint32_t numBytesPerSecond = fourBytesToInt (fileData, f + 16);
     uint16_t numBytesPerBlock = twoBytesToInt (fileData, f + 20);
-    bitDepth = (int) twoBytesToInt (fileData, f + 22);
+    int bitDepth = (int) twoBytesToInt (fileData, f + 22);
     
     uint16_t numBytesPerSample = static_cast<uint16_t> (bitDepth) / 8;
     
+    // an extensible file's real sample format is the first two bytes of its sub-format GUID
+    if (audioFormat == WavAudioFormat::Extensible && formatChunkSize >= 40 && f + 34 <= fileData.size())
+        audioFormat = twoBytesToInt (fileData, f + 32);
+    
     // check that the audio format is PCM or Float or extensible
     if (audioFormat != WavAudioFormat::PCM && audioFormat != WavAudioFormat::IEEEFloat && audioFormat != WavAudioFormat::Extensible)
     {
@@ -564,101 +2220,41 @@ bool AudioFile<T>::decodeWaveFile (std::vector<uint8_t>& fileData)
     
     // -----------------------------------------------------------
     // DATA CHUNK
-    int d = indexOfDataChunk;
-    std::string dataChunkID (fileData.begin() + d, fileData.begin() + d + 4);
-    int32_t dataChunkSize = fourBytesToInt (fileData, d + 4);
-    
-    int numSamples = dataChunkSize / (numChannels * bitDepth / 8);
-    int samplesStartIndex = indexOfDataChunk + 8;
+    size_t d = dataChunk->offset;
+    uint64_t dataChunkSize = dataChunk->size;
+    
+    layout.format = AudioFileFormat::Wave;
+    layout.audioFormat = audioFormat;
+    layout.numChannels = numChannels;
+    layout.bitDepth = bitDepth;
+    layout.sampleRate = sampleRate;
+    layout.bigEndian = false;
+    layout.numBytesPerSample = numBytesPerSample;
+    layout.numBytesPerFrame = numBytesPerBlock;
+    layout.numSamplesPerChannel = dataChunkSize / numBytesPerBlock;
+    layout.samplesStartIndex = d + 8;
     
-    clearAudioBuffer();
-    samples.resize (numChannels);
-    
-    for (int i = 0; i < numSamples; i++)
-    {
-        for (int channel = 0; channel < numChannels; channel++)
-        {
-            int sampleIndex = samplesStartIndex + (numBytesPerBlock * i) + channel * numBytesPerSample;
-            
-            if ((sampleIndex + (bitDepth / 8) - 1) >= fileData.size())
-            {
-                reportError ("ERROR: read file error as the metadata indicates more samples than there are in the file data");
-                return false;
-            }
-            
-            if (bitDepth == 8)
-            {
-                T sample = singleByteToSample (fileData[sampleIndex]);
-                samples[channel].push_back (sample);
-            }
-            else if (bitDepth == 16)
-            {
-                int16_t sampleAsInt = twoBytesToInt (fileData, sampleIndex);
-                T sample = sixteenBitIntToSample (sampleAsInt);
-                samples[channel].push_back (sample);
-            }
-            else if (bitDepth == 24)
-            {
-                int32_t sampleAsInt = 0;
-                sampleAsInt = (fileData[sampleIndex + 2] << 16) | (fileData[sampleIndex + 1] << 8) | fileData[sampleIndex];
-                
-                if (sampleAsInt & 0x800000) //  if the 24th bit is set, this is a negative number in 24-bit world
-                    sampleAsInt = sampleAsInt | ~0xFFFFFF; // so make sure sign is extended to the 32 bit float
-
-                T sample = (T)sampleAsInt / (T)8388608.;
-                samples[channel].push_back (sample);
-            }
-            else if (bitDepth == 32)
-            {
-                int32_t sampleAsInt = fourBytesToInt (fileData, sampleIndex);
-                T sample;
-                
-                if (audioFormat == WavAudioFormat::IEEEFloat)
-                    sample = (T)reinterpret_cast<float&> (sampleAsInt);
-                else // assume PCM
-                    sample = (T) sampleAsInt / static_cast<float> (std::numeric_limits<std::int32_t>::max());
-                
-                samples[channel].push_back (sample);
-            }
-            else
-            {
-                assert (false);
-            }
-        }
-    }
-
-    // -----------------------------------------------------------
-    // iXML CHUNK
-    if (indexOfXMLChunk != -1)
-    {
-        int32_t chunkSize = fourBytesToInt (fileData, indexOfXMLChunk + 4);
-        iXMLChunk = std::string ((const char*) &fileData[indexOfXMLChunk + 8], chunkSize);
-    }
-
     return true;
 }
 
 //=============================================================
 template <class T>
-bool AudioFile<T>::decodeAiffFile (std::vector<uint8_t>& fileData)
+bool AudioFile<T>::parseAiffHeader (const AudioFileData& fileData, size_t fileSize, const AudioFileChunkDirectory& chunks, AudioFileLayout& layout)
 {
     // -----------------------------------------------------------
     // HEADER CHUNK
-    std::string headerChunkID (fileData.begin(), fileData.begin() + 4);
-    //int32_t fileSizeInBytes = fourBytesToInt (fileData, 4, Endianness::BigEndian) + 8;
-    std::string format (fileData.begin() + 8, fileData.begin() + 12);
-    
-    int audioFormat = format == "AIFF" ? AIFFAudioFormat::Uncompressed : format == "AIFC" ? AIFFAudioFormat::Compressed : AIFFAudioFormat::Error;
+    bool validHeaderChunkID = memcmp (&fileData[0], "FORM", 4) == 0;
+    int audioFormat = memcmp (&fileData[8], "AIFF", 4) == 0 ? AIFFAudioFormat::Uncompressed : memcmp (&fileData[8], "AIFC", 4) == 0 ? AIFFAudioFormat::Compressed : AIFFAudioFormat::Error;
     
     // -----------------------------------------------------------
-    // try and find the start points of key chunks
-    int indexOfCommChunk = getIndexOfChunk (fileData, "COMM", 12, Endianness::BigEndian);
-    int indexOfSoundDataChunk = getIndexOfChunk (fileData, "SSND", 12, Endianness::BigEndian);
-    int indexOfXMLChunk = getIndexOfChunk (fileData, "iXML", 12, Endianness::BigEndian);
+    // look up the key chunks
+    const AudioFileChunk* commChunk = chunks.find ("COMM");
+    const AudioFileChunk* soundDataChunk = chunks.find ("SSND");
     
     // if we can't find the data or format chunks, or the IDs/formats don't seem to be as expected
     // then it is unlikely we'll able to read this file, so abort
-    if (indexOfSoundDataChunk == -1 || indexOfCommChunk == -1 || headerChunkID != "FORM" || audioFormat == AIFFAudioFormat::Error)
+    if (soundDataChunk == nullptr || commChunk == nullptr || commChunk->offset + 26 > fileData.size() || soundDataChunk->offset + 16 > fileData.size()
+        || ! validHeaderChunkID || audioFormat == AIFFAudioFormat::Error)
     {
         reportError ("ERROR: this doesn't seem to be a valid AIFF file");
         return false;
@@ -666,13 +2262,12 @@ bool AudioFile<T>::decodeAiffFile (std::vector<uint8_t>& fileData)
 
     // -----------------------------------------------------------
     // COMM CHUNK
-    int p = indexOfCommChunk;
-    std::string commChunkID (fileData.begin() + p, fileData.begin() + p + 4);
+    size_t p = commChunk->offset;
     //int32_t commChunkSize = fourBytesToInt (fileData, p + 4, Endianness::BigEndian);
     int16_t numChannels = twoBytesToInt (fileData, p + 8, Endianness::BigEndian);
-    int32_t numSamplesPerChannel = fourBytesToInt (fileData, p + 10, Endianness::BigEndian);
-    bitDepth = (int) twoBytesToInt (fileData, p + 14, Endianness::BigEndian);
-    sampleRate = getAiffSampleRate (fileData, p + 16);
+    uint32_t numSamplesPerChannel = (uint32_t) fourBytesToInt (fileData, p + 10, Endianness::BigEndian);
+    int bitDepth = (int) twoBytesToInt (fileData, p + 14, Endianness::BigEndian);
+    uint32_t sampleRate = getAiffSampleRate (fileData, p + 16);
     
     // check the sample rate was properly decoded
     if (sampleRate == 0)
@@ -697,95 +2292,125 @@ bool AudioFile<T>::decodeAiffFile (std::vector<uint8_t>& fileData)
     
     // -----------------------------------------------------------
     // SSND CHUNK
-    int s = indexOfSoundDataChunk;
-    std::string soundDataChunkID (fileData.begin() + s, fileData.begin() + s + 4);
-    int32_t soundDataChunkSize = fourBytesToInt (fileData, s + 4, Endianness::BigEndian);
-    int32_t offset = fourBytesToInt (fileData, s + 8, Endianness::BigEndian);
+    size_t s = soundDataChunk->offset;
+    uint64_t soundDataChunkSize = soundDataChunk->size;
+    uint32_t offset = (uint32_t) fourBytesToInt (fileData, s + 8, Endianness::BigEndian);
     //int32_t blockSize = fourBytesToInt (fileData, s + 12, Endianness::BigEndian);
     
     int numBytesPerSample = bitDepth / 8;
     int numBytesPerFrame = numBytesPerSample * numChannels;
-    int totalNumAudioSampleBytes = numSamplesPerChannel * numBytesPerFrame;
-    int samplesStartIndex = s + 16 + (int)offset;
+    uint64_t totalNumAudioSampleBytes = (uint64_t) numSamplesPerChannel * numBytesPerFrame;
+    size_t samplesStartIndex = s + 16 + offset;
         
     // sanity check the data
-    if ((soundDataChunkSize - 8) != totalNumAudioSampleBytes || totalNumAudioSampleBytes > static_cast<long>(fileData.size() - samplesStartIndex))
+    if ((soundDataChunkSize - 8) != totalNumAudioSampleBytes || samplesStartIndex > fileSize || totalNumAudioSampleBytes > fileSize - samplesStartIndex)
     {
         reportError ("ERROR: the metadatafor this file doesn't seem right");
         return false;
     }
     
+    layout.format = AudioFileFormat::Aiff;
+    layout.audioFormat = audioFormat;
+    layout.numChannels = numChannels;
+    layout.bitDepth = bitDepth;
+    layout.sampleRate = sampleRate;
+    layout.bigEndian = true;
+    layout.numBytesPerSample = numBytesPerSample;
+    layout.numBytesPerFrame = numBytesPerFrame;
+    layout.numSamplesPerChannel = numSamplesPerChannel;
+    layout.samplesStartIndex = samplesStartIndex;
+    
+    return true;
+}
+
+//=============================================================
+template <class T>
+bool AudioFile<T>::decodeWaveFile (const AudioFileData& fileData)
+{
+    AudioFileLayout layout;
+    AudioFileChunkDirectory chunks;
+    
+    if (! chunks.build (fileData, false) || ! parseWaveHeader (fileData, chunks, layout))
+        return false;
+    
+    sampleRate = layout.sampleRate;
+    bitDepth = layout.bitDepth;
+    size_t numSamplesPerChannel = layout.numSamplesPerChannel;
+    size_t numBytesPerFrame = layout.numBytesPerFrame;
+    size_t samplesStartIndex = layout.samplesStartIndex;
+    
     clearAudioBuffer();
-    samples.resize (numChannels);
     
-    for (int i = 0; i < numSamplesPerChannel; i++)
+    // only whole frames that are actually in the file can be decoded
+    size_t numFramesInFile = (fileData.size() - std::min (fileData.size(), samplesStartIndex)) / numBytesPerFrame;
+    
+    if (numSamplesPerChannel > numFramesInFile)
     {
-        for (int channel = 0; channel < numChannels; channel++)
-        {
-            int sampleIndex = samplesStartIndex + (numBytesPerFrame * i) + channel * numBytesPerSample;
-            
-            if ((sampleIndex + (bitDepth / 8) - 1) >= fileData.size())
-            {
-                reportError ("ERROR: read file error as the metadata indicates more samples than there are in the file data");
-                return false;
-            }
-            
-            if (bitDepth == 8)
-            {
-                int8_t sampleAsSigned8Bit = (int8_t)fileData[sampleIndex];
-                T sample = (T)sampleAsSigned8Bit / (T)128.;
-                samples[channel].push_back (sample);
-            }
-            else if (bitDepth == 16)
-            {
-                int16_t sampleAsInt = twoBytesToInt (fileData, sampleIndex, Endianness::BigEndian);
-                T sample = sixteenBitIntToSample (sampleAsInt);
-                samples[channel].push_back (sample);
-            }
-            else if (bitDepth == 24)
-            {
-                int32_t sampleAsInt = 0;
-                sampleAsInt = (fileData[sampleIndex] << 16) | (fileData[sampleIndex + 1] << 8) | fileData[sampleIndex + 2];
-                
-                if (sampleAsInt & 0x800000) //  if the 24th bit is set, this is a negative number in 24-bit world
-                    sampleAsInt = sampleAsInt | ~0xFFFFFF; // so make sure sign is extended to the 32 bit float
-                
-                T sample = (T)sampleAsInt / (T)8388608.;
-                samples[channel].push_back (sample);
-            }
-            else if (bitDepth == 32)
-            {
-                int32_t sampleAsInt = fourBytesToInt (fileData, sampleIndex, Endianness::BigEndian);
-                T sample;
-                
-                if (audioFormat == AIFFAudioFormat::Compressed)
-                    sample = (T)reinterpret_cast<float&> (sampleAsInt);
-                else // assume uncompressed
-                    sample = (T) sampleAsInt / static_cast<float> (std::numeric_limits<std::int32_t>::max());
-                    
-                samples[channel].push_back (sample);
-            }
-            else
-            {
-                assert (false);
-            }
-        }
+        reportError ("ERROR: read file error as the metadata indicates more samples than there are in the file data");
+        return false;
     }
+    
+    decodeFrames (fileData.data() + samplesStartIndex, numSamplesPerChannel, layout, samples);
 
     // -----------------------------------------------------------
     // iXML CHUNK
-    if (indexOfXMLChunk != -1)
+    iXMLChunk = readIXMLChunk (fileData, chunks);
+
+    return true;
+}
+
+//=============================================================
+template <class T>
+bool AudioFile<T>::decodeAiffFile (const AudioFileData& fileData)
+{
+    AudioFileLayout layout;
+    AudioFileChunkDirectory chunks;
+    
+    if (! chunks.build (fileData, true) || ! parseAiffHeader (fileData, fileData.size(), chunks, layout))
+        return false;
+    
+    sampleRate = layout.sampleRate;
+    bitDepth = layout.bitDepth;
+    size_t numSamplesPerChannel = layout.numSamplesPerChannel;
+    size_t numBytesPerFrame = layout.numBytesPerFrame;
+    size_t samplesStartIndex = layout.samplesStartIndex;
+    
+    clearAudioBuffer();
+    
+    // only whole frames that are actually in the file can be decoded
+    size_t numFramesInFile = (fileData.size() - std::min (fileData.size(), samplesStartIndex)) / numBytesPerFrame;
+    
+    if (numSamplesPerChannel > numFramesInFile)
     {
-        int32_t chunkSize = fourBytesToInt (fileData, indexOfXMLChunk + 4);
-        iXMLChunk = std::string ((const char*) &fileData[indexOfXMLChunk + 8], chunkSize);
+        reportError ("ERROR: read file error as the metadata indicates more samples than there are in the file data");
+        return false;
     }
     
+    decodeFrames (fileData.data() + samplesStartIndex, numSamplesPerChannel, layout, samples);
+
+    // -----------------------------------------------------------
+    // iXML CHUNK
+    iXMLChunk = readIXMLChunk (fileData, chunks);
+    
     return true;
 }
 
 //=============================================================
 template <class T>
-uint32_t AudioFile<T>::getAiffSampleRate (std::vector<uint8_t>& fileData, int sampleRateStartIndex)
+std::string AudioFile<T>::readIXMLChunk (const AudioFileData& fileData, const AudioFileChunkDirectory& chunks)
+{
+    const AudioFileChunk* chunk = chunks.find ("iXML");
+    
+    if (chunk == nullptr)
+        return std::string();
+    
+    size_t chunkSize = (size_t) std::min<uint64_t> (chunk->size, fileData.size() - (chunk->offset + 8));
+    return std::string ((const char*) &fileData[chunk->offset + 8], chunkSize);
+}
+
+//=============================================================
+template <class T>
+uint32_t AudioFile<T>::getAiffSampleRate (const AudioFileData& fileData, size_t sampleRateStartIndex)
 {
     for (auto it : aiffSampleRateTable)
     {
@@ -798,7 +2423,7 @@ uint32_t AudioFile<T>::getAiffSampleRate (std::vector<uint8_t>& fileData, int sa
 
 //=============================================================
 template <class T>
-bool AudioFile<T>::tenByteMatch (std::vector<uint8_t>& v1, int startIndex1, std::vector<uint8_t>& v2, int startIndex2)
+bool AudioFile<T>::tenByteMatch (const AudioFileData& v1, size_t startIndex1, const AudioFileData& v2, size_t startIndex2)
 {
     for (int i = 0; i < 10; i++)
     {
@@ -842,142 +2467,185 @@ bool AudioFile<T>::saveToWaveFile (std::string filePath)
 {
     std::vector<uint8_t> fileData;
     
-    int32_t dataChunkSize = getNumSamplesPerChannel() * (getNumChannels() * bitDepth / 8);
-    int16_t audioFormat = bitDepth == 32 ? WavAudioFormat::IEEEFloat : WavAudioFormat::PCM;
-    int32_t formatChunkSize = audioFormat == WavAudioFormat::PCM ? 16 : 18;
-    int32_t iXMLChunkSize = static_cast<int32_t> (iXMLChunk.size());
+    AudioFileLayout layout = getOutputLayout (AudioFileFormat::Wave, getNumChannels(), bitDepth, sampleRate);
+    uint64_t dataChunkSize = (uint64_t) getNumSamplesPerChannel() * layout.numBytesPerFrame;
+    uint32_t iXMLChunkSize = static_cast<uint32_t> (iXMLChunk.size());
     
-    // -----------------------------------------------------------
-    // HEADER CHUNK
-    addStringToFileData (fileData, "RIFF");
+    addWaveHeaderToFileData (fileData, layout, dataChunkSize, iXMLChunkSize);
     
-    // The file size in bytes is the header chunk size (4, not counting RIFF and WAVE) + the format
-    // chunk size (24) + the metadata part of the data chunk plus the actual data chunk size
-    int32_t fileSizeInBytes = 4 + formatChunkSize + 8 + 8 + dataChunkSize;
-    if (iXMLChunkSize > 0)
+    // check that the various sizes we put in the metadata are correct (an RF64 file keeps its size in the ds64 chunk)
+    AudioFileChunkDirectory chunks;
+    chunks.build (fileData, false);
+    uint64_t fileSizeInBytes = chunks.getFormSize();
+    uint64_t totalNumBytes = fileData.size() + dataChunkSize + (iXMLChunkSize > 0 ? 8 + iXMLChunkSize : 0);
+    
+    if (fileSizeInBytes != totalNumBytes - 8 || dataChunkSize != getNumSamplesPerChannel() * getNumChannels() * (bitDepth / 8))
     {
-        fileSizeInBytes += (8 + iXMLChunkSize);
+        reportError ("ERROR: couldn't save file to " + filePath);
+        return false;
     }
+    
+    // try to write the file
+    return writeDataToFile (fileData, layout, filePath);
+}
 
-    addInt32ToFileData (fileData, fileSizeInBytes);
+//=============================================================
+template <class T>
+bool AudioFile<T>::saveToAiffFile (std::string filePath)
+{
+    std::vector<uint8_t> fileData;
     
-    addStringToFileData (fileData, "WAVE");
+    AudioFileLayout layout = getOutputLayout (AudioFileFormat::Aiff, getNumChannels(), bitDepth, sampleRate);
+    uint64_t numBytesPerFrame = layout.numBytesPerFrame;
+    uint64_t soundDataChunkSize = getNumSamplesPerChannel() * numBytesPerFrame + 8;
+    uint32_t iXMLChunkSize = static_cast<uint32_t> (iXMLChunk.size());
     
-    // -----------------------------------------------------------
-    // FORMAT CHUNK
-    addStringToFileData (fileData, "fmt ");
-    addInt32ToFileData (fileData, formatChunkSize); // format chunk size (16 for PCM)
-    addInt16ToFileData (fileData, audioFormat); // audio format
-    addInt16ToFileData (fileData, (int16_t)getNumChannels()); // num channels
-    addInt32ToFileData (fileData, (int32_t)sampleRate); // sample rate
+    if (! addAiffHeaderToFileData (fileData, layout, getNumSamplesPerChannel(), iXMLChunkSize))
+    {
+        reportError ("ERROR: this file is too large to be saved as AIFF, which is limited to 4 GB\n" + filePath);
+        return false;
+    }
     
-    int32_t numBytesPerSecond = (int32_t) ((getNumChannels() * sampleRate * bitDepth) / 8);
-    addInt32ToFileData (fileData, numBytesPerSecond);
+    // check that the various sizes we put in the metadata are correct
+    uint64_t fileSizeInBytes = (uint32_t) fourBytesToInt (fileData, 4, Endianness::BigEndian);
+    uint64_t totalNumBytes = fileData.size() + soundDataChunkSize - 8 + (iXMLChunkSize > 0 ? 8 + iXMLChunkSize : 0);
     
-    int16_t numBytesPerBlock = getNumChannels() * (bitDepth / 8);
-    addInt16ToFileData (fileData, numBytesPerBlock);
+    if (fileSizeInBytes != totalNumBytes - 8 || soundDataChunkSize != getNumSamplesPerChannel() *  numBytesPerFrame + 8)
+    {
+        reportError ("ERROR: couldn't save file to " + filePath);
+        return false;
+    }
     
-    addInt16ToFileData (fileData, (int16_t)bitDepth);
+    // try to write the file
+    return writeDataToFile (fileData, layout, filePath);
+}
+
+//=============================================================
+template <class T>
+AudioFileLayout AudioFile<T>::getOutputLayout (AudioFileFormat format, int numChannels, int numBitsPerSample, uint32_t newSampleRate)
+{
+    AudioFileLayout layout;
+    layout.format = format;
+    layout.numChannels = numChannels;
+    layout.bitDepth = numBitsPerSample;
+    layout.sampleRate = newSampleRate;
+    layout.numBytesPerSample = numBitsPerSample / 8;
+    layout.numBytesPerFrame = layout.numBytesPerSample * numChannels;
     
-    if (audioFormat == WavAudioFormat::IEEEFloat)
-        addInt16ToFileData (fileData, 0); // extension size
+    if (format == AudioFileFormat::Wave)
+    {
+        // 32 bit WAV files are written as floating point, everything else as PCM
+        layout.audioFormat = numBitsPerSample == 32 ? WavAudioFormat::IEEEFloat : WavAudioFormat::PCM;
+        layout.bigEndian = false;
+    }
+    else
+    {
+        layout.audioFormat = AIFFAudioFormat::Uncompressed;
+        layout.bigEndian = true;
+    }
+    
+    return layout;
+}
+
+//=============================================================
+template <class T>
+void AudioFile<T>::addWaveHeaderToFileData (std::vector<uint8_t>& fileData, const AudioFileLayout& layout, uint64_t dataChunkSize, uint32_t iXMLChunkSize, bool reserveDs64Chunk)
+{
+    int16_t audioFormat = layout.audioFormat;
+    int32_t formatChunkSize = audioFormat == WavAudioFormat::PCM ? 16 : 18;
+    
+    // the ds64 chunk holds the 64-bit sizes of an RF64 file, and a JUNK chunk of
+    // the same size keeps its place in a RIFF file that may need to become one
+    const uint32_t ds64ChunkSize = 28;
     
     // -----------------------------------------------------------
-    // DATA CHUNK
-    addStringToFileData (fileData, "data");
-    addInt32ToFileData (fileData, dataChunkSize);
+    // HEADER CHUNK
     
-    for (int i = 0; i < getNumSamplesPerChannel(); i++)
+    // The file size in bytes is the header chunk size (4, not counting RIFF and WAVE) + the format
+    // chunk size (24) + the metadata part of the data chunk plus the actual data chunk size
+    uint64_t fileSizeInBytes = 4 + formatChunkSize + 8 + 8 + dataChunkSize;
+    if (iXMLChunkSize > 0)
     {
-        for (int channel = 0; channel < getNumChannels(); channel++)
-        {
-            if (bitDepth == 8)
-            {
-                uint8_t byte = sampleToSingleByte (samples[channel][i]);
-                fileData.push_back (byte);
-            }
-            else if (bitDepth == 16)
-            {
-                int16_t sampleAsInt = sampleToSixteenBitInt (samples[channel][i]);
-                addInt16ToFileData (fileData, sampleAsInt);
-            }
-            else if (bitDepth == 24)
-            {
-                int32_t sampleAsIntAgain = (int32_t) (samples[channel][i] * (T)8388608.);
-                
-                uint8_t bytes[3];
-                bytes[2] = (uint8_t) (sampleAsIntAgain >> 16) & 0xFF;
-                bytes[1] = (uint8_t) (sampleAsIntAgain >>  8) & 0xFF;
-                bytes[0] = (uint8_t) sampleAsIntAgain & 0xFF;
-                
-                fileData.push_back (bytes[0]);
-                fileData.push_back (bytes[1]);
-                fileData.push_back (bytes[2]);
-            }
-            else if (bitDepth == 32)
-            {
-                int32_t sampleAsInt;
-                
-                if (audioFormat == WavAudioFormat::IEEEFloat)
-                    sampleAsInt = (int32_t) reinterpret_cast<int32_t&> (samples[channel][i]);
-                else // assume PCM
-                    sampleAsInt = (int32_t) (samples[channel][i] * std::numeric_limits<int32_t>::max());
-                
-                addInt32ToFileData (fileData, sampleAsInt, Endianness::LittleEndian);
-            }
-            else
-            {
-                assert (false && "Trying to write a file with unsupported bit depth");
-                return false;
-            }
-        }
+        fileSizeInBytes += (8 + iXMLChunkSize);
     }
     
+    // anything too big for the 32-bit sizes of a RIFF file is written as RF64
+    bool rf64 = fileSizeInBytes + (reserveDs64Chunk ? 8 + ds64ChunkSize : 0) > 0xFFFFFFFF;
+    
+    if (rf64 || reserveDs64Chunk)
+        fileSizeInBytes += 8 + ds64ChunkSize;
+    
+    addStringToFileData (fileData, rf64 ? "RF64" : "RIFF");
+    addInt32ToFileData (fileData, rf64 ? -1 : (int32_t) fileSizeInBytes);
+    
+    addStringToFileData (fileData, "WAVE");
+    
     // -----------------------------------------------------------
-    // iXML CHUNK
-    if (iXMLChunkSize > 0) 
+    // DS64 CHUNK
+    if (rf64)
     {
-        addStringToFileData (fileData, "iXML");
-        addInt32ToFileData (fileData, iXMLChunkSize);
-        addStringToFileData (fileData, iXMLChunk);
+        addStringToFileData (fileData, "ds64");
+        addInt32ToFileData (fileData, ds64ChunkSize);
+        addInt64ToFileData (fileData, fileSizeInBytes); // RIFF size
+        addInt64ToFileData (fileData, dataChunkSize); // data size
+        addInt64ToFileData (fileData, dataChunkSize / layout.numBytesPerFrame); // sample count
+        addInt32ToFileData (fileData, 0); // table length
     }
-    
-    // check that the various sizes we put in the metadata are correct
-    if (fileSizeInBytes != static_cast<int32_t> (fileData.size() - 8) || dataChunkSize != (getNumSamplesPerChannel() * getNumChannels() * (bitDepth / 8)))
+    else if (reserveDs64Chunk)
     {
-        reportError ("ERROR: couldn't save file to " + filePath);
-        return false;
+        addStringToFileData (fileData, "JUNK");
+        addInt32ToFileData (fileData, ds64ChunkSize);
+        fileData.insert (fileData.end(), ds64ChunkSize, 0);
     }
     
-    // try to write the file
-    return writeDataToFile (fileData, filePath);
+    // -----------------------------------------------------------
+    // FORMAT CHUNK
+    addStringToFileData (fileData, "fmt ");
+    addInt32ToFileData (fileData, formatChunkSize); // format chunk size (16 for PCM)
+    addInt16ToFileData (fileData, audioFormat); // audio format
+    addInt16ToFileData (fileData, (int16_t)layout.numChannels); // num channels
+    addInt32ToFileData (fileData, (int32_t)layout.sampleRate); // sample rate
+    
+    int32_t numBytesPerSecond = (int32_t) ((layout.numChannels * layout.sampleRate * layout.bitDepth) / 8);
+    addInt32ToFileData (fileData, numBytesPerSecond);
+    
+    int16_t numBytesPerBlock = layout.numChannels * (layout.bitDepth / 8);
+    addInt16ToFileData (fileData, numBytesPerBlock);
+    
+    addInt16ToFileData (fileData, (int16_t)layout.bitDepth);
+    
+    if (audioFormat == WavAudioFormat::IEEEFloat)
+        addInt16ToFileData (fileData, 0); // extension size
+    
+    // -----------------------------------------------------------
+    // DATA CHUNK
+    addStringToFileData (fileData, "data");
+    addInt32ToFileData (fileData, rf64 ? -1 : (int32_t) dataChunkSize);
 }
 
 //=============================================================
 template <class T>
-bool AudioFile<T>::saveToAiffFile (std::string filePath)
+bool AudioFile<T>::addAiffHeaderToFileData (std::vector<uint8_t>& fileData, const AudioFileLayout& layout, uint64_t numSamplesPerChannel, uint32_t iXMLChunkSize)
 {
-    std::vector<uint8_t> fileData;
-    
-    int32_t numBytesPerSample = bitDepth / 8;
-    int32_t numBytesPerFrame = numBytesPerSample * getNumChannels();
-    int32_t totalNumAudioSampleBytes = getNumSamplesPerChannel() * numBytesPerFrame;
-    int32_t soundDataChunkSize = totalNumAudioSampleBytes + 8;
-    int32_t iXMLChunkSize = static_cast<int32_t> (iXMLChunk.size());
-    
-    // -----------------------------------------------------------
-    // HEADER CHUNK
-    addStringToFileData (fileData, "FORM");
+    uint64_t totalNumAudioSampleBytes = numSamplesPerChannel * layout.numBytesPerFrame;
+    uint64_t soundDataChunkSize = totalNumAudioSampleBytes + 8;
     
     // The file size in bytes is the header chunk size (4, not counting FORM and AIFF) + the COMM
     // chunk size (26) + the metadata part of the SSND chunk plus the actual data chunk size
-    int32_t fileSizeInBytes = 4 + 26 + 16 + totalNumAudioSampleBytes;
+    uint64_t fileSizeInBytes = 4 + 26 + 16 + totalNumAudioSampleBytes;
     if (iXMLChunkSize > 0)
     {
         fileSizeInBytes += (8 + iXMLChunkSize);
     }
-
-    addInt32ToFileData (fileData, fileSizeInBytes, Endianness::BigEndian);
+    
+    // AIFF has no 64-bit extension, so its sizes have to fit in 32 bits
+    if (fileSizeInBytes > 0xFFFFFFFF)
+        return false;
+    
+    // -----------------------------------------------------------
+    // HEADER CHUNK
+    addStringToFileData (fileData, "FORM");
+    addInt32ToFileData (fileData, (int32_t) fileSizeInBytes, Endianness::BigEndian);
     
     addStringToFileData (fileData, "AIFF");
     
@@ -985,99 +2653,64 @@ bool AudioFile<T>::saveToAiffFile (std::string filePath)
     // COMM CHUNK
     addStringToFileData (fileData, "COMM");
     addInt32ToFileData (fileData, 18, Endianness::BigEndian); // commChunkSize
-    addInt16ToFileData (fileData, getNumChannels(), Endianness::BigEndian); // num channels
-    addInt32ToFileData (fileData, getNumSamplesPerChannel(), Endianness::BigEndian); // num samples per channel
-    addInt16ToFileData (fileData, bitDepth, Endianness::BigEndian); // bit depth
-    addSampleRateToAiffData (fileData, sampleRate);
+    addInt16ToFileData (fileData, layout.numChannels, Endianness::BigEndian); // num channels
+    addInt32ToFileData (fileData, (int32_t) numSamplesPerChannel, Endianness::BigEndian); // num samples per channel
+    addInt16ToFileData (fileData, layout.bitDepth, Endianness::BigEndian); // bit depth
+    addSampleRateToAiffData (fileData, layout.sampleRate);
     
     // -----------------------------------------------------------
     // SSND CHUNK
     addStringToFileData (fileData, "SSND");
-    addInt32ToFileData (fileData, soundDataChunkSize, Endianness::BigEndian);
+    addInt32ToFileData (fileData, (int32_t) soundDataChunkSize, Endianness::BigEndian);
     addInt32ToFileData (fileData, 0, Endianness::BigEndian); // offset
     addInt32ToFileData (fileData, 0, Endianness::BigEndian); // block size
     
-    for (int i = 0; i < getNumSamplesPerChannel(); i++)
-    {
-        for (int channel = 0; channel < getNumChannels(); channel++)
-        {
-            if (bitDepth == 8)
-            {
-                uint8_t byte = sampleToSingleByte (samples[channel][i]);
-                fileData.push_back (byte);
-            }
-            else if (bitDepth == 16)
-            {
-                int16_t sampleAsInt = sampleToSixteenBitInt (samples[channel][i]);
-                addInt16ToFileData (fileData, sampleAsInt, Endianness::BigEndian);
-            }
-            else if (bitDepth == 24)
-            {
-                int32_t sampleAsIntAgain = (int32_t) (samples[channel][i] * (T)8388608.);
-                
-                uint8_t bytes[3];
-                bytes[0] = (uint8_t) (sampleAsIntAgain >> 16) & 0xFF;
-                bytes[1] = (uint8_t) (sampleAsIntAgain >>  8) & 0xFF;
-                bytes[2] = (uint8_t) sampleAsIntAgain & 0xFF;
-                
-                fileData.push_back (bytes[0]);
-                fileData.push_back (bytes[1]);
-                fileData.push_back (bytes[2]);
-            }
-            else if (bitDepth == 32)
-            {
-                // write samples as signed integers (no implementation yet for floating point, but looking at WAV implementation should help)
-                int32_t sampleAsInt = (int32_t) (samples[channel][i] * std::numeric_limits<int32_t>::max());
-                addInt32ToFileData (fileData, sampleAsInt, Endianness::BigEndian);
-            }
-            else
-            {
-                assert (false && "Trying to write a file with unsupported bit depth");
-                return false;
-            }
-        }
-    }
-
-    // -----------------------------------------------------------
-    // iXML CHUNK
-    if (iXMLChunkSize > 0)
-    {
-        addStringToFileData (fileData, "iXML");
-        addInt32ToFileData (fileData, iXMLChunkSize, Endianness::BigEndian);
-        addStringToFileData (fileData, iXMLChunk);
-    }
-    
-    // check that the various sizes we put in the metadata are correct
-    if (fileSizeInBytes != static_cast<int32_t> (fileData.size() - 8) || soundDataChunkSize != getNumSamplesPerChannel() *  numBytesPerFrame + 8)
-    {
-        reportError ("ERROR: couldn't save file to " + filePath);
-        return false;
-    }
-    
-    // try to write the file
-    return writeDataToFile (fileData, filePath);
+    return true;
 }
 
 //=============================================================
 template <class T>
-bool AudioFile<T>::writeDataToFile (std::vector<uint8_t>& fileData, std::string filePath)
+bool AudioFile<T>::writeDataToFile (const std::vector<uint8_t>& headerData, const AudioFileLayout& layout, std::string filePath)
 {
-    std::ofstream outputFile (filePath, std::ios::binary);
+    // the samples are encoded a buffer's worth at a time and handed straight to the file,
+    // so the whole file never has to be held in memory
+    size_t numSamplesPerChannel = getNumSamplesPerChannel();
+    size_t numFramesPerBlock = std::max ((size_t) 1, AudioFileSink::bufferSize / layout.numBytesPerFrame);
+    std::vector<uint8_t> frameData;
+    
+    // encode the first block before creating the file, so an unsupported bit depth leaves nothing behind
+    if (! encodeFrames (samples, 0, std::min (numFramesPerBlock, numSamplesPerChannel), layout, frameData))
+        return false;
+    
+    AudioFileSink outputFile;
+    
+    if (! outputFile.open (filePath))
+        return false;
+    
+    outputFile.write (headerData.data(), headerData.size());
+    outputFile.write (frameData.data(), frameData.size());
     
-    if (outputFile.is_open())
+    for (size_t i = numFramesPerBlock; i < numSamplesPerChannel; i += numFramesPerBlock)
     {
-        for (size_t i = 0; i < fileData.size(); i++)
-        {
-            char value = (char) fileData[i];
-            outputFile.write (&value, sizeof (char));
-        }
+        frameData.clear();
+        encodeFrames (samples, i, std::min (numFramesPerBlock, numSamplesPerChannel - i), layout, frameData);
         
-        outputFile.close();
-        
-        return true;
+        if (! outputFile.write (frameData.data(), frameData.size()))
+            break;
     }
     
-    return false;
+    // -----------------------------------------------------------
+    // iXML CHUNK
+    if (iXMLChunk.size() > 0)
+    {
+        std::vector<uint8_t> chunk;
+        addStringToFileData (chunk, "iXML");
+        addInt32ToFileData (chunk, static_cast<int32_t> (iXMLChunk.size()), layout.bigEndian ? Endianness::BigEndian : Endianness::LittleEndian);
+        addStringToFileData (chunk, iXMLChunk);
+        outputFile.write (chunk.data(), chunk.size());
+    }
+    
+    return outputFile.close();
 }
 
 //=============================================================
@@ -1088,6 +2721,15 @@ void AudioFile<T>::addStringToFileData (std::vector<uint8_t>& fileData, std::str
         fileData.push_back ((uint8_t) s[i]);
 }
 
+//=============================================================
+template <class T>
+void AudioFile<T>::addInt64ToFileData (std::vector<uint8_t>& fileData, uint64_t i)
+{
+    // only RF64 files have 64-bit fields, and they are always little endian
+    for (int b = 0; b < 8; b++)
+        fileData.push_back ((i >> (8 * b)) & 0xFF);
+}
+
 //=============================================================
 template <class T>
 void AudioFile<T>::addInt32ToFileData (std::vector<uint8_t>& fileData, int32_t i, Endianness endianness)
@@ -1138,21 +2780,19 @@ void AudioFile<T>::addInt16ToFileData (std::vector<uint8_t>& fileData, int16_t i
 template <class T>
 void AudioFile<T>::clearAudioBuffer()
 {
-    for (size_t i = 0; i < samples.size();i++)
-    {
-        samples[i].clear();
-    }
-    
     samples.clear();
 }
 
 //=============================================================
 template <class T>
-AudioFileFormat AudioFile<T>::determineAudioFileFormat (std::vector<uint8_t>& fileData)
+AudioFileFormat AudioFile<T>::determineAudioFileFormat (const AudioFileData& fileData)
 {
+    if (fileData.size() < 12)
+        return AudioFileFormat::Error;
+    
     std::string header (fileData.begin(), fileData.begin() + 4);
     
-    if (header == "RIFF")
+    if (header == "RIFF" || header == "RF64" || header == "BW64")
         return AudioFileFormat::Wave;
     else if (header == "FORM")
         return AudioFileFormat::Aiff;
@@ -1162,7 +2802,19 @@ AudioFileFormat AudioFile<T>::determineAudioFileFormat (std::vector<uint8_t>& fi
 
 //=============================================================
 template <class T>
-int32_t AudioFile<T>::fourBytesToInt (std::vector<uint8_t>& source, int startIndex, Endianness endianness)
+uint64_t AudioFile<T>::eightBytesToInt (const AudioFileData& source, size_t startIndex)
+{
+    uint64_t result = 0;
+    
+    for (int i = 7; i >= 0; i--)
+        result = (result << 8) | source[startIndex + i];
+    
+    return result;
+}
+
+//=============================================================
+template <class T>
+int32_t AudioFile<T>::fourBytesToInt (const AudioFileData& source, size_t startIndex, Endianness endianness)
 {
     int32_t result;
     
@@ -1176,7 +2828,7 @@ int32_t AudioFile<T>::fourBytesToInt (std::vector<uint8_t>& source, int startInd
 
 //=============================================================
 template <class T>
-int16_t AudioFile<T>::twoBytesToInt (std::vector<uint8_t>& source, int startIndex, Endianness endianness)
+int16_t AudioFile<T>::twoBytesToInt (const AudioFileData& source, size_t startIndex, Endianness endianness)
 {
     int16_t result;
     
@@ -1190,49 +2842,20 @@ int16_t AudioFile<T>::twoBytesToInt (std::vector<uint8_t>& source, int startInde
 
 //=============================================================
 template <class T>
-int AudioFile<T>::getIndexOfString (std::vector<uint8_t>& source, std::string stringToSearchFor)
+int64_t AudioFile<T>::getIndexOfString (const AudioFileData& source, std::string stringToSearchFor)
 {
-    int index = -1;
-    int stringLength = (int)stringToSearchFor.length();
-    
-    for (size_t i = 0; i < source.size() - stringLength;i++)
-    {
-        std::string section (source.begin() + i, source.begin() + i + stringLength);
-        
-        if (section == stringToSearchFor)
-        {
-            index = static_cast<int> (i);
-            break;
-        }
-    }
+    size_t stringLength = stringToSearchFor.length();
     
-    return index;
-}
-
-//=============================================================
-template <class T>
-int AudioFile<T>::getIndexOfChunk (std::vector<uint8_t>& source, const std::string& chunkHeaderID, int startIndex, Endianness endianness)
-{
-    constexpr int dataLen = 4;
-    if (chunkHeaderID.size() != dataLen)
-    {
-        assert (false && "Invalid chunk header ID string");
+    if (stringLength == 0 || stringLength > source.size())
         return -1;
-    }
-
-    int i = startIndex;
-    while (i < source.size() - dataLen)
+    
+    // compare the bytes in place rather than copying every section into a new string
+    for (size_t i = 0; i + stringLength <= source.size(); i++)
     {
-        if (memcmp (&source[i], chunkHeaderID.data(), dataLen) == 0)
-        {
-            return i;
-        }
-
-        i += dataLen;
-        auto chunkSize = fourBytesToInt (source, i, endianness);
-        i += (dataLen + chunkSize);
+        if (memcmp (&source[i], stringToSearchFor.data(), stringLength) == 0)
+            return static_cast<int64_t> (i);
     }
-
+    
     return -1;
 }
 
@@ -1284,6 +2907,238 @@ void AudioFile<T>::reportError (std::string errorMessage)
         std::cout << errorMessage << std::endl;
 }
 
+//=============================================================
+template <class T>
+bool AudioFileReader<T>::open (std::string filePath)
+{
+    close();
+    
+    if (! codec.readLayout (filePath, layout))
+        return false;
+    
+    if (! file.open (filePath))
+    {
+        codec.reportError ("ERROR: File doesn't exist or otherwise can't load file\n"  + filePath);
+        return false;
+    }
+    
+    if (layout.iXMLChunkSize > 0)
+    {
+        iXMLChunk.resize (layout.iXMLChunkSize);
+        size_t numRead = file.readAt (reinterpret_cast<uint8_t*> (&iXMLChunk[0]), layout.iXMLChunkSize, layout.iXMLChunkStartIndex);
+        iXMLChunk.resize (numRead);
+    }
+    
+    return seek (0);
+}
+
+//=============================================================
+template <class T>
+void AudioFileReader<T>::close()
+{
+    file.close();
+    layout = AudioFileLayout();
+    position = 0;
+    iXMLChunk.clear();
+}
+
+//=============================================================
+template <class T>
+size_t AudioFileReader<T>::read (AudioBuffer& buffer, size_t numFrames)
+{
+    numFrames = readFrames (frameData, numFrames);
+    codec.decodeFrames (frameData.data(), numFrames, layout, buffer);
+    return numFrames;
+}
+
+//=============================================================
+template <class T>
+size_t AudioFileReader<T>::readFrames (std::vector<uint8_t>& frames, size_t numFrames)
+{
+    numFrames = std::min (numFrames, getNumFramesRemaining());
+    size_t numFramesRead = readFramesAt (position, frames, numFrames);
+    
+    // a short read means the file was shorter than its header said, stop at the last whole frame
+    if (numFramesRead < numFrames)
+        layout.numSamplesPerChannel = position + numFramesRead;
+    
+    position += numFramesRead;
+    return numFramesRead;
+}
+
+//=============================================================
+template <class T>
+size_t AudioFileReader<T>::readAt (size_t frame, AudioBuffer& buffer, size_t numFrames)
+{
+    numFrames = readFramesAt (frame, frameData, numFrames);
+    codec.decodeFrames (frameData.data(), numFrames, layout, buffer);
+    return numFrames;
+}
+
+//=============================================================
+template <class T>
+size_t AudioFileReader<T>::readFramesAt (size_t frame, std::vector<uint8_t>& frames, size_t numFrames)
+{
+    if (frame > layout.numSamplesPerChannel)
+        frame = layout.numSamplesPerChannel;
+    
+    numFrames = std::min (numFrames, layout.numSamplesPerChannel - frame);
+    frames.resize (numFrames * layout.numBytesPerFrame);
+    
+    if (numFrames == 0 || ! file.isOpen())
+        return 0;
+    
+    size_t numBytesRead = file.readAt (frames.data(), frames.size(), layout.samplesStartIndex + (uint64_t) frame * layout.numBytesPerFrame);
+    size_t numFramesRead = numBytesRead / layout.numBytesPerFrame;
+    frames.resize (numFramesRead * layout.numBytesPerFrame);
+    return numFramesRead;
+}
+
+//=============================================================
+template <class T>
+bool AudioFileReader<T>::seek (size_t frame)
+{
+    if (! file.isOpen() || frame > layout.numSamplesPerChannel)
+        return false;
+    
+    position = frame;
+    return true;
+}
+
+//=============================================================
+template <class T>
+bool AudioFileWriter<T>::open (std::string filePath, AudioFileFormat format, int numChannels, uint32_t sampleRate, int bitDepth)
+{
+    if (format != AudioFileFormat::Wave && format != AudioFileFormat::Aiff)
+    {
+        close();
+        return false;
+    }
+    
+    return open (filePath, codec.getOutputLayout (format, numChannels, bitDepth, sampleRate));
+}
+
+//=============================================================
+template <class T>
+bool AudioFileWriter<T>::open (std::string filePath, const AudioFileLayout& sampleLayout)
+{
+    close();
+    
+    if (! canWriteLayout (sampleLayout))
+        return false;
+    
+    layout = AudioFileLayout();
+    layout.format = sampleLayout.format;
+    layout.audioFormat = sampleLayout.audioFormat;
+    layout.numChannels = sampleLayout.numChannels;
+    layout.bitDepth = sampleLayout.bitDepth;
+    layout.sampleRate = sampleLayout.sampleRate;
+    layout.bigEndian = sampleLayout.format == AudioFileFormat::Aiff;
+    layout.numBytesPerSample = sampleLayout.bitDepth / 8;
+    layout.numBytesPerFrame = layout.numBytesPerSample * sampleLayout.numChannels;
+    path = filePath;
+    numFramesWritten = 0;
+    failed = false;
+    
+    if (! file.open (filePath))
+    {
+        codec.reportError ("ERROR: couldn't save file to " + filePath);
+        return false;
+    }
+    
+    // the sizes are filled in when the file is closed
+    std::vector<uint8_t> header;
+    return getHeader (header, 0) && file.write (header.data(), header.size());
+}
+
+//=============================================================
+template <class T>
+bool AudioFileWriter<T>::canWriteLayout (const AudioFileLayout& sampleLayout)
+{
+    // the headers that can be written are plain WAV (PCM or float) and uncompressed AIFF
+    bool supportedFormat = sampleLayout.format == AudioFileFormat::Wave
+        ? sampleLayout.audioFormat == WavAudioFormat::PCM || sampleLayout.audioFormat == WavAudioFormat::IEEEFloat
+        : sampleLayout.format == AudioFileFormat::Aiff && sampleLayout.audioFormat == AIFFAudioFormat::Uncompressed;
+    
+    bool supportedBitDepth = sampleLayout.bitDepth == 8 || sampleLayout.bitDepth == 16 || sampleLayout.bitDepth == 24 || sampleLayout.bitDepth == 32;
+    
+    return supportedFormat && supportedBitDepth && sampleLayout.numChannels >= 1;
+}
+
+//=============================================================
+template <class T>
+bool AudioFileWriter<T>::write (const AudioBuffer& buffer, size_t numFrames)
+{
+    frameData.clear();
+    
+    if (! codec.encodeFrames (buffer, 0, numFrames, layout, frameData))
+    {
+        failed = true;
+        return false;
+    }
+    
+    return writeFrames (frameData.data(), numFrames);
+}
+
+//=============================================================
+template <class T>
+bool AudioFileWriter<T>::writeFrames (const uint8_t* frames, size_t numFrames)
+{
+    if (! file.isOpen())
+        return false;
+    
+    if (! file.write (frames, numFrames * layout.numBytesPerFrame))
+        failed = true;
+    
+    numFramesWritten += numFrames;
+    return ! failed;
+}
+
+//=============================================================
+template <class T>
+bool AudioFileWriter<T>::close()
+{
+    if (! file.isOpen())
+        return false;
+    
+    uint32_t iXMLChunkSize = static_cast<uint32_t> (iXMLChunk.size());
+    
+    if (iXMLChunkSize > 0)
+    {
+        std::vector<uint8_t> chunk;
+        codec.addStringToFileData (chunk, "iXML");
+        codec.addInt32ToFileData (chunk, iXMLChunkSize, layout.bigEndian ? AudioFile<T>::Endianness::BigEndian : AudioFile<T>::Endianness::LittleEndian);
+        codec.addStringToFileData (chunk, iXMLChunk);
+        file.write (chunk.data(), chunk.size());
+    }
+    
+    // rewrite the header now that the sizes are known, it is the same length as before
+    std::vector<uint8_t> header;
+    bool complete = getHeader (header, iXMLChunkSize) && file.writeAt (header.data(), header.size(), 0) && ! failed;
+    complete = file.close() && complete;
+    
+    if (! complete)
+        codec.reportError ("ERROR: couldn't save file to " + path);
+    
+    return complete;
+}
+
+//=============================================================
+template <class T>
+bool AudioFileWriter<T>::getHeader (std::vector<uint8_t>& header, uint32_t iXMLChunkSize)
+{
+    // a WAV file's final size isn't known yet, so room is kept for the ds64 chunk it needs if it becomes RF64
+    if (layout.format == AudioFileFormat::Wave)
+        codec.addWaveHeaderToFileData (header, layout, (uint64_t) numFramesWritten * layout.numBytesPerFrame, iXMLChunkSize, true);
+    else if (! codec.addAiffHeaderToFileData (header, layout, numFramesWritten, iXMLChunkSize))
+    {
+        codec.reportError ("ERROR: this file is too large to be saved as AIFF, which is limited to 4 GB\n" + path);
+        return false;
+    }
+    
+    return true;
+}
+
 #if defined (_MSC_VER)
     __pragma(warning (pop))
 #elif defined (__GNUC__)
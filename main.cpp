@@ -4,6 +4,7 @@
 */
 #include "include/raylib.h"
 #include "monoc.h"
+#include "dialogs.h"
 #include <string>
 #include <fstream>
 #include <streambuf>
@@ -73,15 +74,20 @@ class AppState {
 public:
     // Setup the buttons for the GUI
     Button loadButton = { {10, 100}, {150, 50}, false, false, true};
+    Button folderButton = { {10, 50}, {150, 40}, false, false, true};
     Button saveButton = { {10, 170}, {300, 50}, false, false, true};
     Button processButton = { {10, 300}, {150, 50}, false, false, false};
     Button resetButton = {  {300, 0}, {100, 25}, false, false, true};
+    Button toleranceButton = { {170, 310}, {220, 30}, false, false, true};
     
 
     // Data for the app
     vector<string> files; // Stores audio files from file picker
+    vector<string> folders; // Stores folders from folder picker, processed with their subfolders
     string savePath; // Stores save path from folder picker
+    ProcessOptions options; // Settings for the next run, such as the tolerance policy
     int numFake = -1; // Number of fakes found after the process completes.
+    string error; // Why the last process couldn't start, shown until the app is reset
     bool closingApp = false;
     bool processing = false;
 };
@@ -95,9 +101,11 @@ int buttonThread(AppState& state) {
 
         // Handle mouse and button interactions.
         state.loadButton = handleMouse(state.loadButton);
+        state.folderButton = handleMouse(state.folderButton);
         state.saveButton = handleMouse(state.saveButton);
         state.processButton = handleMouse(state.processButton);
         state.resetButton = handleMouse(state.resetButton);
+        state.toleranceButton = handleMouse(state.toleranceButton);
 
         // Handle when load button is clicked.
         if (state.loadButton.clicked) {
@@ -106,6 +114,14 @@ int buttonThread(AppState& state) {
             state.loadButton.enabled = state.files.empty();
         }
 
+        // Handle when folder button is clicked. More folders can be added until the app is reset.
+        if (state.folderButton.clicked) {
+            string folder = showFolderDialog();
+            if (!folder.empty()) {
+                state.folders.push_back(folder);
+            }
+        }
+
         // Handle when save button is clicked.
         if (state.saveButton.clicked) {
             state.savePath = showSaveDialog();
@@ -113,15 +129,29 @@ int buttonThread(AppState& state) {
             state.saveButton.enabled = state.savePath.empty();
         }
 
-        // When files and a save path have been chosen, enable processing option.
-        if (state.files.size() > 0 && state.savePath.empty() == false && !state.loadButton.enabled && !state.saveButton.enabled) {
+        // Cycle through the tolerance policies when the tolerance button is clicked.
+        if (state.toleranceButton.clicked) {
+            state.options.tolerance = (TolerancePolicy)((state.options.tolerance + 1) % (RelativeToRms + 1));
+        }
+
+        // When files or folders and a save path have been chosen, enable processing option.
+        if ((state.files.size() > 0 || state.folders.size() > 0) && state.savePath.empty() == false && !state.saveButton.enabled) {
             state.processButton.enabled = true;
         }
         // Process all files if process button clicked
         if (state.processButton.clicked) {
             state.processButton.enabled = false;
+            // Files saved into a chosen folder would be found by the walk and processed again, so it's never walked
+            for (const string &folder : state.folders) {
+                if (isSameFolder(folder, state.savePath)) {
+                    state.error = "The save folder can't be a chosen folder. Reset to pick again.";
+                }
+            }
+        }
+        if (state.processButton.clicked && state.error.empty()) {
             state.processing = true;
-            state.numFake = processAll(state.files, state.savePath);
+            state.numFake = processAll(state.files, state.savePath, state.options);
+            state.numFake += processFolders(state.folders, state.savePath, state.options);
             state.processing = false;
         }
 
@@ -131,7 +161,9 @@ int buttonThread(AppState& state) {
             state.saveButton.enabled = true;
             state.loadButton.enabled = true;
             state.numFake = -1;
+            state.error = "";
             state.files.clear();
+            state.folders.clear();
             state.savePath = "";
         }
         if (state.closingApp) {
@@ -176,10 +208,19 @@ int main(void) {
             string msg = "Files chosen: " + std::to_string(state.files.size());
             DrawText(msg.c_str(), 200, 105, 24, BLACK);
         }
+        // Display message for number of folders chosen.
+        if (state.folders.size() > 0) {
+            string msg = "Folders chosen: " + std::to_string(state.folders.size());
+            DrawText(msg.c_str(), 200, 58, 24, BLACK);
+        }
         // Display message for save directory chosen.
         if (state.savePath.empty() == false) {
             DrawText(state.savePath.c_str(), 10, 250, 12, BLACK);
         }
+        // Display why processing couldn't start
+        if (!state.error.empty()) {
+            DrawText(state.error.c_str(), 10, 355, 12, RED);
+        }
         // Display message for number of fake files found
         if (state.numFake > -1) {
             string msg = std::to_string(state.numFake) + " fake stereo files converted to mono.";
@@ -188,9 +229,11 @@ int main(void) {
         // Draw main UI components.
         DrawText("Mono Catcher", 15, 15, 20, BLACK);
         drawButton(state.loadButton, "Load files...");
+        drawButton(state.folderButton, "Load folder...");
         drawButton(state.saveButton, "Choose Save Folder...");
         drawButton(state.processButton, "Process!");
         drawButton(state.resetButton, "Reset");
+        drawButton(state.toleranceButton, "Match: " + describeTolerance(state.options));
         
         // Draw a little label for when it's processing.
         if (state.processing) {
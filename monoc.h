@@ -1,7 +1,24 @@
 #pragma once
 #include "include/AudioFile.h"
-//#include "include/pfd.h"
-#include "include/tinyfiledialogs.h"
+#include "cache.h"
+#include "compare.h"
+#include "extract.h"
+#include "channels.h"
+#include "fft.h"
+#include "timeline.h"
+#include "pool.h"
+#include "walk.h"
+#include "watch.h"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <condition_variable>
+#include <fstream>
+#include <functional>
+#include <mutex>
+#include <set>
+#include <sstream>
 #include <string>
 // Degree of accuracy for comparing floats
 const double EPSILON = 0.0001;
@@ -10,17 +27,262 @@ using std::string;
 
 // A result for processing an audio file.
 enum AudioResult {
-    Stereo, // When audio file is true stereo
-    FakeStereo, // When audio file is 'fake' stereo
-    Mono // When audio file is mono
+    Stereo, // When audio file is true stereo, or no channel of a multichannel file is a copy of another
+    FakeStereo, // When audio file is 'fake' stereo, or every channel of a multichannel file is the same
+    Mono, // When audio file is mono
+    DuplicateChannels, // When some channels of a multichannel file are copies of others
+    ScaledMono, // When the right channel is the left one times a constant gain, such as inverted or panned mono
+    OffsetMono, // When one channel is the other one delayed by a number of frames
+    MostlyMono // When enough of a stereo file's timeline is mono for options.mostlyMonoShare
 };
 
+// How the left and right channels are compared.
+enum DetectionMode {
+    Tolerant, // Decode to float and compare with the options' TolerancePolicy
+    BitExact // Compare the raw sample bytes straight from the file data
+};
+
+// When two decoded samples count as the same in Tolerant mode.
+enum TolerancePolicy {
+    ExactBits, // The floats are the same bit pattern
+    UlpDistance, // The floats are at most toleranceUlps representable floats apart
+    AbsoluteDb, // The difference is at most toleranceDb dBFS, -80 dBFS is the old EPSILON
+    RelativeToRms // The difference is at most toleranceDb dB below the RMS of the samples being compared
+};
+
+// Settings for processing audio files.
+struct ProcessOptions {
+    DetectionMode mode = Tolerant;
+    TolerancePolicy tolerance = AbsoluteDb;
+    double toleranceDb = -80; // Largest difference for AbsoluteDb, in dBFS, and for RelativeToRms, in dB relative to the RMS
+    int toleranceUlps = 4; // Largest distance for UlpDistance, in floats
+    size_t blockFrames = 65536; // Number of frames read at a time when streaming a file
+    unsigned numThreads = 0; // Number of files processed at once by processAll, 0 for one per hardware thread
+    unsigned numWalkThreads = 0; // Number of folders listed at once by processFolders, 0 for one per hardware thread
+    size_t memoryBudget = (size_t)2 << 30; // Bytes of file data allowed in memory at once, 0 for no limit
+    bool skipMono = false; // Leave files that are already mono out of the save folder instead of copying them
+    bool detectScaled = true; // In Tolerant mode, also look for a right channel that is the left one times a gain
+    double scaledTolerance = 1e-6; // Largest share of the right channel's energy a gain may leave unexplained for ScaledMono
+    double gainTolerance = 0.001; // A gain this close to 1 or -1 is taken as identical or inverted, and rounded to it
+    bool collapseScaled = false; // Save ScaledMono files as one channel, instead of copying them as they are
+    bool detectOffset = true; // Also look for a channel that is the other one delayed
+    size_t maxOffset = 4096; // Longest delay between the channels detectOffset looks for, in frames
+    bool collapseOffset = false; // Save OffsetMono files as their leading channel, instead of copying them as they are
+    size_t numProbes = 8; // Blocks spread from the start to the end of a stereo file compared before reading all of it, 0 for none
+    size_t probeFrames = 1024; // Frames in each probe
+    size_t timelineWindow = 0; // Frames per window of a stereo file's mono, stereo and silent timeline, 0 for no timeline
+    double mostlyMonoShare = 0; // Save a stereo file as mono when this share of its audible timeline is mono, 0 to never do so
+    bool measureDifferences = false; // In Tolerant mode, read the whole of a stereo file to measure how much its channels differ
+    string reportPath; // Where processAll writes a report of every file it processed, empty for none. See reportFormatFor.
+    bool dryRun = false; // Analyze and report every file, but save nothing
+    bool cacheContentHash = false; // With a ResultCache, also hash each file's contents, to catch changes that kept its size and time
+};
+
+// What analyzeStream found out about the channels of a file.
+struct ChannelAnalysis {
+    AudioResult result = Stereo;
+    vector<int> groups; // The group of identical channels each channel is in, numbered from 0 in order
+    double gain = 1; // For ScaledMono, the right channel is the left one times this
+    int64_t offset = 0; // For OffsetMono, the right channel is the left one delayed by this many frames, or ahead if negative
+    Timeline timeline; // For stereo files with options.timelineWindow, which windows are mono, stereo and silent
+    bool measured = false; // Whether differences were measured, for stereo files with options.measureDifferences
+    DifferenceStats differences; // How much the left and right channels differ over the whole file
+};
+
+// What happened to one file while it was processed, for reports.
+struct FileReport {
+    AudioResult result = Stereo;
+    AudioFileLayout layout; // The file's header, with no channels if it couldn't be read
+    ChannelAnalysis analysis;
+    uint64_t savableBytes = 0; // Bytes of sample data saving the file with fewer channels leaves out, 0 if it keeps them all
+    bool cached = false; // Whether the analysis came from a ResultCache
+    double probeSeconds = 0; // Reading the header
+    double analyzeSeconds = 0; // Comparing the channels, or looking the file up in the cache
+    double saveSeconds = 0; // Saving the file, 0 in a dry run
+};
+
+/**
+ * Returns the name of a result, as written in reports.
+ */
+const char *resultName(AudioResult result) {
+    switch (result) {
+        case Stereo: return "Stereo";
+        case FakeStereo: return "FakeStereo";
+        case Mono: return "Mono";
+        case DuplicateChannels: return "DuplicateChannels";
+        case ScaledMono: return "ScaledMono";
+        case OffsetMono: return "OffsetMono";
+        default: return "MostlyMono";
+    }
+}
+
+/**
+ * Compares blocks of decoded samples with the TolerancePolicy of a run.
+ * The kernel for the policy is picked once, so the policy costs nothing per sample.
+ * Silence is anything within getSilenceThreshold of zero: the AbsoluteDb threshold, the denormals within
+ * toleranceUlps floats of zero for UlpDistance, and exactly zero for the other two, since a block can't be
+ * quiet relative to its own RMS.
+ */
+class SampleComparer {
+public:
+    explicit SampleComparer(const ProcessOptions &options) {
+        relative = options.tolerance == RelativeToRms;
+        switch (options.tolerance) {
+            case ExactBits:
+                kernel = getCompareKernel(SampleMatch::ExactBits);
+                differ = getDifferenceKernel(SampleMatch::ExactBits);
+                threshold = 0;
+                silenceThreshold = 0;
+                break;
+            case UlpDistance: {
+                kernel = getCompareKernel(SampleMatch::Ulps);
+                differ = getDifferenceKernel(SampleMatch::Ulps);
+                int32_t ulps = std::max(options.toleranceUlps, 0);
+                threshold = (float)ulps;
+                // Floats next to zero are evenly spaced, so the one with the bits of the distance is that many floats from it
+                memcpy(&silenceThreshold, &ulps, sizeof(silenceThreshold));
+                break;
+            }
+            case RelativeToRms:
+                kernel = getCompareKernel();
+                differ = getDifferenceKernel();
+                ratio = std::pow(10.0, options.toleranceDb / 20);
+                threshold = 0;
+                silenceThreshold = 0;
+                break;
+            default:
+                kernel = getCompareKernel();
+                differ = getDifferenceKernel();
+                threshold = toleranceThreshold(std::pow(10.0, options.toleranceDb / 20));
+                silenceThreshold = threshold;
+        }
+    }
+
+    /**
+     * Returns the index of the first pair of samples that don't match, or count if they all do.
+     */
+    size_t findMismatch(const float *left, const float *right, size_t count) const {
+        return kernel(left, right, count, thresholdFor(left, right, count));
+    }
+
+    /**
+     * Returns true if every pair of count samples match.
+     */
+    bool matches(const float *left, const float *right, size_t count) const {
+        return findMismatch(left, right, count) == count;
+    }
+
+    /**
+     * Adds count pairs of samples to stats, counting the ones that don't match in the same pass.
+     */
+    void measure(const float *left, const float *right, size_t count, DifferenceStats &stats) const {
+        differ(left, right, count, thresholdFor(left, right, count), stats);
+    }
+
+    /**
+     * Returns the largest magnitude a sample can have and still be silent.
+     */
+    float getSilenceThreshold() const {
+        return silenceThreshold;
+    }
+
+private:
+    /**
+     * Returns the kernel threshold for comparing a block. Only RelativeToRms depends on the block,
+     * which costs it one correlation kernel pass over the block to find the RMS.
+     */
+    float thresholdFor(const float *left, const float *right, size_t count) const {
+        if (!relative || count == 0) {
+            return threshold;
+        }
+        ChannelSums sums;
+        getCorrelationKernel()(left, right, count, sums);
+        double rms = std::sqrt((sums.leftSquares + sums.rightSquares) / (2.0 * count));
+        return (float)(rms * ratio);
+    }
+
+    CompareKernel kernel;
+    DifferenceKernel differ;
+    float threshold;
+    float silenceThreshold;
+    bool relative;
+    double ratio = 0;
+};
+
+/**
+ * Returns a short description of how a run compares channels, for reports and the GUI.
+ */
+string describeTolerance(const ProcessOptions &options) {
+    if (options.mode == BitExact) {
+        return "raw sample bytes";
+    }
+    std::ostringstream text;
+    switch (options.tolerance) {
+        case ExactBits: text << "exact bits"; break;
+        case UlpDistance: text << options.toleranceUlps << " ULPs"; break;
+        case RelativeToRms: text << options.toleranceDb << " dB of RMS"; break;
+        default: text << options.toleranceDb << " dBFS";
+    }
+    return text.str();
+}
+
+/**
+ * Returns a hash of the options that can change what analyzing a file finds, so a cached analysis
+ * is only used by runs with the same settings.
+ */
+uint64_t settingsHash(const ProcessOptions &options) {
+    std::ostringstream text;
+    text << options.mode << " " << options.tolerance << " " << options.toleranceDb << " " << options.toleranceUlps << " "
+         << options.blockFrames << " " << options.detectScaled << " " << options.scaledTolerance << " " << options.gainTolerance << " "
+         << options.detectOffset << " " << options.maxOffset << " " << options.measureDifferences;
+    string settings = text.str();
+    return hashBytes(settings.data(), settings.size());
+}
+
+/**
+ * Looks up a file's analysis in a cache. Returns true, and sets analysis, if it was found.
+ */
+bool lookupAnalysis(ResultCache &cache, const FileKey &key, uint64_t contentHash, ChannelAnalysis &analysis) {
+    CachedAnalysis cached;
+    if (!cache.lookup(key, contentHash, cached)) {
+        return false;
+    }
+    analysis.result = (AudioResult)cached.result;
+    analysis.groups.assign(cached.groups, cached.groups + cached.numChannels);
+    analysis.gain = cached.gain;
+    analysis.offset = cached.offset;
+    analysis.measured = cached.measured != 0;
+    analysis.differences = cached.differences;
+    return true;
+}
+
+/**
+ * Stores a file's analysis in a cache. Files with too many channels or too long a path for an entry aren't stored.
+ */
+void storeAnalysis(ResultCache &cache, const FileKey &key, const string &file, uint64_t contentHash, const ChannelAnalysis &analysis) {
+    if (analysis.groups.size() > (size_t)MaxCachedChannels) {
+        return;
+    }
+    CachedAnalysis cached;
+    cached.contentHash = contentHash;
+    cached.result = analysis.result;
+    cached.numChannels = (int32_t)analysis.groups.size();
+    for (size_t channel = 0; channel < analysis.groups.size(); channel++) {
+        cached.groups[channel] = (int8_t)analysis.groups[channel];
+    }
+    cached.measured = analysis.measured ? 1 : 0;
+    cached.gain = analysis.gain;
+    cached.offset = analysis.offset;
+    cached.differences = analysis.differences;
+    cache.store(key, file, cached);
+}
+
 /**
  * Returns true is float a and float b are sufficiently close in value.
  * EPSILON constant defines the maximum difference between the two.
  */
 bool compareFloat(float a, float b) {
-    return abs(a - b) < EPSILON;
+    return std::abs(a - b) < EPSILON;
 }
 
 /**
@@ -29,74 +291,823 @@ bool compareFloat(float a, float b) {
  * Returns 'Stereo' if buffer is found to be actually stereo.
  * Returns 'FakeStereo' if buffer is found to have sufficiently identical stereo channels.
  */
-AudioResult isRealStereo(AudioFile<float> *w) {
+AudioResult isRealStereo(AudioFile<float> *w, const ProcessOptions &options = ProcessOptions()) {
     // Check if already mono
     if (w->isMono()) {
         return Mono;
     }
-    // Default the result
-    AudioResult result = FakeStereo;
-    
-    // Go through every sample in the buffer
-    for (int i = 0; i < w->getNumSamplesPerChannel(); i++) {
-        // Take one sample from left buffer
-        double leftSample = w->samples[0][i];
-        // Take one sample from right buffer
-        double rightSample = w->samples[1][i];
-        // Compare the two
-        if (!compareFloat(leftSample, rightSample)) {
-            // If the two samples do not match, set the result to stereo and break from the loop.
-            result = Stereo;
+    // Find the first sample where the left and right buffers differ, a whole block at a time
+    size_t numSamples = (size_t)w->getNumSamplesPerChannel();
+    size_t mismatch = SampleComparer(options).findMismatch(w->samples[0].data(), w->samples[1].data(), numSamples);
+
+    // If every sample matched, the channels are the same
+    return mismatch == numSamples ? FakeStereo : Stereo;
+}
+
+/**
+ * Reads just the header of an audio file into layout: its format, channels, bit depth, sample rate and data size.
+ * None of the sample data is read, so this is cheap enough to run on every file of a large library.
+ * Returns false if the file's header couldn't be read.
+ */
+bool probeFile(string file, AudioFileLayout &layout) {
+    AudioFile<float> codec;
+    return codec.readLayout(file, layout);
+}
+
+/**
+ * Streams the sample data of a file with more than two channels in fixed-size blocks to find the channels
+ * that are copies of others, comparing their sample bytes. Reading stops once every channel has differed
+ * from every other. Sets groups to the group of identical channels each channel is in.
+ */
+AudioResult analyzeChannels(AudioFileReader<float> &reader, const ProcessOptions &options, vector<int> &groups) {
+    const AudioFileLayout &layout = reader.getLayout();
+    ChannelGroups channelGroups(layout.numChannels);
+    vector<uint8_t> block;
+    while (!channelGroups.allDistinct()) {
+        size_t numFrames = reader.readFrames(block, options.blockFrames);
+        if (numFrames == 0) {
             break;
         }
+        channelGroups.addFrames(block.data(), numFrames, layout.numBytesPerSample, layout.numBytesPerFrame);
     }
-    
-    return result;
+    groups = channelGroups.getGroups();
+    if (channelGroups.allDistinct()) {
+        return Stereo;
+    }
+    return channelGroups.getNumGroups() == 1 ? FakeStereo : DuplicateChannels;
 }
 
 /**
- * Opens an Open File Dialog and returns a list of file paths selected.
- */ 
-vector<string> showOpenDialog() {
-    /*auto selection = pfd::open_file("Select a file", ".",
-                                { "Wave Files", "*.wav" },
-                                pfd::opt::multiselect).result();*/
-    vector<string> selection;
-    char const * filter[3] = {"*.wav", "*.aiff", "*.aif"};
-    auto result = tinyfd_openFileDialog("Select Audio File(s)", "", 3, filter, "Audio Files", 1);
-
-    if (result != NULL) {
-        string str_result(result);
-        str_result += "|";
-        auto del_index = str_result.find("|");
-
-        
-            do {
-                
-                auto one_file = str_result.substr(0, del_index);
-                selection.push_back(one_file);
-                printf("%s\n", one_file.c_str());
-                str_result = str_result.substr(del_index+1, str_result.length());
-                del_index = str_result.find("|");
-                
-            } while(del_index != std::string::npos);
-        
-        
-    }
-    return selection;
-}
-
-/**
- * Opens a Choose Folder Dialog and returns the path of the folder chosen.
- */
-string showSaveDialog() {
-    //string selection = pfd::select_folder("Select a folder to save.").result();
-    auto result = tinyfd_selectFolderDialog("Select a folder to save.", "");
-    if (result != NULL) {
-        return string(result);
+ * Keeps the sums for fitting right = gain * left over a stereo file as it streams past,
+ * and says whether the fit can still come out close enough for ScaledMono.
+ */
+class ScaledMonoFit {
+public:
+    ScaledMonoFit(const ProcessOptions &options, size_t numFrames)
+        : tolerance(options.scaledTolerance), gainTolerance(options.gainTolerance), framesLeft(numFrames) {}
+
+    /**
+     * Adds a block of decoded samples. Returns false once no gain can fit the whole file within the tolerance.
+     */
+    bool add(const float *left, const float *right, size_t numFrames) {
+        getCorrelationKernel()(left, right, numFrames, sums);
+        framesLeft -= std::min(framesLeft, numFrames);
+        // Whatever gain fits the whole file leaves at least this block's residual unexplained, and the
+        // right channel can't gain more energy than a full scale sample per frame still to come
+        return fitResidual(sums) <= tolerance * (sums.rightSquares + (double)framesLeft);
+    }
+
+    /**
+     * Returns true if scaling the left channel explains the right one within the tolerance.
+     * A silent channel doesn't count, there's no gain to find.
+     */
+    bool fits() const {
+        return sums.leftSquares > 0 && sums.rightSquares > 0 && fitResidual(sums) <= tolerance * sums.rightSquares;
+    }
+
+    /**
+     * Returns the best fitting gain, rounded to exactly 1 or -1 when it is within gainTolerance of them.
+     */
+    double gain() const {
+        double g = fitGain(sums);
+        if (std::fabs(g - 1) <= gainTolerance) {
+            return 1;
+        }
+        if (std::fabs(g + 1) <= gainTolerance) {
+            return -1;
+        }
+        return g;
+    }
+
+private:
+    ChannelSums sums;
+    double tolerance;
+    double gainTolerance;
+    size_t framesLeft;
+};
+
+/**
+ * Checks, a block at a time, that one channel of a stereo file is the other one delayed by a fixed number of samples.
+ * The samples can be decoded floats or raw bytes, they're only ever compared in whole runs.
+ * The delayed channel's first samples have nothing to match, so they have to be silent.
+ */
+template <class S>
+class DelayCheck {
+public:
+    explicit DelayCheck(size_t delay) : delay(delay) {}
+
+    /**
+     * Adds count samples of the leading and delayed channels. same(a, b, n) says whether n samples match
+     * and silent(a, n) whether n samples are silence. Returns false once the channels don't match.
+     */
+    template <class Same, class Silent>
+    bool add(const S *leading, const S *delayed, size_t count, Same same, Silent silent) {
+        history.insert(history.end(), leading, leading + count);
+        size_t head = 0;
+        if (checked < delay) {
+            head = std::min(count, delay - checked);
+            if (!silent(delayed, head)) {
+                return false;
+            }
+        }
+        bool matched = head == count || same(history.data() + (checked + head - delay - historyStart), delayed + head, count - head);
+        checked += count;
+        // Only keep the leading samples that the next block's delayed samples are still to be matched with
+        if (checked > delay) {
+            size_t drop = checked - delay - historyStart;
+            history.erase(history.begin(), history.begin() + drop);
+            historyStart += drop;
+        }
+        return matched;
+    }
+
+private:
+    size_t delay;
+    size_t checked = 0; // Samples of the delayed channel checked so far
+    size_t historyStart = 0; // Which sample of the leading channel history starts at
+    std::vector<S> history;
+};
+
+/**
+ * Looks for how far one channel of a stereo file lags the other, from the cross-correlation of a window of them.
+ * The window starts at the first sound in the file. Both channels are decimated, by summing a few samples
+ * at a time, so the FFT that correlates them is small. Then each lag near the peak is checked sample by sample
+ * across the window. Reads from the reader's current position.
+ * Returns the first lag that matched (positive when the right channel is late), or 0 if none did.
+ */
+int64_t findOffset(AudioFileReader<float> &reader, const ProcessOptions &options) {
+    const size_t windowFrames = 32768;
+    const size_t decimation = 4;
+    SampleComparer comparer(options);
+    float silence = comparer.getSilenceThreshold();
+    size_t maxLag = std::min(options.maxOffset, windowFrames / 2);
+    AudioFileReader<float>::AudioBuffer samples;
+
+    // Find the first frame with any sound in it, reading a little at a time since it is usually near the start
+    const size_t scanFrames = 4096;
+    size_t start = 0;
+    bool found = false;
+    while (!found) {
+        size_t numFrames = reader.read(samples, scanFrames);
+        if (numFrames == 0) {
+            return 0;
+        }
+        size_t i = 0;
+        while (i < numFrames && std::fabs(samples[0][i]) <= silence && std::fabs(samples[1][i]) <= silence) {
+            i++;
+        }
+        found = i < numFrames;
+        start += i;
+        // The delayed channel is silent until the leading one has been going for a while, but it only has to match
+        // silence within the tolerance, so it is within twice the silence threshold of 0. Both channels sounding at once rules
+        // a delay out. With RelativeToRms the tolerance isn't the silence threshold, so there's no such bound.
+        if (found && options.tolerance != RelativeToRms && std::fabs(samples[0][i]) > 2 * silence && std::fabs(samples[1][i]) > 2 * silence) {
+            return 0;
+        }
+    }
+    reader.seek(start);
+    size_t window = reader.read(samples, windowFrames + maxLag);
+    size_t numDecimated = window / decimation;
+    if (numDecimated < 2) {
+        return 0;
+    }
+
+    // Correlate the decimated channels. The padding to twice the length keeps the circular correlation from wrapping.
+    size_t fftSize = 16;
+    while (fftSize < 2 * numDecimated) {
+        fftSize *= 2;
+    }
+    vector<float> left(fftSize, 0.0f), right(fftSize, 0.0f);
+    for (size_t i = 0; i < numDecimated * decimation; i++) {
+        left[i / decimation] += samples[0][i];
+        right[i / decimation] += samples[1][i];
+    }
+    RealFFT fft(fftSize);
+    size_t numBins = fftSize / 2 + 1;
+    vector<float> leftRe(numBins), leftIm(numBins), rightRe(numBins), rightIm(numBins);
+    fft.forward(left.data(), leftRe.data(), leftIm.data());
+    fft.forward(right.data(), rightRe.data(), rightIm.data());
+    // conj(L) * R transforms back to sum(left[n] * right[n + lag]), with negative lags at the end
+    for (size_t k = 0; k < numBins; k++) {
+        float re = leftRe[k] * rightRe[k] + leftIm[k] * rightIm[k];
+        float im = leftRe[k] * rightIm[k] - leftIm[k] * rightRe[k];
+        leftRe[k] = re;
+        leftIm[k] = im;
+    }
+    vector<float> correlation(fftSize);
+    fft.inverse(leftRe.data(), leftIm.data(), correlation.data());
+    int64_t maxDecimatedLag = (int64_t)(maxLag / decimation) + 1;
+    int64_t peak = 0;
+    float peakValue = correlation[0];
+    for (int64_t lag = -maxDecimatedLag; lag <= maxDecimatedLag; lag++) {
+        float value = correlation[lag < 0 ? fftSize + lag : lag];
+        if (value > peakValue) {
+            peak = lag;
+            peakValue = value;
+        }
+    }
+
+    // The true lag is within a decimation step of the peak, try the closest first
+    for (int64_t step = 0; step <= (int64_t)decimation; step++) {
+        for (int sign = 1; sign >= -1; sign -= 2) {
+            int64_t lag = peak * (int64_t)decimation + sign * step;
+            size_t distance = (size_t)(lag < 0 ? -lag : lag);
+            if (lag == 0 || distance > maxLag || distance >= window) {
+                continue;
+            }
+            const float *leading = samples[lag > 0 ? 0 : 1].data();
+            const float *delayed = samples[lag > 0 ? 1 : 0].data() + distance;
+            if (comparer.matches(leading, delayed, window - distance)) {
+                return lag;
+            }
+        }
+    }
+    return 0;
+}
+
+/**
+ * Streams a whole stereo file to check that one channel is the other one delayed by offset frames,
+ * the right one if offset is positive. The frames of the delayed channel before the leading one starts have
+ * to be silent. Compares with the options' TolerancePolicy in Tolerant mode and the raw sample bytes in BitExact mode.
+ */
+bool verifyOffset(AudioFileReader<float> &reader, const AudioFileLayout &layout, int64_t offset, const ProcessOptions &options) {
+    if (!reader.seek(0)) {
+        return false;
+    }
+    int leading = offset > 0 ? 0 : 1;
+    size_t delay = (size_t)(offset > 0 ? offset : -offset);
+    if (options.mode == BitExact) {
+        // 8-bit WAV samples are unsigned, so their silence is 0x80
+        uint8_t silence = layout.format == AudioFileFormat::Wave && layout.numBytesPerSample == 1 ? 0x80 : 0x00;
+        int numBytesPerSample = layout.numBytesPerSample;
+        DelayCheck<uint8_t> check(delay * numBytesPerSample);
+        vector<uint8_t> frames;
+        vector<uint8_t> leadingSamples(options.blockFrames * numBytesPerSample), delayedSamples(options.blockFrames * numBytesPerSample);
+        while (size_t numFrames = reader.readFrames(frames, options.blockFrames)) {
+            extractChannels(frames.data(), numFrames, numBytesPerSample, layout.numBytesPerFrame, vector<int>(1, leading), leadingSamples.data());
+            extractChannels(frames.data(), numFrames, numBytesPerSample, layout.numBytesPerFrame, vector<int>(1, 1 - leading), delayedSamples.data());
+            bool matched = check.add(leadingSamples.data(), delayedSamples.data(), numFrames * numBytesPerSample,
+                [](const uint8_t *a, const uint8_t *b, size_t n) { return memcmp(a, b, n) == 0; },
+                [silence](const uint8_t *a, size_t n) { return std::all_of(a, a + n, [silence](uint8_t x) { return x == silence; }); });
+            if (!matched) {
+                return false;
+            }
+        }
+        return true;
+    }
+    SampleComparer comparer(options);
+    float silence = comparer.getSilenceThreshold();
+    DelayCheck<float> check(delay);
+    AudioFileReader<float>::AudioBuffer samples;
+    while (size_t numFrames = reader.read(samples, options.blockFrames)) {
+        bool matched = check.add(samples[leading].data(), samples[1 - leading].data(), numFrames,
+            [&](const float *a, const float *b, size_t n) { return comparer.matches(a, b, n); },
+            [&](const float *a, size_t n) { return std::all_of(a, a + n, [&](float x) { return std::fabs(x) <= silence; }); });
+        if (!matched) {
+            return false;
+        }
+    }
+    return true;
+}
+
+/**
+ * Reads a stereo file again from its start, and checks that every right sample is the left one times gain,
+ * compared with the options' TolerancePolicy. The energy of a fit can't tell a few loud differences from
+ * many quiet ones, so a gain that fits has to pass this too before the file is ScaledMono.
+ */
+bool verifyGain(AudioFileReader<float> &reader, double gain, const ProcessOptions &options) {
+    if (!reader.seek(0)) {
+        return false;
+    }
+    SampleComparer comparer(options);
+    AudioFileReader<float>::AudioBuffer samples;
+    vector<float> scaled;
+    while (size_t numFrames = reader.read(samples, options.blockFrames)) {
+        const float *left = samples[0].data();
+        scaled.resize(numFrames);
+        for (size_t i = 0; i < numFrames; i++) {
+            scaled[i] = (float)(gain * left[i]);
+        }
+        if (!comparer.matches(scaled.data(), samples[1].data(), numFrames)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+/**
+ * Sorts the windows of a stereo file into mono, stereo and silent ones as its blocks stream past,
+ * and adds them to a timeline. Windows can span blocks, so any window size works with any block size.
+ * Decoded samples are compared with the options' TolerancePolicy, raw frames byte for byte.
+ */
+class WindowClassifier {
+public:
+    WindowClassifier(const AudioFileLayout &layout, const ProcessOptions &options)
+        : layout(layout), window(options.timelineWindow), comparer(options) {}
+
+    /**
+     * Adds a block of decoded samples.
+     */
+    void addSamples(const float *left, const float *right, size_t numFrames) {
+        CompareKernel compare = getCompareKernel();
+        float silence = comparer.getSilenceThreshold();
+        if (zeros.size() < window) {
+            zeros.assign(window, 0.0f);
+        }
+        addWindows(numFrames, [&](size_t start, size_t count) {
+            if (!differs) {
+                differs = !comparer.matches(left + start, right + start, count);
+            }
+            if (!audible) {
+                audible = compare(left + start, zeros.data(), count, silence) != count
+                    || compare(right + start, zeros.data(), count, silence) != count;
+            }
+        });
+    }
+
+    /**
+     * Adds a block of raw frames.
+     */
+    void addFrames(const uint8_t *frames, size_t numFrames) {
+        FrameCompareKernel compare = getFrameCompareKernel();
+        size_t windowBytes = window * layout.numBytesPerFrame;
+        if (silence.size() < windowBytes) {
+            // 8-bit WAV samples are unsigned, so their silence is 0x80
+            bool unsignedSamples = layout.format == AudioFileFormat::Wave && layout.numBytesPerSample == 1;
+            silence.assign(windowBytes, unsignedSamples ? 0x80 : 0x00);
+        }
+        addWindows(numFrames, [&](size_t start, size_t count) {
+            const uint8_t *first = frames + start * layout.numBytesPerFrame;
+            if (!differs) {
+                differs = compare(first, count, layout.numBytesPerSample, layout.numBytesPerFrame) != count;
+            }
+            if (!audible) {
+                audible = memcmp(first, silence.data(), count * layout.numBytesPerFrame) != 0;
+            }
+        });
+    }
+
+    /**
+     * Adds the last window, if the file didn't end on a whole one, and returns the timeline.
+     */
+    const Timeline &finish() {
+        endWindow();
+        return timeline;
+    }
+
+private:
+    /**
+     * Splits numFrames frames into the pieces that fall in each window, calls classify(start, count)
+     * on each piece, and ends every window that fills up.
+     */
+    template <class Classify>
+    void addWindows(size_t numFrames, Classify classify) {
+        size_t done = 0;
+        while (done < numFrames) {
+            size_t count = std::min(numFrames - done, window - framesInWindow);
+            classify(done, count);
+            framesInWindow += count;
+            done += count;
+            if (framesInWindow == window) {
+                endWindow();
+            }
+        }
+    }
+
+    void endWindow() {
+        RegionKind kind = !audible ? RegionKind::Silent : (differs ? RegionKind::Stereo : RegionKind::Mono);
+        timeline.add(kind, framesInWindow);
+        framesInWindow = 0;
+        differs = false;
+        audible = false;
+    }
+
+    const AudioFileLayout &layout;
+    size_t window;
+    SampleComparer comparer;
+    Timeline timeline;
+    size_t framesInWindow = 0;
+    bool differs = false; // Whether the current window has a frame whose channels differ
+    bool audible = false; // Whether the current window has a sample that isn't silent
+    vector<float> zeros;
+    vector<uint8_t> silence;
+};
+
+/**
+ * Compares options.numProbes blocks of a stereo file, spread evenly from its first frame to its last, reading each
+ * from where it is without reading the frames in between. Sets identical to false if the channels differ in any
+ * probe, and scaled to false if the probes alone rule out ScaledMono. Probes can only prove that the channels
+ * differ, a file whose probes all match still has to be read in full to know it is fake stereo.
+ */
+void probeStereo(AudioFileReader<float> &reader, const ProcessOptions &options, bool &identical, bool &scaled) {
+    const AudioFileLayout &layout = reader.getLayout();
+    size_t numFrames = layout.numSamplesPerChannel;
+    size_t length = std::min(options.probeFrames, numFrames);
+    SampleComparer comparer(options);
+    ScaledMonoFit fit(options, numFrames);
+    vector<uint8_t> block;
+    AudioFileReader<float>::AudioBuffer samples;
+    for (size_t probe = 0; probe < options.numProbes && (identical || scaled); probe++) {
+        size_t start = options.numProbes > 1 ? (numFrames - length) * probe / (options.numProbes - 1) : 0;
+        if (options.mode == BitExact) {
+            size_t numRead = reader.readFramesAt(start, block, length);
+            identical = getFrameCompareKernel()(block.data(), numRead, layout.numBytesPerSample, layout.numBytesPerFrame) == numRead;
+        } else {
+            size_t numRead = reader.readAt(start, samples, length);
+            if (identical) {
+                identical = comparer.matches(samples[0].data(), samples[1].data(), numRead);
+            }
+            if (scaled) {
+                scaled = fit.add(samples[0].data(), samples[1].data(), numRead);
+            }
+        }
+    }
+}
+
+/**
+ * Streams the sample data of an audio file in fixed-size blocks to determine if it is truely stereo.
+ * Stereo files are probed with probeStereo first, so true stereo files are usually rejected after a few
+ * small reads. Otherwise reading stops at the first block where the channels differ.
+ * Sets the result the same way isRealStereo does, and fills in the layout.
+ * In Tolerant mode with options.detectScaled, the same pass also fits right = gain * left, and a file
+ * whose channels differ but fit within options.scaledTolerance is ScaledMono with that gain, once verifyGain
+ * finds every sample within the TolerancePolicy of it. A gain rounded to 1 can't be, the channels already differ.
+ * With options.detectOffset, a file that is still stereo is checked for one channel being the other one
+ * delayed, with findOffset and verifyOffset, and is OffsetMono if it is.
+ * With options.timelineWindow, the same pass reads the whole of a stereo file to build its timeline of
+ * mono, stereo and silent windows. A file that is still stereo is MostlyMono if the mono share of the
+ * timeline reaches options.mostlyMonoShare.
+ * In Tolerant mode with options.measureDifferences, the same pass also reads the whole of a stereo file to
+ * measure how much its channels differ, and finds whether they're identical from the same statistics.
+ * Files with more channels are checked for channels that copy others with analyzeChannels.
+ * Returns false if the file's header couldn't be read.
+ */
+bool analyzeStream(string file, const ProcessOptions &options, AudioFileLayout &layout, ChannelAnalysis &analysis) {
+    AudioFileReader<float> reader;
+    if (!reader.open(file)) {
+        return false;
+    }
+    layout = reader.getLayout();
+    // Check if already mono
+    if (layout.numChannels == 1) {
+        analysis.result = Mono;
+        analysis.groups.assign(1, 0);
+        return true;
+    }
+    if (layout.numChannels > 2) {
+        analysis.result = analyzeChannels(reader, options, analysis.groups);
+        return true;
+    }
+    vector<uint8_t> block;
+    AudioFileReader<float>::AudioBuffer samples;
+    SampleComparer comparer(options);
+    ScaledMonoFit fit(options, layout.numSamplesPerChannel);
+    WindowClassifier windows(layout, options);
+
+    bool identical = true;
+    bool scaled = options.mode == Tolerant && options.detectScaled;
+    bool timeline = options.timelineWindow > 0;
+    bool measure = options.mode == Tolerant && options.measureDifferences;
+    // The timeline and the statistics need every frame anyway, and probing a short file costs about as much as reading it
+    if (!timeline && !measure && options.numProbes > 0 && layout.numSamplesPerChannel > options.numProbes * options.probeFrames) {
+        probeStereo(reader, options, identical, scaled);
+    }
+    while (identical || scaled || timeline || measure) {
+        size_t numFrames;
+        if (options.mode == BitExact) {
+            numFrames = reader.readFrames(block, options.blockFrames);
+            if (identical) {
+                identical = getFrameCompareKernel()(block.data(), numFrames, layout.numBytesPerSample, layout.numBytesPerFrame) == numFrames;
+            }
+            if (timeline) {
+                windows.addFrames(block.data(), numFrames);
+            }
+        } else {
+            numFrames = reader.read(samples, options.blockFrames);
+            if (measure) {
+                comparer.measure(samples[0].data(), samples[1].data(), numFrames, analysis.differences);
+                identical = analysis.differences.numDiffering == 0;
+            } else if (identical) {
+                identical = comparer.matches(samples[0].data(), samples[1].data(), numFrames);
+            }
+            if (scaled) {
+                scaled = fit.add(samples[0].data(), samples[1].data(), numFrames);
+            }
+            if (timeline) {
+                windows.addSamples(samples[0].data(), samples[1].data(), numFrames);
+            }
+        }
+        if (numFrames == 0) {
+            break;
+        }
+        // No need to read any further once a single frame differs, unless a gain could still explain it or there's a timeline to build
+    }
+    if (timeline) {
+        analysis.timeline = windows.finish();
+    }
+    analysis.measured = measure;
+    analysis.groups.assign(1, 0);
+    if (identical) {
+        analysis.result = FakeStereo;
+        analysis.groups.push_back(0);
+    } else if (scaled && fit.fits() && fit.gain() != 1 && verifyGain(reader, fit.gain(), options)) {
+        analysis.result = ScaledMono;
+        analysis.gain = fit.gain();
+        analysis.groups.push_back(0);
     } else {
-        return "";
+        analysis.result = Stereo;
+        analysis.groups.push_back(1);
+    }
+    if (analysis.result == Stereo && options.detectOffset && reader.seek(0)) {
+        int64_t offset = findOffset(reader, options);
+        if (offset != 0 && verifyOffset(reader, layout, offset, options)) {
+            analysis.result = OffsetMono;
+            analysis.offset = offset;
+            analysis.groups.back() = 0;
+        }
+    }
+    if (analysis.result == Stereo && timeline && options.mostlyMonoShare > 0 && analysis.timeline.getMonoShare() >= options.mostlyMonoShare) {
+        analysis.result = MostlyMono;
+        analysis.groups.back() = 0;
+    }
+    return true;
+}
+
+/**
+ * Returns the first channel of each group of identical channels, in order.
+ */
+vector<int> firstChannelOfEachGroup(const vector<int> &groups) {
+    vector<int> channels;
+    for (size_t channel = 0; channel < groups.size(); channel++) {
+        if (groups[channel] == (int)channels.size()) {
+            channels.push_back((int)channel);
+        }
+    }
+    return channels;
+}
+
+/**
+ * Writes a report of which of a file's original channels each of its saved channels stands for,
+ * one saved channel per line. Channels are counted from 1.
+ * If gains is given, an original channel that is its saved channel times a gain other than 1
+ * is written as channel*gain. If delays is given, one that is its saved channel delayed by some frames
+ * is written as channel+frames.
+ * Returns true if the report was written.
+ */
+bool writeChannelMap(string path, const vector<int> &groups, const vector<double> &gains = vector<double>(), const vector<int64_t> &delays = vector<int64_t>()) {
+    std::ofstream out(path);
+    out << "# saved channel: original channels\n";
+    int numGroups = (int)firstChannelOfEachGroup(groups).size();
+    for (int group = 0; group < numGroups; group++) {
+        out << group + 1 << ":";
+        for (size_t channel = 0; channel < groups.size(); channel++) {
+            if (groups[channel] == group) {
+                out << " " << channel + 1;
+                if (channel < gains.size() && gains[channel] != 1) {
+                    out << "*" << gains[channel];
+                }
+                if (channel < delays.size() && delays[channel] != 0) {
+                    out << "+" << delays[channel];
+                }
+            }
+        }
+        out << "\n";
+    }
+    return out.good();
+}
+
+/**
+ * Writes a file's timeline of mono, stereo and silent regions, one region per line,
+ * as its first frame, its number of frames and its kind.
+ * Returns true if the report was written.
+ */
+bool writeTimeline(string path, const Timeline &timeline, uint32_t sampleRate, const ProcessOptions &options) {
+    std::ofstream out(path);
+    out << "# start frame, frames, kind at " << sampleRate << " frames per second, channels compared by " << describeTolerance(options) << "\n";
+    const vector<Region> &regions = timeline.getRegions();
+    for (size_t i = 0; i < regions.size(); i++) {
+        out << regions[i].start << " " << regions[i].length << " " << regionName(regions[i].kind) << "\n";
+    }
+    return out.good();
+}
+
+// How a report's lines are written.
+enum ReportFormat {
+    TextReport, // Space separated, with the path last so it can have spaces in it
+    JsonReport, // One JSON object per line
+    CsvReport // Comma separated, after a line of column names
+};
+
+/**
+ * Picks a report's format from its extension: .json, .jsonl and .ndjson are JSON lines, .csv is CSV,
+ * and anything else is text.
+ */
+ReportFormat reportFormatFor(const string &path) {
+    string extension = getExtension(path);
+    if (extension == "json" || extension == "jsonl" || extension == "ndjson") {
+        return JsonReport;
     }
+    return extension == "csv" ? CsvReport : TextReport;
+}
+
+// The columns of JSON and CSV reports, in order.
+const char *const reportColumns[] = {"path", "result", "channels", "bit_depth", "sample_rate", "duration", "savable_bytes", "cached",
+    "probe_ms", "analyze_ms", "save_ms", "max_difference_db", "rms_difference_db", "first_differing", "last_differing",
+    "differing_frames", "mid_side_db", "gain", "offset"};
+
+/**
+ * Writes a report of a batch of files, one line per file, as each file is finished. Nothing is kept once
+ * its line is written, so reports of millions of files take no more memory than reports of a few.
+ * Lines come in the order files finish, not the order they were given in.
+ *
+ * Text lines have the file's result, then its difference statistics: the largest and the RMS difference between
+ * the channels in dBFS, the first and last frames that differ, the number that do, and the mid to side energy
+ * ratio in dB, with a - for each one a file doesn't have. The file's path ends the line.
+ * JSON and CSV lines have the path, result, channels, bit depth, sample rate, length in seconds, the bytes saving
+ * the file with fewer channels leaves out, whether it was cached, each stage's time in milliseconds, and then the
+ * difference statistics, then the gain of a ScaledMono file and the offset in frames of an OffsetMono one,
+ * null or empty where a file doesn't have them.
+ */
+class ReportWriter {
+public:
+    /**
+     * Starts a report at path, in the format its extension picks.
+     * Returns false if it can't be written.
+     */
+    bool open(const string &path, const ProcessOptions &options) {
+        format = reportFormatFor(path);
+        out.open(path);
+        if (format == TextReport) {
+            out << "# result, max |L-R| dBFS, RMS of L-R dBFS, first and last differing frame, differing frames, "
+                << "mid/side energy dB, file; channels compared by " << describeTolerance(options) << "\n";
+        } else if (format == CsvReport) {
+            for (size_t i = 0; i < NumColumns; i++) {
+                out << (i > 0 ? "," : "") << reportColumns[i];
+            }
+            out << "\n";
+        }
+        return out.good();
+    }
+
+    bool isOpen() const {
+        return out.is_open();
+    }
+
+    /**
+     * Adds a file's line to the report. Can be called from several threads at once.
+     */
+    void write(const string &file, const FileReport &report) {
+        std::ostringstream line;
+        if (format == TextReport) {
+            writeText(line, file, report);
+        } else {
+            vector<string> values = getValues(file, report);
+            if (format == JsonReport) {
+                line << "{";
+                for (size_t i = 0; i < NumColumns; i++) {
+                    line << (i > 0 ? "," : "") << "\"" << reportColumns[i] << "\":";
+                    if (values[i].empty()) {
+                        line << "null";
+                    } else if (i < NumTextColumns) {
+                        writeJsonString(line, values[i]);
+                    } else {
+                        line << values[i];
+                    }
+                }
+                line << "}\n";
+            } else {
+                for (size_t i = 0; i < NumColumns; i++) {
+                    line << (i > 0 ? "," : "");
+                    if (i < NumTextColumns) {
+                        writeCsvString(line, values[i]);
+                    } else {
+                        line << values[i];
+                    }
+                }
+                line << "\n";
+            }
+        }
+        std::lock_guard<std::mutex> lock(mtx);
+        out << line.str();
+    }
+
+    /**
+     * Finishes the report. If cache is given, a text report ends with how many files were found in it.
+     * Returns true if the whole report was written.
+     */
+    bool close(const ResultCache *cache = nullptr) {
+        if (format == TextReport && cache != nullptr && cache->isOpen()) {
+            out << "# " << cache->getNumHits() << " of " << cache->getNumLookups() << " files looked up were in the cache\n";
+        }
+        out.close();
+        return !out.fail();
+    }
+
+private:
+    static const size_t NumColumns = sizeof(reportColumns) / sizeof(reportColumns[0]);
+    static const size_t NumTextColumns = 2; // The path and result, which are quoted
+
+    ReportFormat format = TextReport;
+    std::ofstream out;
+    std::mutex mtx;
+
+    /**
+     * Returns a number as it's written in a report, or "" if it isn't finite.
+     */
+    static string formatNumber(double value) {
+        if (!std::isfinite(value)) {
+            return "";
+        }
+        std::ostringstream text;
+        text << value;
+        return text.str();
+    }
+
+    /**
+     * Returns a file's value for each column, with "" for the ones it doesn't have.
+     */
+    static vector<string> getValues(const string &file, const FileReport &report) {
+        const AudioFileLayout &layout = report.layout;
+        const DifferenceStats &stats = report.analysis.differences;
+        bool hasLayout = layout.numChannels > 0 && layout.sampleRate > 0;
+        bool hasStats = report.analysis.measured;
+        bool hasDiffering = hasStats && stats.numDiffering > 0;
+        vector<string> values = {file, resultName(report.result)};
+        values.push_back(hasLayout ? std::to_string(layout.numChannels) : "");
+        values.push_back(hasLayout ? std::to_string(layout.bitDepth) : "");
+        values.push_back(hasLayout ? std::to_string(layout.sampleRate) : "");
+        values.push_back(hasLayout ? formatNumber((double)layout.numSamplesPerChannel / layout.sampleRate) : "");
+        values.push_back(std::to_string(report.savableBytes));
+        values.push_back(report.cached ? "true" : "false");
+        values.push_back(formatNumber(report.probeSeconds * 1000));
+        values.push_back(formatNumber(report.analyzeSeconds * 1000));
+        values.push_back(formatNumber(report.saveSeconds * 1000));
+        values.push_back(hasStats ? formatNumber(20 * std::log10((double)stats.maxDifference)) : "");
+        values.push_back(hasStats ? formatNumber(20 * std::log10(differenceRms(stats))) : "");
+        values.push_back(hasDiffering ? std::to_string(stats.firstDiffering) : "");
+        values.push_back(hasDiffering ? std::to_string(stats.lastDiffering) : "");
+        values.push_back(hasStats ? std::to_string(stats.numDiffering) : "");
+        values.push_back(hasStats ? formatNumber(10 * std::log10(midSideRatio(stats))) : "");
+        values.push_back(report.result == ScaledMono ? formatNumber(report.analysis.gain) : "");
+        values.push_back(report.result == OffsetMono ? std::to_string(report.analysis.offset) : "");
+        return values;
+    }
+
+    static void writeText(std::ostream &line, const string &file, const FileReport &report) {
+        const ChannelAnalysis &analysis = report.analysis;
+        const DifferenceStats &stats = analysis.differences;
+        line << resultName(report.result) << " ";
+        if (!analysis.measured) {
+            line << "- - - - - - ";
+        } else {
+            line << 20 * std::log10((double)stats.maxDifference) << " " << 20 * std::log10(differenceRms(stats)) << " ";
+            if (stats.numDiffering > 0) {
+                line << stats.firstDiffering << " " << stats.lastDiffering << " ";
+            } else {
+                line << "- - ";
+            }
+            line << stats.numDiffering << " " << 10 * std::log10(midSideRatio(stats)) << " ";
+        }
+        line << file << "\n";
+    }
+
+    static void writeJsonString(std::ostream &line, const string &text) {
+        line << "\"";
+        for (unsigned char c : text) {
+            if (c == '"' || c == '\\') {
+                line << '\\' << c;
+            } else if (c < 0x20) {
+                char escaped[8];
+                snprintf(escaped, sizeof(escaped), "\\u%04x", c);
+                line << escaped;
+            } else {
+                line << c;
+            }
+        }
+        line << "\"";
+    }
+
+    static void writeCsvString(std::ostream &line, const string &text) {
+        line << "\"";
+        for (char c : text) {
+            line << (c == '"' ? "\"\"" : string(1, c));
+        }
+        line << "\"";
+    }
+};
+
+/**
+ * Copies a file byte for byte, for outputs that don't need re-encoding.
+ * Returns true if the whole file was copied.
+ */
+bool copyFile(string from, string to) {
+    std::ifstream in(from, std::ios::binary);
+    std::ofstream out(to, std::ios::binary);
+    if (!in.good() || !out.good()) {
+        return false;
+    }
+    out << in.rdbuf();
+    return out.good();
 }
 
 /**
@@ -114,53 +1125,486 @@ string cleanFileName(string file) {
 }
 
 /**
- * Processes and saves an audio buffer from a given file path.
- * Saves to given savePath.
- */ 
-AudioResult processSingle(string file, string savePath) {
-    // Load the audio file
-    AudioFile<float> wav;
-    wav.load(file);
-    // Do the stereo checking operation 
-    AudioResult result = isRealStereo(&wav);
-    // Build new save path string
-    string saveTo = savePath + "/" + cleanFileName(file);
-    
-    // Check if that file name already exists.
-    std::ifstream f(saveTo.c_str());
-    if(f.good()) {
+ * Estimates the memory it takes to re-save a file one block at a time:
+ * a block of raw frames, the decoded float buffers and the encoded output.
+ */
+size_t estimateStreamMemory(const AudioFileLayout &layout, size_t blockFrames) {
+    size_t rawBytes = blockFrames * layout.numBytesPerFrame;
+    size_t floatBytes = blockFrames * layout.numChannels * sizeof(float);
+    size_t outputBytes = blockFrames * layout.numBytesPerFrame;
+    return rawBytes + floatBytes + outputBytes;
+}
+
+/**
+ * Estimates the memory it takes to load a whole file whose header couldn't be read, from its size alone:
+ * the file's bytes, the decoded floats, which take up to four times the bytes of 8-bit samples, and the
+ * encoded output, which is no bigger than the file. Returns 0 if the file can't be opened.
+ */
+size_t estimateUnreadableMemory(string file) {
+    std::ifstream in(file, std::ios::binary | std::ios::ate);
+    std::streamoff fileBytes = in.good() ? (std::streamoff)in.tellg() : 0;
+    return fileBytes > 0 ? (size_t)fileBytes * 6 : 0;
+}
+
+/**
+ * Estimates the memory it takes to copy numChannels channels out of a file a block at a time:
+ * a block of raw frames and the samples of those channels taken from it.
+ */
+size_t estimateCopyMemory(const AudioFileLayout &layout, size_t blockFrames, int numChannels = 1) {
+    return blockFrames * layout.numBytesPerFrame + blockFrames * layout.numBytesPerSample * numChannels;
+}
+
+/**
+ * Picks the format to save a file in from its file name's extension: AIFF for .aif and .aiff in any case, else WAV.
+ */
+AudioFileFormat saveFormatFor(string saveTo) {
+    string extension = getExtension(saveTo);
+    if (extension == "aif" || extension == "aiff") {
+        return AudioFileFormat::Aiff;
+    }
+    return AudioFileFormat::Wave;
+}
+
+/**
+ * Re-saves an audio file with just the given channels, in ascending order, reading and writing a block at a time.
+ * Only options.blockFrames frames of the file are in memory at once, whatever its size.
+ * Returns true if the new file was written.
+ */
+bool saveChannelsStream(string file, string saveTo, const vector<int> &channels, const ProcessOptions &options) {
+    AudioFileReader<float> reader;
+    if (!reader.open(file)) {
+        return false;
+    }
+    const AudioFileLayout &layout = reader.getLayout();
+    AudioFileWriter<float> writer;
+    writer.iXMLChunk = reader.iXMLChunk;
+    if (!writer.open(saveTo, saveFormatFor(saveTo), (int)channels.size(), layout.sampleRate, layout.bitDepth)) {
+        return false;
+    }
+    AudioFileReader<float>::AudioBuffer samples;
+    while (size_t numFrames = reader.read(samples, options.blockFrames)) {
+        // Move the kept channels to the front. Each comes from at or after its new place, so none is overwritten first.
+        for (size_t i = 0; i < channels.size(); i++) {
+            if (channels[i] != (int)i) {
+                std::copy(samples[channels[i]].begin(), samples[channels[i]].end(), samples[(int)i].begin());
+            }
+        }
+        if (!writer.write(samples, numFrames)) {
+            break;
+        }
+    }
+    return writer.close();
+}
+
+/**
+ * Returns true if a file with samples stored as layout can be saved to saveTo by copying its sample bytes,
+ * which needs the output to be the same format as the input and stored in a way AudioFileWriter can write.
+ */
+bool canCopySamples(const AudioFileLayout &layout, string saveTo) {
+    return layout.format == saveFormatFor(saveTo) && AudioFileWriter<float>::canWriteLayout(layout);
+}
+
+/**
+ * Saves the given channels of an audio file, in ascending order, by copying their sample bytes straight out of each frame.
+ * Nothing is decoded or re-encoded, so the new file's samples are bit-for-bit the same as the original's.
+ * Only options.blockFrames frames of the file are in memory at once, whatever its size.
+ * Returns true if the new file was written.
+ */
+bool saveChannelsRaw(string file, string saveTo, const vector<int> &channels, const ProcessOptions &options) {
+    AudioFileReader<float> reader;
+    if (!reader.open(file)) {
+        return false;
+    }
+    const AudioFileLayout &layout = reader.getLayout();
+    AudioFileLayout savedLayout = layout;
+    savedLayout.numChannels = (int)channels.size();
+    AudioFileWriter<float> writer;
+    writer.iXMLChunk = reader.iXMLChunk;
+    if (!writer.open(saveTo, savedLayout)) {
+        return false;
+    }
+    // Keeping just the first channel is the common case, and has vector kernels
+    bool firstChannelOnly = channels.size() == 1 && channels[0] == 0;
+    ExtractKernel extract = getExtractKernel();
+    vector<uint8_t> frames;
+    vector<uint8_t> samples(options.blockFrames * layout.numBytesPerSample * channels.size());
+    while (size_t numFrames = reader.readFrames(frames, options.blockFrames)) {
+        if (firstChannelOnly) {
+            extract(frames.data(), numFrames, layout.numBytesPerSample, layout.numBytesPerFrame, samples.data());
+        } else {
+            extractChannels(frames.data(), numFrames, layout.numBytesPerSample, layout.numBytesPerFrame, channels, samples.data());
+        }
+        if (!writer.writeFrames(samples.data(), numFrames)) {
+            break;
+        }
+    }
+    return writer.close();
+}
+
+/**
+ * Returns true if there is a file at path that can be opened.
+ */
+bool fileExists(const string &path) {
+    std::ifstream f(path.c_str());
+    return f.good();
+}
+
+/**
+ * Builds the path a file is saved to in savePath.
+ * While a file with that name is already there, or is in claimed, 'NEW-' is put in front of the name
+ * to avoid overriding it. The returned path is added to claimed.
+ */
+string reserveSavePath(string file, string savePath, std::set<string> &claimed) {
+    string name = cleanFileName(file);
+    string saveTo = savePath + "/" + name;
+
+    // Every name tried is checked on the disk too, as files saved earlier in a long run are no longer claimed
+    while (fileExists(saveTo) || claimed.count(saveTo) > 0) {
         // append a new to the save path to potentially prevent overriding user files.
-        saveTo = savePath + "/NEW-" + cleanFileName(file);
+        name = "NEW-" + name;
+        saveTo = savePath + "/" + name;
     }
-    f.close();
+    claimed.insert(saveTo);
+    return saveTo;
+}
 
-    // Set proper number of channels for the new wave file
-    if (result != Stereo) {
-        wav.setNumChannels(1);
+/**
+ * Saves the given channels of an audio file, whose header has been read into layout, to saveTo.
+ * If budget is given, the memory for streaming the file is taken from it first.
+ */
+void saveChannels(string file, string saveTo, const AudioFileLayout &layout, const vector<int> &channels, const ProcessOptions &options, MemoryBudget *budget) {
+    // Save the file a block at a time, so even huge files only need a fixed amount of memory.
+    // When the output is stored the same way as the input, the samples are copied without decoding them.
+    bool copySamples = canCopySamples(layout, saveTo);
+    size_t streamMemory = copySamples ? estimateCopyMemory(layout, options.blockFrames, (int)channels.size()) : estimateStreamMemory(layout, options.blockFrames);
+    if (budget != nullptr) {
+        budget->acquire(streamMemory);
+    }
+    if (copySamples) {
+        saveChannelsRaw(file, saveTo, channels, options);
+    } else {
+        saveChannelsStream(file, saveTo, channels, options);
     }
-    AudioFileFormat ff = AudioFileFormat::Wave;
-    if (saveTo.find(".aif") > 0) {
-        ff = AudioFileFormat::Aiff;
+    if (budget != nullptr) {
+        budget->release(streamMemory);
+    }
+}
+
+/**
+ * Returns true if a file with this result is saved as fewer channels, and counts as fake stereo.
+ */
+bool isConvertedFake(AudioResult result, const ProcessOptions &options) {
+    return result == FakeStereo || result == MostlyMono || (result == ScaledMono && options.collapseScaled) || (result == OffsetMono && options.collapseOffset);
+}
+
+/**
+ * Returns how many bytes of sample data saving a file leaves out: those of the channels that are copies of others,
+ * for results that are saved with fewer channels.
+ */
+uint64_t savableBytes(const AudioFileLayout &layout, const ChannelAnalysis &analysis, const ProcessOptions &options) {
+    size_t numKept;
+    if (isConvertedFake(analysis.result, options)) {
+        numKept = 1;
+    } else if (analysis.result == DuplicateChannels) {
+        numKept = firstChannelOfEachGroup(analysis.groups).size();
+    } else {
+        return 0;
+    }
+    return (uint64_t)layout.numSamplesPerChannel * layout.numBytesPerSample * (layout.numChannels - numKept);
+}
+
+/**
+ * Returns the seconds since lap, and moves lap to now, for timing stages one after another.
+ */
+double lapSeconds(std::chrono::steady_clock::time_point &lap) {
+    std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+    double seconds = std::chrono::duration<double>(now - lap).count();
+    lap = now;
+    return seconds;
+}
+
+/**
+ * Analyzes a file whose header has been read into layout: from the header alone if it is mono, else from cache
+ * if it is given and has the file, else by reading as much of the file as it takes.
+ * Sets cached to whether the analysis came from the cache. Returns false if the file couldn't be analyzed.
+ * Files with a timeline aren't cached, since it takes reading the whole file anyway.
+ */
+bool analyzeFile(string file, AudioFileLayout &layout, const ProcessOptions &options, ResultCache *cache, ChannelAnalysis &analysis, bool &cached) {
+    cached = false;
+    // Files that are already mono are found from their header alone, without reading any samples
+    if (layout.numChannels == 1) {
+        analysis.result = Mono;
+        return true;
+    }
+
+    FileKey key;
+    uint64_t contentHash = 0;
+    bool cacheable = cache != nullptr && cache->isOpen() && options.timelineWindow == 0
+        && getFileKey(file, settingsHash(options), key) && (!options.cacheContentHash || hashFile(file, contentHash));
+    if (cacheable && lookupAnalysis(*cache, key, contentHash, analysis)) {
+        cached = true;
+        return true;
+    }
+    if (!analyzeStream(file, options, layout, analysis)) {
+        return false;
+    }
+    if (cacheable) {
+        storeAnalysis(*cache, key, file, contentHash, analysis);
+    }
+    return true;
+}
+
+/**
+ * Saves an analyzed file to the file path saveTo: copied as it is if nothing can be left out, else with one channel
+ * of each group of identical channels. If budget is given, the memory for streaming the file is taken from it first.
+ */
+void saveAnalyzed(string file, string saveTo, const AudioFileLayout &layout, const ChannelAnalysis &analysis, const ProcessOptions &options, MemoryBudget *budget) {
+    AudioResult result = analysis.result;
+    if (result == Mono) {
+        if (options.skipMono) {
+            return;
+        }
+        // Copy the file as it is, unless it has to be saved in another format
+        if (layout.format == saveFormatFor(saveTo)) {
+            copyFile(file, saveTo);
+        } else {
+            saveChannels(file, saveTo, layout, vector<int>(1, 0), options, budget);
+        }
+        return;
+    }
+
+    if (analysis.timeline.getLength() > 0) {
+        writeTimeline(saveTo + ".timeline.txt", analysis.timeline, layout.sampleRate, options);
+    }
+
+    // True stereo files are kept as they are, so there's nothing to decode
+    if (result == Stereo || (result == ScaledMono && !options.collapseScaled) || (result == OffsetMono && !options.collapseOffset)) {
+        copyFile(file, saveTo);
+        return;
+    }
+
+    if (result == ScaledMono) {
+        // Keep the louder channel, so the quieter one is rebuilt by scaling down and nothing is lost to rounding
+        int kept = std::fabs(analysis.gain) > 1 ? 1 : 0;
+        vector<double> gains(2, 1.0);
+        gains[1 - kept] = kept == 0 ? analysis.gain : 1 / analysis.gain;
+        saveChannels(file, saveTo, layout, vector<int>(1, kept), options, budget);
+        writeChannelMap(saveTo + ".channels.txt", analysis.groups, gains);
+        return;
     }
-    
-    // Save the processed file.
-    wav.save(saveTo, ff);
 
+    if (result == OffsetMono) {
+        // Keep the leading channel whole, the delayed one is that shifted later, with silence in front
+        int kept = analysis.offset > 0 ? 0 : 1;
+        vector<int64_t> delays(2, 0);
+        delays[1 - kept] = analysis.offset > 0 ? analysis.offset : -analysis.offset;
+        saveChannels(file, saveTo, layout, vector<int>(1, kept), options, budget);
+        writeChannelMap(saveTo + ".channels.txt", analysis.groups, vector<double>(), delays);
+        return;
+    }
+
+    // Keep one channel of each group of identical channels, and say which channels each one stands for
+    saveChannels(file, saveTo, layout, firstChannelOfEachGroup(analysis.groups), options, budget);
+    if (layout.numChannels > 2) {
+        writeChannelMap(saveTo + ".channels.txt", analysis.groups);
+    }
+}
+
+/**
+ * Processes an audio file and saves the result to the file path saveTo, unless options.dryRun is set.
+ * If budget is given, memory for reading the file is taken from it first, by saveChannels while streaming it,
+ * or for the whole file when its header can't be read and it has to be loaded at once.
+ * If report is given, it is set to what analyzing the file found and how long each stage took.
+ * If cache is given, a file that hasn't changed since it was stored there isn't analyzed again.
+ */
+AudioResult processFile(string file, string saveTo, const ProcessOptions &options, MemoryBudget *budget = nullptr, FileReport *report = nullptr,
+                        ResultCache *cache = nullptr) {
+    FileReport stages;
+    std::chrono::steady_clock::time_point lap = std::chrono::steady_clock::now();
+    bool probed = probeFile(file, stages.layout);
+    stages.probeSeconds = lapSeconds(lap);
+
+    if (probed && analyzeFile(file, stages.layout, options, cache, stages.analysis, stages.cached)) {
+        stages.result = stages.analysis.result;
+        stages.savableBytes = savableBytes(stages.layout, stages.analysis, options);
+        stages.analyzeSeconds = lapSeconds(lap);
+        if (!options.dryRun) {
+            saveAnalyzed(file, saveTo, stages.layout, stages.analysis, options, budget);
+            stages.saveSeconds = lapSeconds(lap);
+        }
+    } else {
+        // The header couldn't be read, so leave it to AudioFile to load what it can
+        stages.layout = AudioFileLayout();
+        stages.analysis = ChannelAnalysis();
+        size_t loadMemory = budget != nullptr ? estimateUnreadableMemory(file) : 0;
+        if (budget != nullptr) {
+            budget->acquire(loadMemory);
+        }
+        {
+            // Scoped so the loaded file is freed before its memory goes back to the budget
+            AudioFile<float> wav;
+            wav.load(file);
+            stages.result = isRealStereo(&wav, options);
+            stages.analyzeSeconds = lapSeconds(lap);
+            if (!options.dryRun) {
+                if (stages.result != Stereo) {
+                    wav.setNumChannels(1);
+                }
+                wav.save(saveTo, saveFormatFor(saveTo));
+                stages.saveSeconds = lapSeconds(lap);
+            }
+        }
+        if (budget != nullptr) {
+            budget->release(loadMemory);
+        }
+    }
+
+    AudioResult result = stages.result;
+    if (report) {
+        *report = std::move(stages);
+    }
     return result;
 }
 
 /**
- * Processes a whole batch of audio files from given paths.
+ * Processes and saves an audio buffer from a given file path.
  * Saves to given savePath.
- * Returns the number of fake stereo files found.
  */ 
-int processAll(vector<string> files, string savePath) {
-    int numFakeStereo = 0;
-    for (size_t i = 0; i < files.size(); i++) {
-        AudioResult result = processSingle(files[i], savePath);
-        if (result == FakeStereo) {
-            numFakeStereo++;
+AudioResult processSingle(string file, string savePath, const ProcessOptions &options = ProcessOptions()) {
+    std::set<string> claimed;
+    return processFile(file, reserveSavePath(file, savePath, claimed), options);
+}
+
+/**
+ * Processes files as they are found, several at a time, for callers that don't have the whole list up front.
+ * Files can be added from any thread. Each file's save path is picked when it is added, so files added
+ * from one thread get their save paths in the order they were added.
+ */
+class ProcessQueue {
+public:
+    /**
+     * Saves to given savePath, and calls processed with every file and its result from the thread that processed it, if it is given.
+     * If report is given, a line for every file is written to it as the file is finished.
+     */
+    ProcessQueue(string savePath, const ProcessOptions &options, ResultCache *cache = nullptr, std::function<void(const string &, AudioResult)> processed = nullptr,
+                 ReportWriter *report = nullptr)
+        : savePath(savePath), options(options), cache(cache), processed(processed), report(report), budget(options.memoryBudget), pool(options.numThreads) {}
+
+    /**
+     * Queues a file to be processed. Waits while maxWaiting files are already queued, so a fast walk
+     * over a huge tree doesn't hold every path in memory.
+     */
+    void add(const string &file) {
+        string saveTo;
+        {
+            std::unique_lock<std::mutex> lock(mtx);
+            spaceFree.wait(lock, [this] { return numWaiting < maxWaiting; });
+            numWaiting++;
+            saveTo = reserveSavePath(file, savePath, claimed);
+        }
+        pool.submit([this, file, saveTo] {
+            FileReport fileReport;
+            AudioResult result = processFile(file, saveTo, options, &budget, report ? &fileReport : nullptr, cache);
+            if (report) {
+                report->write(file, fileReport);
+            }
+            {
+                // Finished files are on disk, which reserveSavePath checks, so they don't need to stay claimed.
+                // In a dry run nothing is saved, and the names picked don't matter.
+                std::lock_guard<std::mutex> lock(mtx);
+                claimed.erase(saveTo);
+                numWaiting--;
+            }
+            spaceFree.notify_one();
+            if (isConvertedFake(result, options)) {
+                numFakeStereo++;
+            }
+            if (processed) {
+                processed(file, result);
+            }
+        });
+    }
+
+    /**
+     * Waits for every file added so far to be processed.
+     * Returns the number of fake stereo files found, counted as processAll does.
+     */
+    int finish() {
+        pool.wait();
+        return numFakeStereo;
+    }
+
+private:
+    static const size_t maxWaiting = 1 << 14;
+
+    string savePath;
+    ProcessOptions options;
+    ResultCache *cache;
+    std::function<void(const string &, AudioResult)> processed;
+    ReportWriter *report;
+    std::mutex mtx;
+    std::condition_variable spaceFree;
+    std::set<string> claimed; // Save paths of the files that are queued or being processed
+    size_t numWaiting = 0;
+    std::atomic<int> numFakeStereo{0};
+    MemoryBudget budget;
+    ThreadPool pool; // Last, so the workers stop before anything they use is gone
+};
+
+/**
+ * Processes a whole batch of audio files from given paths, several at a time.
+ * Saves to given savePath, and writes a report of every file to report, or to options.reportPath if it is set and report isn't given.
+ * If cache is given, files that haven't changed since they were stored there aren't analyzed again.
+ * Returns the number of fake stereo files found, counting MostlyMono files, and ScaledMono and OffsetMono files when they are collapsed.
+ */ 
+int processAll(vector<string> files, string savePath, const ProcessOptions &options = ProcessOptions(), ResultCache *cache = nullptr,
+               ReportWriter *report = nullptr) {
+    ReportWriter ownReport;
+    if (report == nullptr && !options.reportPath.empty() && ownReport.open(options.reportPath, options)) {
+        report = &ownReport;
+    }
+    int numFakeStereo;
+    {
+        ProcessQueue queue(savePath, options, cache, nullptr, report);
+        for (size_t i = 0; i < files.size(); i++) {
+            queue.add(files[i]);
         }
+        numFakeStereo = queue.finish();
+    }
+    if (ownReport.isOpen()) {
+        ownReport.close(cache);
     }
     return numFakeStereo;
-}
\ No newline at end of file
+}
+
+/**
+ * Processes the audio files that arrive in a watcher's folders as they are finished, several at a time,
+ * until the watcher is stopped. Saves to given savePath, calls processed as ProcessQueue does, and writes
+ * each file to report if it is given.
+ * Returns the number of fake stereo files found, counted as processAll does.
+ */
+int processArrivals(FolderWatcher &watcher, string savePath, const ProcessOptions &options = ProcessOptions(), ResultCache *cache = nullptr,
+                    std::function<void(const string &, AudioResult)> processed = nullptr, ReportWriter *report = nullptr) {
+    ProcessQueue queue(savePath, options, cache, processed, report);
+    watcher.run([&](const string &file) {
+        if (hasAudioExtension(file)) {
+            queue.add(file);
+        }
+    });
+    return queue.finish();
+}
+
+/**
+ * Processes every WAV and AIFF file in the given folders and their subfolders, several at a time.
+ * Files start being processed as soon as the walk finds them, while the rest of the tree is still being walked.
+ * The savePath folder is never walked, so files saved while the walk goes on aren't processed again.
+ * That includes a root that is the savePath folder itself, so callers should refuse one, as nothing in it is processed.
+ * Saves to given savePath, calls processed as ProcessQueue does, and writes each file to report if it is given.
+ * Returns the number of fake stereo files found, counted as processAll does.
+ */
+int processFolders(const vector<string> &folders, string savePath, const ProcessOptions &options = ProcessOptions(), ResultCache *cache = nullptr,
+                   std::function<void(const string &, AudioResult)> processed = nullptr, ReportWriter *report = nullptr) {
+    ProcessQueue queue(savePath, options, cache, processed, report);
+    findAudioFiles(folders, options.numWalkThreads, [&](const string &file) { queue.add(file); }, savePath);
+    return queue.finish();
+}
@@ -0,0 +1,199 @@
+#pragma once
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/**
+ * A fixed set of worker threads that run submitted tasks.
+ * Every worker has its own queue. A worker that runs out of tasks steals from the back
+ * of another worker's queue, so a few long tasks can't leave the other threads idle.
+ */
+class ThreadPool {
+public:
+    typedef std::function<void()> Task;
+
+    /**
+     * Starts numWorkers threads. 0 starts one per hardware thread.
+     */
+    explicit ThreadPool(unsigned numWorkers = 0) {
+        if (numWorkers == 0) {
+            numWorkers = std::max(1u, std::thread::hardware_concurrency());
+        }
+        for (unsigned i = 0; i < numWorkers; i++) {
+            queues.emplace_back(new WorkerQueue());
+        }
+        for (unsigned i = 0; i < numWorkers; i++) {
+            workers.emplace_back(&ThreadPool::workerLoop, this, i);
+        }
+    }
+
+    ~ThreadPool() {
+        {
+            std::lock_guard<std::mutex> lock(signalMutex);
+            stopping = true;
+        }
+        taskAvailable.notify_all();
+        for (auto &worker : workers) {
+            worker.join();
+        }
+    }
+
+    ThreadPool(const ThreadPool &) = delete;
+    ThreadPool &operator=(const ThreadPool &) = delete;
+
+    /**
+     * Returns the number of worker threads.
+     */
+    size_t size() const {
+        return workers.size();
+    }
+
+    /**
+     * Queues a task. Tasks are spread over the workers' queues in turn.
+     */
+    void submit(Task task) {
+        size_t index = nextQueue++ % queues.size();
+        // Counted before it is queued, or a worker could run it and count it done before it was ever counted
+        {
+            std::lock_guard<std::mutex> lock(signalMutex);
+            pending++;
+        }
+        {
+            std::lock_guard<std::mutex> lock(queues[index]->mtx);
+            queues[index]->tasks.push_back(std::move(task));
+        }
+        // Notified under the lock workers check the queues with, so one can't miss it on its way to sleep
+        std::lock_guard<std::mutex> lock(signalMutex);
+        taskAvailable.notify_one();
+    }
+
+    /**
+     * Blocks until every submitted task has finished.
+     */
+    void wait() {
+        std::unique_lock<std::mutex> lock(signalMutex);
+        allDone.wait(lock, [this] { return pending == 0; });
+    }
+
+private:
+    struct WorkerQueue {
+        std::mutex mtx;
+        std::deque<Task> tasks;
+    };
+
+    /**
+     * Takes the next task for a worker: the front of its own queue, or else the back of someone else's.
+     */
+    bool takeTask(size_t self, Task &task) {
+        for (size_t n = 0; n < queues.size(); n++) {
+            WorkerQueue &queue = *queues[(self + n) % queues.size()];
+            std::lock_guard<std::mutex> lock(queue.mtx);
+            if (queue.tasks.empty()) {
+                continue;
+            }
+            if (n == 0) {
+                task = std::move(queue.tasks.front());
+                queue.tasks.pop_front();
+            } else {
+                task = std::move(queue.tasks.back());
+                queue.tasks.pop_back();
+            }
+            return true;
+        }
+        return false;
+    }
+
+    void workerLoop(size_t self) {
+        while (true) {
+            Task task;
+            if (takeTask(self, task)) {
+                task();
+                std::lock_guard<std::mutex> lock(signalMutex);
+                pending--;
+                if (pending == 0) {
+                    allDone.notify_all();
+                }
+                continue;
+            }
+            std::unique_lock<std::mutex> lock(signalMutex);
+            // Only sleep while there is nothing left that hasn't been picked up yet
+            taskAvailable.wait(lock, [this] { return stopping || queued() > 0; });
+            if (stopping && queued() == 0) {
+                return;
+            }
+        }
+    }
+
+    /**
+     * Returns the number of tasks sitting in the queues. Only called with signalMutex held.
+     */
+    size_t queued() {
+        size_t count = 0;
+        for (auto &queue : queues) {
+            std::lock_guard<std::mutex> lock(queue->mtx);
+            count += queue->tasks.size();
+        }
+        return count;
+    }
+
+    std::vector<std::unique_ptr<WorkerQueue>> queues;
+    std::vector<std::thread> workers;
+    std::atomic<size_t> nextQueue{0};
+
+    std::mutex signalMutex;
+    std::condition_variable taskAvailable;
+    std::condition_variable allDone;
+    size_t pending = 0; // Submitted tasks that haven't finished
+    bool stopping = false;
+};
+
+/**
+ * Limits how many bytes the workers may have in use at once.
+ * A request bigger than the whole budget is let through once nothing else is using any,
+ * so a single huge file still gets processed, just on its own.
+ */
+class MemoryBudget {
+public:
+    /**
+     * Creates a budget of limit bytes. 0 means no limit.
+     */
+    explicit MemoryBudget(size_t limit) : limit(limit) {}
+
+    /**
+     * Blocks until bytes fit in the budget, then takes them.
+     */
+    void acquire(size_t bytes) {
+        if (limit == 0) {
+            return;
+        }
+        std::unique_lock<std::mutex> lock(mtx);
+        released.wait(lock, [&] { return inUse == 0 || inUse + bytes <= limit; });
+        inUse += bytes;
+    }
+
+    /**
+     * Gives back bytes taken with acquire.
+     */
+    void release(size_t bytes) {
+        if (limit == 0) {
+            return;
+        }
+        {
+            std::lock_guard<std::mutex> lock(mtx);
+            inUse -= bytes;
+        }
+        released.notify_all();
+    }
+
+private:
+    size_t limit;
+    size_t inUse = 0;
+    std::mutex mtx;
+    std::condition_variable released;
+};
@@ -0,0 +1,89 @@
+#pragma once
+#include <cstddef>
+#include <vector>
+
+// What a stretch of a stereo file holds.
+enum class RegionKind {
+    Mono, // The channels are the same
+    Stereo, // The channels differ
+    Silent // Both channels are silent
+};
+
+// A run of frames of one kind.
+struct Region {
+    RegionKind kind;
+    size_t start; // First frame of the run
+    size_t length; // Number of frames in the run
+};
+
+/**
+ * Returns the name of a kind of region, as written in reports.
+ */
+const char *regionName(RegionKind kind) {
+    switch (kind) {
+        case RegionKind::Mono: return "mono";
+        case RegionKind::Stereo: return "stereo";
+        default: return "silent";
+    }
+}
+
+/**
+ * A run-length encoded timeline of the mono, stereo and silent stretches of a file.
+ * Frames are added in order, and frames of the same kind as the last run just make it longer,
+ * so a file that only changes a few times takes a few regions whatever its length.
+ */
+class Timeline {
+public:
+    /**
+     * Adds numFrames frames of a kind to the end of the timeline.
+     */
+    void add(RegionKind kind, size_t numFrames) {
+        if (numFrames == 0) {
+            return;
+        }
+        if (!regions.empty() && regions.back().kind == kind) {
+            regions.back().length += numFrames;
+        } else {
+            Region region = {kind, length, numFrames};
+            regions.push_back(region);
+        }
+        length += numFrames;
+    }
+
+    const std::vector<Region> &getRegions() const {
+        return regions;
+    }
+
+    /**
+     * Returns the number of frames in the timeline.
+     */
+    size_t getLength() const {
+        return length;
+    }
+
+    /**
+     * Returns the number of frames of a kind.
+     */
+    size_t getNumFrames(RegionKind kind) const {
+        size_t count = 0;
+        for (size_t i = 0; i < regions.size(); i++) {
+            if (regions[i].kind == kind) {
+                count += regions[i].length;
+            }
+        }
+        return count;
+    }
+
+    /**
+     * Returns the share of the frames that aren't silent that are mono, or 0 if every frame is silent.
+     */
+    double getMonoShare() const {
+        size_t mono = getNumFrames(RegionKind::Mono);
+        size_t audible = mono + getNumFrames(RegionKind::Stereo);
+        return audible > 0 ? (double)mono / audible : 0;
+    }
+
+private:
+    std::vector<Region> regions;
+    size_t length = 0;
+};
@@ -0,0 +1,334 @@
+#pragma once
+#include <algorithm>
+#include <cctype>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Folders are listed with getdents64 on Linux, which returns a large batch of entries per call,
+// with readdir on other POSIX systems, and with FindFirstFile on Windows.
+#ifdef _WIN32
+#include <stdlib.h>
+#include <windows.h>
+#else
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#ifdef __linux__
+#define MONOC_GETDENTS 1
+#include <sys/syscall.h>
+#endif
+#endif
+
+/**
+ * Returns the extension of a file's name, after its last dot, in lower case, or "" if the name has no dot.
+ * Dots in the folders above the file don't count.
+ */
+std::string getExtension(const std::string &file) {
+    size_t dot = file.find_last_of('.');
+    if (dot == std::string::npos || file.find_first_of("/\\", dot) != std::string::npos) {
+        return "";
+    }
+    std::string extension = file.substr(dot + 1);
+    std::transform(extension.begin(), extension.end(), extension.begin(), [](unsigned char c) { return (char)std::tolower(c); });
+    return extension;
+}
+
+/**
+ * Returns true if a file's name ends in .wav, .aif or .aiff, in any case.
+ */
+bool hasAudioExtension(const std::string &file) {
+    std::string extension = getExtension(file);
+    return extension == "wav" || extension == "aif" || extension == "aiff";
+}
+
+/**
+ * Returns true if a file starts like a WAV or AIFF file: a RIFF, RF64 or BW64 chunk holding WAVE,
+ * or a FORM chunk holding AIFF or AIFC.
+ */
+bool hasAudioHeader(const std::string &file) {
+    char header[12];
+    FILE *in = fopen(file.c_str(), "rb");
+    if (in == nullptr) {
+        return false;
+    }
+    bool complete = fread(header, 1, sizeof(header), in) == sizeof(header);
+    fclose(in);
+    if (!complete) {
+        return false;
+    }
+    if (memcmp(header, "RIFF", 4) == 0 || memcmp(header, "RF64", 4) == 0 || memcmp(header, "BW64", 4) == 0) {
+        return memcmp(header + 8, "WAVE", 4) == 0;
+    }
+    return memcmp(header, "FORM", 4) == 0 && (memcmp(header + 8, "AIFF", 4) == 0 || memcmp(header + 8, "AIFC", 4) == 0);
+}
+
+// What tells two paths to one folder apart from paths to different ones
+#ifdef _WIN32
+typedef std::string FolderId; // The full path, in lower case
+#else
+struct FolderId {
+    dev_t device;
+    ino_t inode;
+    bool operator==(const FolderId &other) const { return device == other.device && inode == other.inode; }
+};
+#endif
+
+/**
+ * Sets id to the identity of a folder. Returns false if it isn't a folder.
+ */
+bool getFolderId(const std::string &folder, FolderId &id) {
+#ifdef _WIN32
+    char full[MAX_PATH];
+    DWORD attributes = GetFileAttributesA(folder.c_str());
+    if (attributes == INVALID_FILE_ATTRIBUTES || (attributes & FILE_ATTRIBUTE_DIRECTORY) == 0
+        || _fullpath(full, folder.c_str(), MAX_PATH) == nullptr) {
+        return false;
+    }
+    id = full;
+    while (id.size() > 3 && (id.back() == '\\' || id.back() == '/')) {
+        id.pop_back();
+    }
+    std::transform(id.begin(), id.end(), id.begin(), [](unsigned char c) { return (char)std::tolower(c); });
+    return true;
+#else
+    struct stat info;
+    if (stat(folder.c_str(), &info) != 0 || !S_ISDIR(info.st_mode)) {
+        return false;
+    }
+    id.device = info.st_dev;
+    id.inode = info.st_ino;
+    return true;
+#endif
+}
+
+/**
+ * Returns true if two paths name the same folder.
+ */
+bool isSameFolder(const std::string &a, const std::string &b) {
+    FolderId idA, idB;
+    return getFolderId(a, idA) && getFolderId(b, idB) && idA == idB;
+}
+
+/**
+ * Walks folder trees on several threads at once. Each thread takes a folder, lists it, queues its subfolders
+ * for any thread to take, and hands over its files as soon as they are seen.
+ * Links to folders aren't followed, so a link back up the tree can't loop forever. Links to files are.
+ * Folders given to skipFolder aren't walked, wherever they turn up in the tree.
+ */
+class FolderWalker {
+public:
+    typedef std::function<bool(const std::string &)> Filter;
+    typedef std::function<void(const std::string &)> Found;
+
+    /**
+     * Walks with numThreads threads. 0 walks with one per hardware thread.
+     */
+    explicit FolderWalker(unsigned numThreads = 0) : numThreads(numThreads) {
+        if (this->numThreads == 0) {
+            this->numThreads = std::max(1u, std::thread::hardware_concurrency());
+        }
+    }
+
+    /**
+     * Leaves a folder out of every walk, such as the folder files are being saved to while the walk goes on,
+     * which would otherwise hand over its own outputs. Returns false if the folder doesn't exist.
+     */
+    bool skipFolder(const std::string &folder) {
+        FolderId id;
+        if (!getFolderId(folder, id)) {
+            return false;
+        }
+        skipped.push_back(id);
+        return true;
+    }
+
+    /**
+     * Walks every folder in roots, and calls found(path) for every file below them that wanted(path) accepts.
+     * Both are called from the walking threads, several at a time. Returns once the whole tree has been walked.
+     */
+    void walk(const std::vector<std::string> &roots, Filter wanted, Found found) {
+        this->wanted = wanted;
+        this->found = found;
+        folders.assign(roots.begin(), roots.end());
+        numBusy = 0;
+        std::vector<std::thread> threads;
+        for (unsigned i = 0; i < numThreads; i++) {
+            threads.emplace_back(&FolderWalker::walkLoop, this);
+        }
+        for (auto &thread : threads) {
+            thread.join();
+        }
+    }
+
+private:
+    enum EntryType { File, Folder, Other };
+
+    unsigned numThreads;
+    Filter wanted;
+    Found found;
+    std::mutex mtx;
+    std::condition_variable changed;
+    std::deque<std::string> folders; // Folders waiting to be listed
+    unsigned numBusy = 0; // Threads listing a folder, which may queue more
+    std::vector<FolderId> skipped;
+
+    bool isSkipped(const std::string &folder) const {
+        FolderId id;
+        return !skipped.empty() && getFolderId(folder, id) && std::find(skipped.begin(), skipped.end(), id) != skipped.end();
+    }
+
+    /**
+     * Lists folders until there are none left and no thread is listing one.
+     */
+    void walkLoop() {
+        while (true) {
+            std::string folder;
+            {
+                std::unique_lock<std::mutex> lock(mtx);
+                changed.wait(lock, [this] { return !folders.empty() || numBusy == 0; });
+                if (folders.empty()) {
+                    return;
+                }
+                // Taking the newest folder walks depth first, which keeps the queue short in wide trees
+                folder = folders.back();
+                folders.pop_back();
+                numBusy++;
+            }
+            std::vector<std::string> subfolders;
+            listFolder(folder, subfolders);
+            {
+                std::lock_guard<std::mutex> lock(mtx);
+                folders.insert(folders.end(), subfolders.begin(), subfolders.end());
+                numBusy--;
+            }
+            changed.notify_all();
+        }
+    }
+
+    /**
+     * Handles one entry of a folder: queues it if it's a folder, or hands it over if it's a wanted file.
+     */
+    void addEntry(const std::string &folder, const char *name, EntryType type, std::vector<std::string> &subfolders) {
+        if (strcmp(name, ".") == 0 || strcmp(name, "..") == 0 || type == Other) {
+            return;
+        }
+        std::string path = folder;
+        if (!path.empty() && path.back() != '/' && path.back() != '\\') {
+            path += '/';
+        }
+        path += name;
+        if (type == Folder) {
+            subfolders.push_back(path);
+        } else if (wanted(path)) {
+            found(path);
+        }
+    }
+
+#ifndef _WIN32
+    /**
+     * Works out what an entry is when the listing didn't say, or said it is a link.
+     */
+    static EntryType typeOf(int folderFd, const char *name, bool isLink) {
+        struct stat info;
+        if (!isLink && fstatat(folderFd, name, &info, AT_SYMLINK_NOFOLLOW) != 0) {
+            return Other;
+        }
+        if (!isLink && S_ISDIR(info.st_mode)) {
+            return Folder;
+        }
+        // Links only count as the files they point to
+        if ((isLink || S_ISLNK(info.st_mode)) && fstatat(folderFd, name, &info, 0) != 0) {
+            return Other;
+        }
+        return S_ISREG(info.st_mode) ? File : Other;
+    }
+
+    static EntryType typeOf(int folderFd, const char *name, unsigned char type) {
+        switch (type) {
+            case DT_DIR: return Folder;
+            case DT_REG: return File;
+            case DT_LNK: return typeOf(folderFd, name, true);
+            case DT_UNKNOWN: return typeOf(folderFd, name, false);
+            default: return Other;
+        }
+    }
+#endif
+
+    /**
+     * Lists a folder, handing over its files and adding its subfolders to subfolders.
+     */
+    void listFolder(const std::string &folder, std::vector<std::string> &subfolders) {
+        if (isSkipped(folder)) {
+            return;
+        }
+#if defined(MONOC_GETDENTS)
+        int fd = open(folder.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+        if (fd < 0) {
+            return;
+        }
+        struct LinuxDirent64 {
+            uint64_t d_ino;
+            int64_t d_off;
+            unsigned short d_reclen;
+            unsigned char d_type;
+            char d_name[1];
+        };
+        alignas(8) char buffer[32 * 1024];
+        long size;
+        while ((size = syscall(SYS_getdents64, fd, buffer, sizeof(buffer))) > 0) {
+            for (long offset = 0; offset < size;) {
+                const LinuxDirent64 *entry = (const LinuxDirent64 *)(buffer + offset);
+                offset += entry->d_reclen;
+                addEntry(folder, entry->d_name, typeOf(fd, entry->d_name, entry->d_type), subfolders);
+            }
+        }
+        close(fd);
+#elif defined(_WIN32)
+        WIN32_FIND_DATAA entry;
+        HANDLE search = FindFirstFileA((folder + "\\*").c_str(), &entry);
+        if (search == INVALID_HANDLE_VALUE) {
+            return;
+        }
+        do {
+            // Junctions and folder links aren't followed, like links elsewhere
+            EntryType type = File;
+            if (entry.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) {
+                type = (entry.dwFileAttributes & FILE_ATTRIBUTE_REPARSE_POINT) ? Other : Folder;
+            }
+            addEntry(folder, entry.cFileName, type, subfolders);
+        } while (FindNextFileA(search, &entry));
+        FindClose(search);
+#else
+        DIR *listing = opendir(folder.c_str());
+        if (listing == nullptr) {
+            return;
+        }
+        while (struct dirent *entry = readdir(listing)) {
+            addEntry(folder, entry->d_name, typeOf(dirfd(listing), entry->d_name, entry->d_type), subfolders);
+        }
+        closedir(listing);
+#endif
+    }
+};
+
+/**
+ * Walks folder trees with walkers threads, and calls found(path) with every WAV and AIFF file below them as it is found.
+ * Files are picked by their extension, and then by the start of the file, so other files named .wav are skipped.
+ * The folder skipped isn't walked, if it is given.
+ */
+void findAudioFiles(const std::vector<std::string> &roots, unsigned walkers, FolderWalker::Found found, const std::string &skipped = "") {
+    FolderWalker walker(walkers);
+    if (!skipped.empty()) {
+        walker.skipFolder(skipped);
+    }
+    walker.walk(roots, [](const std::string &file) { return hasAudioExtension(file) && hasAudioHeader(file); }, found);
+}
@@ -0,0 +1,176 @@
+#pragma once
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <map>
+#include <string>
+
+// Watching folders needs inotify. Elsewhere FolderWatcher never opens, and files can only be processed by naming them.
+#ifdef __linux__
+#define MONOC_WATCH 1
+#include <poll.h>
+#include <sys/inotify.h>
+#include <unistd.h>
+#endif
+
+/**
+ * Waits for files to be finished in a set of folders.
+ * A file is finished when it has been closed after writing, or moved into the folder, and then left alone
+ * for settleMs. Writers that close and reopen a file as they go restart the wait, so half written files
+ * aren't handed over. Subfolders aren't watched.
+ * While nothing arrives, run sleeps in poll without waking up.
+ */
+class FolderWatcher {
+public:
+    explicit FolderWatcher(int settleMs = 200) : settleTime(settleMs) {}
+
+    ~FolderWatcher() {
+#ifdef MONOC_WATCH
+        if (inotifyFd >= 0) {
+            ::close(inotifyFd);
+        }
+        for (int i = 0; i < 2; i++) {
+            if (wakeFds[i] >= 0) {
+                ::close(wakeFds[i]);
+            }
+        }
+#endif
+    }
+
+    FolderWatcher(const FolderWatcher &) = delete;
+    FolderWatcher &operator=(const FolderWatcher &) = delete;
+
+    /**
+     * Gets ready to watch folders. Returns false if watching isn't possible here.
+     */
+    bool open() {
+#ifdef MONOC_WATCH
+        inotifyFd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+        if (inotifyFd < 0 || pipe(wakeFds) != 0) {
+            return false;
+        }
+        return true;
+#else
+        return false;
+#endif
+    }
+
+    /**
+     * Starts watching a folder. Returns false if it can't be watched.
+     */
+    bool addFolder(std::string folder) {
+#ifdef MONOC_WATCH
+        while (folder.size() > 1 && folder.back() == '/') {
+            folder.pop_back();
+        }
+        int watch = inotify_add_watch(inotifyFd, folder.c_str(), IN_CLOSE_WRITE | IN_MOVED_TO | IN_MODIFY | IN_DELETE | IN_MOVED_FROM | IN_ONLYDIR);
+        if (watch < 0) {
+            return false;
+        }
+        folders[watch] = folder;
+        return true;
+#else
+        (void)folder;
+        return false;
+#endif
+    }
+
+    /**
+     * Calls ready(path) with every file that is finished in the watched folders, until stop is called.
+     */
+    template <class Ready>
+    void run(Ready ready) {
+#ifdef MONOC_WATCH
+        while (true) {
+            // Sleep until something happens, or the next waiting file has settled
+            int timeout = -1;
+            if (!pending.empty()) {
+                Clock::time_point next = pending.begin()->second;
+                for (auto &file : pending) {
+                    next = std::min(next, file.second);
+                }
+                auto wait = std::chrono::duration_cast<std::chrono::milliseconds>(next - Clock::now()).count() + 1;
+                timeout = (int)std::max<long long>(0, wait);
+            }
+            struct pollfd fds[2] = {{inotifyFd, POLLIN, 0}, {wakeFds[0], POLLIN, 0}};
+            if (poll(fds, 2, timeout) < 0 && errno != EINTR) {
+                return;
+            }
+            if (fds[1].revents != 0) {
+                return;
+            }
+            if (fds[0].revents & POLLIN) {
+                readEvents();
+            }
+
+            Clock::time_point now = Clock::now();
+            for (auto file = pending.begin(); file != pending.end();) {
+                if (file->second <= now) {
+                    std::string path = file->first;
+                    file = pending.erase(file);
+                    ready(path);
+                } else {
+                    ++file;
+                }
+            }
+        }
+#else
+        (void)ready;
+#endif
+    }
+
+    /**
+     * Makes run return. Only writes to a pipe, so it can be called from a signal handler.
+     */
+    void stop() {
+#ifdef MONOC_WATCH
+        char wake = 1;
+        if (write(wakeFds[1], &wake, 1) < 0) {
+            // Nothing to do, run is already stopping or was never started
+        }
+#endif
+    }
+
+private:
+    typedef std::chrono::steady_clock Clock;
+
+    std::chrono::milliseconds settleTime;
+    std::map<int, std::string> folders; // Watch descriptor to folder
+    std::map<std::string, Clock::time_point> pending; // Files that have been written, to when they're settled
+
+#ifdef MONOC_WATCH
+    int inotifyFd = -1;
+    int wakeFds[2] = {-1, -1};
+
+    /**
+     * Reads every queued event, and moves each file's settle time accordingly.
+     */
+    void readEvents() {
+        alignas(struct inotify_event) char buffer[64 * 1024];
+        ssize_t size;
+        while ((size = read(inotifyFd, buffer, sizeof(buffer))) > 0) {
+            Clock::time_point settled = Clock::now() + settleTime;
+            for (char *next = buffer; next < buffer + size;) {
+                const struct inotify_event *event = (const struct inotify_event *)next;
+                next += sizeof(struct inotify_event) + event->len;
+                auto folder = folders.find(event->wd);
+                if (event->len == 0 || (event->mask & IN_ISDIR) || folder == folders.end()) {
+                    continue;
+                }
+                std::string path = folder->second + "/" + event->name;
+                if (event->mask & (IN_CLOSE_WRITE | IN_MOVED_TO)) {
+                    pending[path] = settled;
+                } else if (event->mask & IN_MODIFY) {
+                    // Only files that were closed once already are waiting, the rest aren't finished anyway
+                    auto file = pending.find(path);
+                    if (file != pending.end()) {
+                        file->second = settled;
+                    }
+                } else if (event->mask & (IN_DELETE | IN_MOVED_FROM)) {
+                    pending.erase(path);
+                }
+            }
+        }
+    }
+#endif
+};